@@ -0,0 +1,262 @@
+/*
+    vibration_check - compare the fixed-point feature engine (../vibration.c) with a double precision reference on a PC
+
+    Build and run (from this folder), once without and once with the decimating FIR:
+        gcc -O2 -Wall -I.. vibration_check.c ../vibration.c -lm -o vibration_check && ./vibration_check
+        gcc -O2 -Wall -I.. -DVIB_DECIMATE=2 vibration_check.c ../vibration.c -lm -o vibration_check && ./vibration_check
+
+    Synthetic 3200 Hz signals (tones on 1 g of gravity, impulses, noise, a swing past the square table) go through both.
+    Every window is compared: RMS within 1 % + 1/2 LSB, peak within 1.5 LSB, crest factor within the error those two
+    allow, zero crossings within 5 % + 2 (the last two only for an RMS of at least 4x the hysteresis and once the DC
+    tracker has settled, see Compare()).
+    Prints the worst deviations, the exit code is 1 if a window is out of tolerance.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "vibration.h"
+
+#define RATE_HZ     3200
+#define WINDOWS     40 //Windows per signal
+#define RMS_WELL_DEFINED (4.0 * VIB_ZC_HYSTERESIS) //LSB: crest factor and zero crossings are compared from this RMS up
+#define SETTLED_WINDOW   ((4 << VIB_DC_SHIFT) >> VIB_WINDOW_LOG2) //...and after 4 time constants of the DC tracker
+
+typedef struct
+{
+    double dc[VIB_AXES];
+    double sumSquares[VIB_AXES];
+    double peak[VIB_AXES];
+    int    crossings[VIB_AXES];
+    int    sign[VIB_AXES];
+    int    count;
+    int    primed;
+    double history[VIB_DECIMATE + 1][VIB_AXES][4];
+    int    phase[VIB_DECIMATE + 1];
+    int    firPrimed[VIB_DECIMATE + 1];
+} Reference;
+
+typedef struct
+{
+    double rms[VIB_AXES];
+    double peak[VIB_AXES];
+    double crest[VIB_AXES];
+    int    crossings[VIB_AXES];
+} RefFeatures;
+
+static double worstRms, worstPeak, worstCrest;
+static int worstCrossings;
+static int failures;
+
+//Same definitions as vibration.c without the integer steps: exact FIR, exact DC mean, no rounding of the results
+static int Reference_Push(Reference *ref, const double *sample, RefFeatures *features)
+{
+    double value[VIB_AXES];
+
+    for(int axis = 0; axis < VIB_AXES; axis++)
+    {
+        value[axis] = sample[axis];
+    }
+    for(int stage = 0; stage < VIB_DECIMATE; stage++)
+    {
+        int out = ref->phase[stage];
+
+        for(int axis = 0; axis < VIB_AXES; axis++)
+        {
+            double *h = ref->history[stage][axis];
+            double x = value[axis];
+
+            if(!ref->firPrimed[stage])
+            {
+                h[0] = h[1] = h[2] = h[3] = x;
+            }
+            if(out)
+            {
+                value[axis] = (h[0] + 4 * h[1] + 6 * h[2] + 4 * h[3] + x) / 16;
+            }
+            h[0] = h[1];
+            h[1] = h[2];
+            h[2] = h[3];
+            h[3] = x;
+        }
+        ref->firPrimed[stage] = 1;
+        ref->phase[stage] = !out;
+        if(!out)
+        {
+            return 0;
+        }
+    }
+
+    for(int axis = 0; axis < VIB_AXES; axis++)
+    {
+        double ac;
+        int sign;
+
+        if(!ref->primed)
+        {
+            ref->dc[axis] = value[axis] * (1 << VIB_DC_SHIFT);
+        }
+        ac = value[axis] - ref->dc[axis] / (1 << VIB_DC_SHIFT);
+        ref->dc[axis] += ac;
+
+        ref->sumSquares[axis] += ac * ac;
+        if(fabs(ac) > ref->peak[axis])
+        {
+            ref->peak[axis] = fabs(ac);
+        }
+        sign = (ac > VIB_ZC_HYSTERESIS) ? 1 : (ac < -VIB_ZC_HYSTERESIS) ? -1 : 0;
+        if(sign)
+        {
+            if(ref->sign[axis] && sign != ref->sign[axis])
+            {
+                ref->crossings[axis]++;
+            }
+            ref->sign[axis] = sign;
+        }
+    }
+    ref->primed = 1;
+
+    if(++ref->count < (1 << VIB_WINDOW_LOG2))
+    {
+        return 0;
+    }
+    for(int axis = 0; axis < VIB_AXES; axis++)
+    {
+        features->rms[axis] = sqrt(ref->sumSquares[axis] / ref->count);
+        features->peak[axis] = ref->peak[axis];
+        features->crest[axis] = features->rms[axis] > 0 ? 100 * ref->peak[axis] / features->rms[axis] : 0;
+        features->crossings[axis] = ref->crossings[axis];
+        ref->sumSquares[axis] = 0;
+        ref->peak[axis] = 0;
+        ref->crossings[axis] = 0;
+    }
+    ref->count = 0;
+    return 1;
+}
+
+//The engine works on integer LSB after every rounding step (FIR output, DC estimate), so each value it sees can be
+//1/2 LSB off the exact one, and the rounded DC estimate stops 1/2 LSB short of a new level. The tolerances follow from
+//that: RMS and peak get an absolute margin, the crest factor the combined relative margin of both. Crest factor and
+//zero crossings are only compared where they are well defined: with an RMS of a few LSB a single rounded sample moves
+//the ratio, and while the DC estimate settles its offset sweeps through the signal, so which peaks leave the
+//hysteresis band depends on that 1/2 LSB.
+static void Compare(const char *name, const VibFeatures *fixed, const RefFeatures *ref)
+{
+    for(int axis = 0; axis < VIB_AXES; axis++)
+    {
+        double rms = (double)fixed->rms[axis] / VIB_RMS_SCALE;
+        double rmsTolerance = 0.01 * ref->rms[axis] + 0.5;
+        double peakTolerance = 1.5;
+        double dRms = fabs(rms - ref->rms[axis]);
+        double dPeak = fabs(fixed->peak[axis] - ref->peak[axis]);
+        double dCrest = 0;
+        int dCrossings = 0;
+        int bad = dRms > rmsTolerance || dPeak > peakTolerance;
+
+        if(ref->rms[axis] >= RMS_WELL_DEFINED && fixed->index >= SETTLED_WINDOW)
+        {
+            double crestTolerance = ref->crest[axis] * (peakTolerance / ref->peak[axis] + rmsTolerance / ref->rms[axis]) + 1;
+
+            dCrest = fabs(fixed->crest[axis] - ref->crest[axis]);
+            dCrossings = abs(fixed->crossings[axis] - ref->crossings[axis]);
+            bad |= dCrest > crestTolerance || dCrossings > ref->crossings[axis] / 20 + 2;
+        }
+
+        worstRms = fmax(worstRms, dRms);
+        worstPeak = fmax(worstPeak, dPeak);
+        worstCrest = fmax(worstCrest, dCrest);
+        worstCrossings = dCrossings > worstCrossings ? dCrossings : worstCrossings;
+
+        if(bad)
+        {
+            printf("%s window %lu axis %d: rms %.3f/%.3f peak %u/%.2f crest %u/%.2f crossings %u/%d\n", name,
+                   (unsigned long)fixed->index, axis, rms, ref->rms[axis], fixed->peak[axis], ref->peak[axis],
+                   fixed->crest[axis], ref->crest[axis], fixed->crossings[axis], ref->crossings[axis]);
+            failures++;
+        }
+    }
+}
+
+//Deterministic noise in -amplitude...amplitude
+static double Noise(double amplitude)
+{
+    return amplitude * (2.0 * rand() / RAND_MAX - 1.0);
+}
+
+static void Signal(int kind, long n, double *sample)
+{
+    double t = (double)n / RATE_HZ;
+
+    switch(kind)
+    {
+        case 0: //Motor: 50 Hz on X, 120 Hz on Y, gravity on Z with 1 kHz (above the decimated band)
+            sample[0] = 3 + 40 * sin(2 * M_PI * 50 * t) + Noise(2);
+            sample[1] = -5 + 15 * sin(2 * M_PI * 120 * t + 1) + Noise(2);
+            sample[2] = 256 + 8 * sin(2 * M_PI * 1000 * t) + Noise(1);
+            break;
+        case 1: //Bearing fault: 100 impulses/s ringing at 800 Hz on X, a slow tilt on Y, noise only on Z
+            sample[0] = 150 * exp(-(fmod(t, 0.01)) * 2000) * sin(2 * M_PI * 800 * t) + Noise(2);
+            sample[1] = 100 * sin(2 * M_PI * 0.2 * t);
+            sample[2] = 256 + Noise(3);
+            break;
+        default: //Large swing: 600 LSB (past the square table) at 30 Hz, a DC step on Y, silence on Z
+            sample[0] = 600 * sin(2 * M_PI * 30 * t);
+            sample[1] = (n < RATE_HZ) ? 0 : 200;
+            sample[2] = -256;
+            break;
+    }
+}
+
+int main(void)
+{
+    static const char *names[] = {"motor", "bearing", "swing"};
+
+    printf("window %u samples, %u decimation stages\n", 1u << VIB_WINDOW_LOG2, VIB_DECIMATE);
+    srand(1);
+
+    for(int kind = 0; kind < 3; kind++)
+    {
+        VibEngine engine;
+        Reference ref = {0};
+        VibFeatures fixed;
+        RefFeatures features;
+        long windows = 0;
+
+        Vib_Init(&engine);
+        for(long n = 0; windows < WINDOWS; n++)
+        {
+            double sample[VIB_AXES];
+            int16_t raw[VIB_AXES];
+            uint8_t out;
+
+            Signal(kind, n, sample);
+            for(int axis = 0; axis < VIB_AXES; axis++)
+            {
+                raw[axis] = (int16_t)lround(sample[axis]); //The sensor delivers integers, both sides get the same ones
+                sample[axis] = raw[axis];
+            }
+
+            out = Vib_Push(&engine, raw, &fixed, 0);
+            if(Reference_Push(&ref, sample, &features) != !!(out & VIB_OUT_WINDOW))
+            {
+                printf("%s: the windows are out of step at sample %ld\n", names[kind], n);
+                return 1;
+            }
+            if(out & VIB_OUT_WINDOW)
+            {
+                Compare(names[kind], &fixed, &features);
+                if(windows == WINDOWS - 1)
+                {
+                    printf("%s: rms %.2f %.2f %.2f, peak %u %u %u, crest %u %u %u, crossings %u %u %u\n", names[kind],
+                           (double)fixed.rms[0] / VIB_RMS_SCALE, (double)fixed.rms[1] / VIB_RMS_SCALE, (double)fixed.rms[2] / VIB_RMS_SCALE,
+                           fixed.peak[0], fixed.peak[1], fixed.peak[2], fixed.crest[0], fixed.crest[1], fixed.crest[2],
+                           fixed.crossings[0], fixed.crossings[1], fixed.crossings[2]);
+                }
+                windows++;
+            }
+        }
+    }
+
+    printf("worst deviation: rms %.3f LSB, peak %.2f LSB, crest %.2f, crossings %d, %d failures\n", worstRms, worstPeak,
+           worstCrest, worstCrossings, failures);
+    return failures ? 1 : 0;
+}
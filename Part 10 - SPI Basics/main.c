@@ -5,6 +5,7 @@
 
 #include "debug.h"
 #include <stdlib.h> //Include this for more math stuff
+#include "vibration.h"
 
 /* Global define */
 //SPI PINS
@@ -12,10 +13,56 @@
 //MOSI: PC6
 //SCK: PC5
 //CS*: PC4 (CS can be arbitrary)
+//INT PINS
+//INT1: PD2 (watermark interrupt, EXTI line 2)
+//INT2: PD3 (not used)
+
+#define ADXL345_USE_FIFO 1 //1: FIFO stream mode, the watermark interrupt drains the FIFO, 0: read one sample every 10 ms
+#define ADXL345_WATERMARK 16 //FIFO entries that trigger the interrupt (1-31): 16 = every 5 ms at 3200 Hz, 16 entries of margin
+#define ADXL345_RATE_HZ 3200 //Output data rate of BW_RATE 0x0F, one report is printed per this many samples
+#define ACCEL_BUFFER_SAMPLES 64 //Samples queued between the interrupt and the main loop (6 bytes each)
+#define ADXL345_FEATURES 1 //With the FIFO: 1 - one vibration feature record per window (vibration.h), 0 - the mean once per second
+
+//Battery mode: the CH32V003 stays in standby and the ADXL345 watches for motion in low-power mode. Its activity
+//interrupt on INT1 wakes the MCU for a 3200 Hz burst (feature records), the inactivity interrupt ends the event.
+#define ADXL345_WAKE_ON_MOTION 0 //1: wake-on-motion bursts (needs ADXL345_USE_FIFO and ADXL345_FEATURES), 0: stream
+#define WAKE_THRESH_ACT 4 //THRESH_ACT, 62.5 mg/LSB: a change of 0.25 g on any axis is activity
+#define WAKE_THRESH_INACT 2 //THRESH_INACT, 62.5 mg/LSB: below 0.125 g...
+#define WAKE_TIME_INACT 5 //TIME_INACT, 1 s/LSB: ...for 5 s is inactivity
+#define WAKE_BURST_WINDOWS 2 //Feature windows captured per wake-up: 2 x 160 ms
+#define WAKE_EVENTS_PER_HOUR 12 //Motion events per hour assumed by the current estimate
+
+//Supply currents of the estimate, uA: replace them with what your board draws. ADXL345: datasheet typicals at 2.5 V.
+//CH32V003: standby as measured in Part 9, run at 48 MHz approximate (the MCU is counted as running all the time it
+//is awake, although it sleeps between the watermarks). The printed averages are a model built from these numbers,
+//not a measurement of this program: check them with a meter in series with the supply before relying on them.
+#define CURRENT_MCU_RUN_UA 4500
+#define CURRENT_MCU_STANDBY_UA 10
+#define CURRENT_ADXL_3200HZ_UA 140 //Normal mode, 3200 Hz: the burst and the polling loop
+#define CURRENT_ADXL_LOWPOWER_UA 34 //LOW_POWER, 12.5 Hz: watching for activity/inactivity
+
+#if ADXL345_WAKE_ON_MOTION && !(ADXL345_USE_FIFO && ADXL345_FEATURES)
+#error "ADXL345_WAKE_ON_MOTION captures its bursts through the FIFO and the feature engine"
+#endif
 
 /* Global Variable */
 uint8_t buffer[10]; //Buffer for the bytes received from the accelerometer
 
+typedef struct
+{
+    int16_t x;
+    int16_t y;
+    int16_t z;
+} AccelSample;
+
+AccelSample accelSamples[ACCEL_BUFFER_SAMPLES]; //Ring buffer: the interrupt writes at accelHead, the main loop reads at accelTail
+volatile uint8_t accelHead = 0;
+volatile uint8_t accelTail = 0;
+volatile uint32_t accelDropped = 0; //Samples lost because the main loop didn't empty accelSamples[] in time
+volatile uint32_t fifoOverruns = 0; //Drains that found the overrun bit set: the FIFO was full and the sensor overwrote samples
+volatile uint32_t fifoBursts = 0; //Number of FIFO drains
+volatile uint8_t adxlEvents = 0; //INT_SOURCE bits seen by the interrupt since the main loop last took them
+
 void USARTx_CFG(void)
 {
     GPIO_InitTypeDef  GPIO_InitStructure = {0};
@@ -72,7 +119,11 @@ void SPI_Initialize(void)
     SPI_InitStructure.SPI_CPHA = SPI_CPHA_2Edge; //Second clock edge is used to sample and shift data 
     //CPOL is high, so 1st transition is H->L, and the 2nd is L->H. This is to fulfil the IMU's requirements
     SPI_InitStructure.SPI_NSS = SPI_NSS_Soft; //Bit-banged chip select (CS)
+#if ADXL345_USE_FIFO
+    SPI_InitStructure.SPI_BaudRatePrescaler = SPI_BaudRatePrescaler_16; //3 MHz bus: 1600/3200 Hz need at least 2 MHz (datasheet), 5 MHz max
+#else
     SPI_InitStructure.SPI_BaudRatePrescaler = SPI_BaudRatePrescaler_32; //1.5 MHz bus
+#endif
     SPI_InitStructure.SPI_FirstBit = SPI_FirstBit_MSB; //MSB-first protocol
     SPI_Init(SPI1, &SPI_InitStructure);
 
@@ -124,6 +175,33 @@ void ADXL345_ReadRegister(uint8_t registerAddress, int numberOfBytes, uint8_t *b
     GPIO_WriteBit(GPIOC, GPIO_Pin_4, Bit_SET); //PC4 - CS -> HIGH    
 }
 
+void IntPinsInit(void)
+{
+    GPIO_InitTypeDef GPIO_InitStructure = {0};
+    EXTI_InitTypeDef EXTI_InitStructure = {0};
+    NVIC_InitTypeDef NVIC_InitStructure = {0};
+
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_AFIO | RCC_APB2Periph_GPIOD, ENABLE);
+
+    GPIO_InitStructure.GPIO_Pin = GPIO_Pin_2 | GPIO_Pin_3; //PD2 - INT1, PD3 - INT2
+    GPIO_InitStructure.GPIO_Mode = GPIO_Mode_IN_FLOATING; //The ADXL345 drives its INT pins (push-pull)
+    GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+    GPIO_Init(GPIOD, &GPIO_InitStructure);
+
+    GPIO_EXTILineConfig(GPIO_PortSourceGPIOD, GPIO_PinSource2); //PD2
+    EXTI_InitStructure.EXTI_Line = EXTI_Line2;
+    EXTI_InitStructure.EXTI_Mode = EXTI_Mode_Interrupt;
+    EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Rising; //The INT pins are active high (INT_INVERT = 0 in DATA_FORMAT)
+    EXTI_InitStructure.EXTI_LineCmd = ENABLE;
+    EXTI_Init(&EXTI_InitStructure);
+
+    NVIC_InitStructure.NVIC_IRQChannel = EXTI7_0_IRQn;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 1;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+}
+
 void printAccelG(int16_t raw)
 {
     //raw/256.0 gives g; scaled = raw * 10000/256 gives fixed-point g*10000. We use 10000 because we want 4 digits
@@ -183,6 +261,249 @@ void ADXL345_Init()
     }
 }
 
+void ADXL345_InitFIFO(uint8_t watermark)
+{
+    ADXL345_WriteRegister(0x2D, 0x00); //Standby while the FIFO and the interrupts are changed
+    ADXL345_WriteRegister(0x2E, 0x00); //INT_ENABLE: everything off
+
+    ADXL345_WriteRegister(0x2F, 0x00); //INT_MAP: every interrupt goes to INT1
+
+    ADXL345_WriteRegister(0x38, 0x80 | (watermark & 0x1F)); //FIFO_CTL: stream mode, watermark
+    // D7 D6 D5 D4 D3 D2 D1 D0
+    // 1  0  0  w  w  w  w  w    -> FIFO_MODE = 10 (stream: the newest 32 samples are kept), samples = w
+
+    ADXL345_WriteRegister(0x2E, 0x02); //INT_ENABLE: watermark
+    // D7 D6 D5 D4 D3 D2 D1 D0
+    // 0  0  0  0  0  0  1  0
+
+    ADXL345_WriteRegister(0x2D, 0x08); //Measure again, the FIFO starts filling
+}
+
+//The FIFO needs 5 us after a data read before the next entry can be read (datasheet). The command byte only covers
+//that up to 1.6 MHz, at 3 MHz it takes 2.7 us. No Delay_Us(): it stops SysTick, the wake-on-motion awake timer.
+//A volatile loop iteration takes at least 6 cycles, 40 of them are 5 us at 48 MHz without counting the command byte.
+static void ADXL345_FIFOPopDelay(void)
+{
+    for(volatile uint8_t i = 0; i < 40; i++);
+}
+
+//Read every queued sample: FIFO_STATUS once, then one 6-byte burst per entry. A burst pops one entry, the address
+//would continue with FIFO_CTL, so every entry needs its own CS cycle, with the pop delay between two entries.
+uint8_t ADXL345_DrainFIFO(void)
+{
+    uint8_t source;
+    uint8_t entries;
+    uint8_t raw[6];
+
+    ADXL345_ReadRegister(0x30, 1, &source); //INT_SOURCE: D0 = overrun, reading it clears activity (D4) and inactivity (D3)
+    if(source & 0x01)
+    {
+        fifoOverruns++;
+    }
+    adxlEvents |= source;
+    if(!(source & 0x02))
+    {
+        return 0; //Not the watermark: activity/inactivity, the FIFO is bypassed between the bursts
+    }
+
+    ADXL345_ReadRegister(0x39, 1, &entries); //FIFO_STATUS: D5-D0 = entries
+    entries &= 0x3F;
+
+    for(uint8_t i = 0; i < entries; i++)
+    {
+        if(i)
+        {
+            ADXL345_FIFOPopDelay(); //The previous entry must leave the FIFO first
+        }
+        ADXL345_ReadRegister(0x32, 6, raw); //DATAX0...DATAZ1 of the oldest entry
+
+        uint8_t next = (accelHead + 1) % ACCEL_BUFFER_SAMPLES;
+        if(next == accelTail)
+        {
+            accelDropped++; //Read anyway, otherwise the watermark stays high
+            continue;
+        }
+        accelSamples[accelHead].x = (int16_t)(((int16_t)raw[1]<<8) | raw[0]);
+        accelSamples[accelHead].y = (int16_t)(((int16_t)raw[3]<<8) | raw[2]);
+        accelSamples[accelHead].z = (int16_t)(((int16_t)raw[5]<<8) | raw[4]);
+        accelHead = next;
+    }
+    fifoBursts++;
+    return entries;
+}
+
+void printFeatures(const VibFeatures *features)
+{
+    printf("%lu,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u,%u\r\n", (unsigned long)features->index,
+           features->rms[0], features->rms[1], features->rms[2], features->peak[0], features->peak[1], features->peak[2],
+           features->crest[0], features->crest[1], features->crest[2],
+           features->crossings[0], features->crossings[1], features->crossings[2]);
+}
+
+#if ADXL345_WAKE_ON_MOTION
+//Low-power watch: 12.5 Hz in LOW_POWER mode, activity and inactivity on INT1, FIFO bypassed. With the link bit the
+//two alternate: after this call the sensor first waits for WAKE_TIME_INACT s of stillness, only then for activity,
+//so a long motion wakes the MCU once at its start and once at its end, not at every sample above the threshold.
+void ADXL345_InitWake(void)
+{
+    ADXL345_WriteRegister(0x2D, 0x00); //Standby while the thresholds and the interrupts are changed
+    ADXL345_WriteRegister(0x2E, 0x00); //INT_ENABLE: everything off
+    ADXL345_WriteRegister(0x38, 0x00); //FIFO_CTL: bypass
+
+    ADXL345_WriteRegister(0x2C, 0x17); //BW_RATE: LOW_POWER, 12.5 Hz
+    // D7 D6 D5 D4 D3 D2 D1 D0
+    // 0  0  0  1  0  1  1  1
+
+    ADXL345_WriteRegister(0x24, WAKE_THRESH_ACT); //THRESH_ACT
+    ADXL345_WriteRegister(0x25, WAKE_THRESH_INACT); //THRESH_INACT
+    ADXL345_WriteRegister(0x26, WAKE_TIME_INACT); //TIME_INACT
+    ADXL345_WriteRegister(0x27, 0xFF); //ACT_INACT_CTL: AC-coupled (relative to the level at the start) on X, Y, Z
+    // D7 D6 D5 D4 D3 D2 D1 D0
+    // 1  1  1  1  1  1  1  1    -> ACT ac/dc, ACT_X, ACT_Y, ACT_Z, INACT ac/dc, INACT_X, INACT_Y, INACT_Z
+
+    ADXL345_WriteRegister(0x2F, 0x00); //INT_MAP: every interrupt goes to INT1 (PD2, EXTI line 2)
+    ADXL345_WriteRegister(0x2E, 0x18); //INT_ENABLE: activity, inactivity
+    // D7 D6 D5 D4 D3 D2 D1 D0
+    // 0  0  0  1  1  0  0  0
+
+    ADXL345_WriteRegister(0x2D, 0x28); //POWER_CTL: link, measure
+    // D7 D6 D5 D4 D3 D2 D1 D0
+    // 0  0  1  0  1  0  0  0
+}
+
+//Switch the sensor to 3200 Hz, collect WAKE_BURST_WINDOWS feature windows through the FIFO, then back to the watch
+void WakeBurst(VibEngine *vibration)
+{
+    VibFeatures features;
+    uint8_t windows = 0;
+
+    Vib_Init(vibration); //The orientation may have changed since the last burst: the DC tracker starts over
+    ADXL345_WriteRegister(0x2C, 0x0F); //BW_RATE: normal power, 3200 Hz
+    ADXL345_InitFIFO(ADXL345_WATERMARK);
+
+    while(windows < WAKE_BURST_WINDOWS)
+    {
+        while(accelTail != accelHead && windows < WAKE_BURST_WINDOWS)
+        {
+            if(Vib_Push(vibration, &accelSamples[accelTail].x, &features, 0) & VIB_OUT_WINDOW)
+            {
+                printFeatures(&features);
+                windows++;
+            }
+            accelTail = (accelTail + 1) % ACCEL_BUFFER_SAMPLES;
+        }
+        if(windows < WAKE_BURST_WINDOWS)
+        {
+            __WFI(); //Sleep (not standby) until the next watermark
+        }
+    }
+
+    ADXL345_InitWake();
+    accelTail = accelHead; //The rest of the burst is not needed
+}
+
+//Modelled average current when every hour has WAKE_EVENTS_PER_HOUR motion events that keep the MCU awake for
+//'awakeMs' each, the rest of the time both parts are in their low-power state. The charge (ms x uA) is summed in
+//64 bits: 4640 uA awake overflows 32 bits after about 925 s.
+void printCurrentEstimate(uint32_t awakeMs)
+{
+    uint32_t periodMs = 3600000UL / WAKE_EVENTS_PER_HOUR;
+    uint32_t awakeUA = CURRENT_MCU_RUN_UA + CURRENT_ADXL_3200HZ_UA;
+    uint32_t idleUA = CURRENT_MCU_STANDBY_UA + CURRENT_ADXL_LOWPOWER_UA;
+    uint64_t charge;
+    uint32_t averageUA;
+
+    if(awakeMs > periodMs)
+    {
+        awakeMs = periodMs;
+    }
+    charge = (uint64_t)awakeMs * awakeUA + (uint64_t)(periodMs - awakeMs) * idleUA;
+    averageUA = (uint32_t)((charge + periodMs / 2) / periodMs);
+
+    //Polling (ADXL345_USE_FIFO 0): the MCU runs all the time and the sensor measures at 3200 Hz
+    printf("Awake %lu ms per event. Estimate from the CURRENT_ values at %u events/h: ~%lu uA average (idle %lu uA), polling ~%lu uA\r\n",
+           (unsigned long)awakeMs, WAKE_EVENTS_PER_HOUR, (unsigned long)averageUA, (unsigned long)idleUA,
+           (unsigned long)awakeUA);
+}
+
+//EXTI line 2 (INT1): an interrupt for the FIFO drain during a burst, an event for the standby wake-up. Standby is left
+//through an EXTI event and WFE, as in Part 9 (the AWU there, INT1 here).
+void IntPin1Mode(EXTIMode_TypeDef mode)
+{
+    EXTI_InitTypeDef EXTI_InitStructure = {0};
+
+    EXTI_InitStructure.EXTI_Line = EXTI_Line2;
+    EXTI_InitStructure.EXTI_Mode = mode;
+    EXTI_InitStructure.EXTI_Trigger = EXTI_Trigger_Rising;
+    EXTI_InitStructure.EXTI_LineCmd = ENABLE;
+    EXTI_Init(&EXTI_InitStructure);
+    EXTI_ClearITPendingBit(EXTI_Line2); //No stale interrupt from the other mode
+}
+
+//Never returns: standby, wake on INT1, burst on activity, current estimate on inactivity (the end of the event)
+void WakeOnMotion_Run(VibEngine *vibration)
+{
+    uint32_t awakeTicks = 0; //SysTick (HCLK/8) counts while awake during the current event
+    uint8_t bursts = 0;
+
+    ADXL345_InitWake();
+    SysTick->CTLR &= ~(1 << 0);
+    SysTick->CNT = 0; //Not what Delay_Ms() left
+
+    while(1)
+    {
+        uint8_t events;
+
+        while(USART_GetFlagStatus(USART1, USART_FLAG_TC) == RESET); //Let the last line leave before the clock stops
+        awakeTicks += SysTick->CNT;
+        SysTick->CTLR &= ~(1 << 0);
+
+        __disable_irq();
+        events = adxlEvents;
+        adxlEvents = 0;
+        __enable_irq();
+
+        if(!events)
+        {
+            //The ADXL345 holds INT1 high until INT_SOURCE is read, so a high pin means the edge has already passed:
+            //read the source instead of sleeping. An edge after the pin check is an event that WFE catches.
+            IntPin1Mode(EXTI_Mode_Event);
+            if(GPIO_ReadInputDataBit(GPIOD, GPIO_Pin_2) == Bit_RESET)
+            {
+                PWR_EnterSTANDBYMode(PWR_STANDBYEntry_WFE);
+                SystemInit(); //Standby stopped the PLL: back to the 48 MHz of the UART and SPI settings
+            }
+            ADXL345_DrainFIFO(); //FIFO bypassed: only reads INT_SOURCE into adxlEvents (no interrupt can interleave)
+            IntPin1Mode(EXTI_Mode_Interrupt); //The burst drains the FIFO from the interrupt; an edge missed here
+                                              //leaves INT1 high, which the pin check above catches on the next round
+            __disable_irq();
+            events = adxlEvents;
+            adxlEvents = 0;
+            __enable_irq();
+        }
+
+        SysTick->CMP = 0xFFFFFFFF; //Free-running awake timer, Delay_Ms() is not used while it runs
+        SysTick->CNT = 0;
+        SysTick->CTLR |= (1 << 0);
+
+        if(events & 0x10) //Activity
+        {
+            printf("Motion\r\n");
+            WakeBurst(vibration);
+            bursts++;
+        }
+        if((events & 0x08) && bursts) //Inactivity after a burst: the event is over
+        {
+            awakeTicks += SysTick->CNT;
+            printf("Still, %u burst(s). ", bursts);
+            printCurrentEstimate(awakeTicks / (SystemCoreClock / 8000));
+            awakeTicks = 0;
+            bursts = 0;
+        }
+    }
+}
+#endif
+
 /*********************************************************************
  * @fn      main
  *
@@ -204,10 +525,84 @@ int main(void)
     printf("CH32V003F4P6 - DEMO 10 - SPI Communication using ADXL345 accelerometer\n");    
 
     Delay_Ms(3000);
+
+#if ADXL345_USE_FIFO && ADXL345_FEATURES
+    static VibEngine vibration;
+    VibFeatures features;
+
+    Vib_Init(&vibration);
+    //One line per window instead of 3200 samples/s: the raw values would need ~100 kB/s, the UART carries 11.5 kB/s
+    printf("Window: %u samples, %u Hz / %u. Record: window,rms x,y,z (1/%u LSB),peak x,y,z (LSB),crest x,y,z (x100),zero crossings x,y,z\r\n",
+           1u << VIB_WINDOW_LOG2, ADXL345_RATE_HZ, 1u << VIB_DECIMATE, VIB_RMS_SCALE);
+#elif ADXL345_USE_FIFO
+    int32_t sumX = 0, sumY = 0, sumZ = 0; //Sums of one report
+    uint16_t reportCount = 0; //Samples in the sums
+#endif
+#if ADXL345_WAKE_ON_MOTION
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_PWR, ENABLE);
+    WakeOnMotion_Run(&vibration);
+#endif
+#if ADXL345_USE_FIFO
+    ADXL345_InitFIFO(ADXL345_WATERMARK); //From now on the interrupt collects the samples
+#endif
     
     while(1)
     {
+#if ADXL345_USE_FIFO && ADXL345_FEATURES
+        while(accelTail != accelHead)
+        {
+            if(Vib_Push(&vibration, &accelSamples[accelTail].x, &features, 0) & VIB_OUT_WINDOW) //AccelSample is x, y, z in a row
+            {
+                printFeatures(&features);
+            }
+            accelTail = (accelTail + 1) % ACCEL_BUFFER_SAMPLES;
+        }
+#elif ADXL345_USE_FIFO
+        while(accelTail != accelHead) //Everything the interrupt queued since the last wake-up
+        {
+            sumX += accelSamples[accelTail].x;
+            sumY += accelSamples[accelTail].y;
+            sumZ += accelSamples[accelTail].z;
+            reportCount++;
+            accelTail = (accelTail + 1) % ACCEL_BUFFER_SAMPLES;
+        }
+
+        if(reportCount >= ADXL345_RATE_HZ) //About once per second: 3200 samples can't be printed one by one
+        {
+            printf("Samples: %u, bursts: %lu, FIFO overruns: %lu, dropped: %lu, mean X:", reportCount, (unsigned long)fifoBursts, (unsigned long)fifoOverruns, (unsigned long)accelDropped);
+            printAccelG(sumX / reportCount);
+            printf(",Y:");
+            printAccelG(sumY / reportCount);
+            printf(",Z:");
+            printAccelG(sumZ / reportCount);
+            printf("\r\n");
+            sumX = sumY = sumZ = 0;
+            reportCount = 0;
+        }
+#endif
+
+#if ADXL345_USE_FIFO
+        //Sleep until the next watermark interrupt. If it came right before __WFI(), its samples wait for the next one,
+        //the FIFO has room for another ADXL345_WATERMARK entries.
+        __WFI();
+#else
          ADXL345_ReadAcceleration();
          Delay_Ms(10);
+#endif
+    }
+}
+
+void EXTI7_0_IRQHandler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
+
+void EXTI7_0_IRQHandler(void)
+{
+    if(EXTI_GetITStatus(EXTI_Line2) != RESET)
+    {
+        EXTI_ClearITPendingBit(EXTI_Line2); //Clear ISR flag before the drain, an edge during it is not lost
+
+        do
+        {
+            ADXL345_DrainFIFO();
+        }while(GPIO_ReadInputDataBit(GPIOD, GPIO_Pin_2) == Bit_SET); //INT1 is a level: still high = the watermark was reached again, no new edge comes
     }
 }
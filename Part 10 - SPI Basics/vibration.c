@@ -0,0 +1,158 @@
+#include "vibration.h"
+#include <string.h>
+
+//Squares of 0...255, filled in by the compiler
+#define VIB_SQ(n)       (uint16_t)((n) * (n))
+#define VIB_SQ4(n)      VIB_SQ(n), VIB_SQ((n) + 1), VIB_SQ((n) + 2), VIB_SQ((n) + 3)
+#define VIB_SQ16(n)     VIB_SQ4(n), VIB_SQ4((n) + 4), VIB_SQ4((n) + 8), VIB_SQ4((n) + 12)
+#define VIB_SQ64(n)     VIB_SQ16(n), VIB_SQ16((n) + 16), VIB_SQ16((n) + 32), VIB_SQ16((n) + 48)
+
+static const uint16_t vibSquares[VIB_SQUARE_TABLE] = {VIB_SQ64(0), VIB_SQ64(64), VIB_SQ64(128), VIB_SQ64(192)};
+
+void Vib_Init(VibEngine *engine)
+{
+    memset(engine, 0, sizeof(VibEngine));
+}
+
+//Integer square root, bit by bit: shifts, adds and compares only
+static uint32_t Vib_Sqrt(uint64_t value)
+{
+    uint64_t root = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    while(bit > value)
+    {
+        bit >>= 2;
+    }
+    while(bit)
+    {
+        if(value >= root + bit)
+        {
+            value -= root + bit;
+            root = (root >> 1) + bit;
+        }
+        else
+        {
+            root >>= 1;
+        }
+        bit >>= 2;
+    }
+    return (uint32_t)root;
+}
+
+#if VIB_DECIMATE
+//One 1-4-6-4-1 / 16 low-pass stage that keeps every second output: zeros at the new Nyquist frequency, gain 1.
+//1 - an output was produced in 'sample'.
+static uint8_t Vib_Decimate(VibEngine *engine, uint8_t stage, int16_t *sample)
+{
+    uint8_t out = engine->phase[stage];
+
+    for(uint8_t axis = 0; axis < VIB_AXES; axis++)
+    {
+        int16_t *h = engine->history[stage][axis];
+        int32_t x = sample[axis];
+
+        if(!(engine->firPrimed & (1 << stage)))
+        {
+            h[0] = h[1] = h[2] = h[3] = (int16_t)x; //Start from the first input instead of a step from 0
+        }
+
+        if(out)
+        {
+            int32_t outer = h[1] + h[3];
+            int32_t sum = h[0] + x + (outer << 2) + (h[2] << 2) + (h[2] << 1);
+
+            sample[axis] = (int16_t)((sum + 8) >> 4); //Rounded
+        }
+        h[0] = h[1];
+        h[1] = h[2];
+        h[2] = h[3];
+        h[3] = (int16_t)x;
+    }
+
+    engine->firPrimed |= 1 << stage;
+    engine->phase[stage] = !out;
+    return out;
+}
+#endif
+
+static void Vib_Finish(VibEngine *engine, VibFeatures *features)
+{
+    features->index = engine->windows++;
+
+    for(uint8_t axis = 0; axis < VIB_AXES; axis++)
+    {
+        //sqrt(sum / 2^N) * 16 = sqrt(sum * 256 / 2^N)
+        uint32_t rms = Vib_Sqrt((engine->sumSquares[axis] << 8) >> VIB_WINDOW_LOG2);
+
+        features->rms[axis] = (rms > 0xFFFF) ? 0xFFFF : (uint16_t)rms;
+        features->peak[axis] = engine->peak[axis];
+        features->crest[axis] = rms ? (uint16_t)(((uint32_t)engine->peak[axis] * VIB_RMS_SCALE * 100 + rms / 2) / rms) : 0;
+        features->crossings[axis] = engine->crossings[axis];
+
+        engine->sumSquares[axis] = 0;
+        engine->peak[axis] = 0;
+        engine->crossings[axis] = 0;
+    }
+    engine->count = 0;
+}
+
+uint8_t Vib_Push(VibEngine *engine, const int16_t *sample, VibFeatures *features, int16_t *decimated)
+{
+    int16_t value[VIB_AXES];
+    uint8_t result = VIB_OUT_SAMPLE;
+
+    memcpy(value, sample, sizeof(value));
+#if VIB_DECIMATE
+    for(uint8_t stage = 0; stage < VIB_DECIMATE; stage++)
+    {
+        if(!Vib_Decimate(engine, stage, value))
+        {
+            return 0; //This stage waits for its second input
+        }
+    }
+#endif
+    if(decimated)
+    {
+        memcpy(decimated, value, sizeof(value));
+    }
+
+    for(uint8_t axis = 0; axis < VIB_AXES; axis++)
+    {
+        int32_t ac;
+        uint32_t magnitude;
+        int8_t sign;
+
+        if(!engine->primed)
+        {
+            engine->dc[axis] = (int32_t)value[axis] << VIB_DC_SHIFT; //Start at the first sample, not at 0 g
+        }
+        ac = value[axis] - ((engine->dc[axis] + (1 << (VIB_DC_SHIFT - 1))) >> VIB_DC_SHIFT); //Rounded, no 1/2 LSB bias
+        engine->dc[axis] += ac; //dc += x - dc / 2^k
+
+        magnitude = (ac < 0) ? -ac : ac;
+        engine->sumSquares[axis] += (magnitude < VIB_SQUARE_TABLE) ? vibSquares[magnitude] : magnitude * magnitude;
+        if(magnitude > engine->peak[axis])
+        {
+            engine->peak[axis] = (magnitude > 0xFFFF) ? 0xFFFF : (uint16_t)magnitude;
+        }
+
+        sign = (ac > VIB_ZC_HYSTERESIS) ? 1 : (ac < -VIB_ZC_HYSTERESIS) ? -1 : 0;
+        if(sign)
+        {
+            if(engine->sign[axis] && sign != engine->sign[axis])
+            {
+                engine->crossings[axis]++;
+            }
+            engine->sign[axis] = sign;
+        }
+    }
+    engine->primed = 1;
+
+    if(++engine->count >= (1u << VIB_WINDOW_LOG2))
+    {
+        Vib_Finish(engine, features);
+        result |= VIB_OUT_WINDOW;
+    }
+    return result;
+}
@@ -0,0 +1,61 @@
+//vibration.h - Streaming vibration features of a 3-axis accelerometer: RMS, peak, crest factor, zero-crossing count
+#ifndef VIBRATION_H
+#define VIBRATION_H
+
+#include <stdint.h>
+
+//Every sample goes through an optional decimating low-pass and a DC (gravity) tracker. The features of the AC part
+//are collected over a window, one VibFeatures record per window is all that leaves the board.
+//Per sample there are only adds, shifts, compares and a table lookup (the CH32V003 core has no multiply or divide
+//instruction): the window is a power of two so the mean square is a shift, squares come from vibSquares[] up to
+//VIB_SQUARE_TABLE, and the square root and the crest factor division run once per window.
+
+#ifndef VIB_WINDOW_LOG2
+#define VIB_WINDOW_LOG2   9  //Samples per window: 2^9 = 512 (160 ms at 3200 Hz), after the decimation
+#endif
+#ifndef VIB_DECIMATE
+#define VIB_DECIMATE      0  //Decimate-by-2 stages in front of the features (1-4-6-4-1 / 16 FIR each), 0 - off
+#endif
+#define VIB_DC_SHIFT      10 //DC tracker: exponential mean over about 2^10 samples (0.5 Hz corner at 3200 Hz)
+#define VIB_ZC_HYSTERESIS 2  //LSB: the AC signal has to leave +-this band to count as a zero crossing
+#define VIB_RMS_SCALE     16 //VibFeatures.rms is in 1/16 LSB
+#define VIB_SQUARE_TABLE  256 //|AC| below this is squared by a table lookup, above it (> 1 g at 256 LSB/g) by a multiply
+#define VIB_AXES          3
+
+//Vib_Push() result bits
+#define VIB_OUT_SAMPLE    0x01 //A (decimated) sample came out, every input with VIB_DECIMATE 0
+#define VIB_OUT_WINDOW    0x02 //A window is complete, its record is in 'features'
+
+typedef struct
+{
+    uint32_t index;                 //Window number, from 0
+    uint16_t rms[VIB_AXES];         //RMS of the AC signal, 1/VIB_RMS_SCALE LSB
+    uint16_t peak[VIB_AXES];        //Largest |AC| of the window, LSB
+    uint16_t crest[VIB_AXES];       //peak / RMS * 100, 0 if the RMS is 0
+    uint16_t crossings[VIB_AXES];   //Zero crossings of the AC signal (2 per period of a clean tone)
+} VibFeatures;
+
+typedef struct
+{
+    int32_t  dc[VIB_AXES];          //DC tracker: mean << VIB_DC_SHIFT
+    uint64_t sumSquares[VIB_AXES];
+    uint16_t peak[VIB_AXES];
+    uint16_t crossings[VIB_AXES];
+    int8_t   sign[VIB_AXES];        //Side of the last sample outside the hysteresis band: 1, -1, 0 - none yet
+    uint16_t count;                 //Samples in the current window
+    uint32_t windows;
+    uint8_t  primed;                //0 - the DC tracker starts from the first sample
+#if VIB_DECIMATE
+    int16_t  history[VIB_DECIMATE][VIB_AXES][4]; //Last 4 inputs of every FIR stage, oldest first
+    uint8_t  phase[VIB_DECIMATE];   //1 - the next input completes an output
+    uint8_t  firPrimed;             //Bit per stage: the history holds real inputs
+#endif
+} VibEngine;
+
+void Vib_Init(VibEngine *engine);
+
+//Feed one sample (x, y, z in LSB) at the sensor rate, returns VIB_OUT_... bits. 'decimated' (may be 0) receives the
+//low-pass output with VIB_OUT_SAMPLE.
+uint8_t Vib_Push(VibEngine *engine, const int16_t *sample, VibFeatures *features, int16_t *decimated);
+
+#endif //VIBRATION_H
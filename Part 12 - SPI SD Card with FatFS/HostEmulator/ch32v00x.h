@@ -0,0 +1,146 @@
+/*
+    Host (Linux) stand-in for the WCH ch32v00x.h header.
+    Only the types, constants and peripheral functions used by the SD card/FatFs sources are declared here,
+    the peripherals themselves are emulated in emu_hal.c and emu_spi.c.
+*/
+
+#ifndef CH32V00X_H
+#define CH32V00X_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+//The MCU sources mark their ISRs with __attribute__((interrupt("WCH-Interrupt-fast"))), x86 doesn't know it
+#define interrupt(x) unused
+
+typedef uint8_t  u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+
+typedef enum {RESET = 0, SET = !RESET} FlagStatus, ITStatus;
+typedef enum {DISABLE = 0, ENABLE = !DISABLE} FunctionalState;
+typedef enum {Bit_RESET = 0, Bit_SET} BitAction;
+
+#define __IO volatile
+
+//GPIO
+typedef struct
+{
+    __IO uint32_t CFGLR;
+    __IO uint32_t INDR;
+    __IO uint32_t OUTDR;
+    __IO uint32_t BSHR;
+    __IO uint32_t BCR;
+    __IO uint32_t LCKR;
+} GPIO_TypeDef;
+
+typedef struct
+{
+    uint16_t GPIO_Pin;
+    uint32_t GPIO_Speed;
+    uint32_t GPIO_Mode;
+} GPIO_InitTypeDef;
+
+extern GPIO_TypeDef EmuGPIOA, EmuGPIOC, EmuGPIOD;
+#define GPIOA (&EmuGPIOA)
+#define GPIOC (&EmuGPIOC)
+#define GPIOD (&EmuGPIOD)
+
+#define GPIO_Pin_0      0x0001
+#define GPIO_Pin_1      0x0002
+#define GPIO_Pin_2      0x0004
+#define GPIO_Pin_3      0x0008
+#define GPIO_Pin_4      0x0010
+#define GPIO_Pin_5      0x0020
+#define GPIO_Pin_6      0x0040
+#define GPIO_Pin_7      0x0080
+
+#define GPIO_Speed_2MHz         2
+#define GPIO_Speed_10MHz        1
+#define GPIO_Speed_30MHz        3
+#define GPIO_Speed_50MHz        3
+
+#define GPIO_Mode_IN_FLOATING   0x04
+#define GPIO_Mode_IPD           0x28
+#define GPIO_Mode_IPU           0x48
+#define GPIO_Mode_Out_OD        0x14
+#define GPIO_Mode_Out_PP        0x10
+#define GPIO_Mode_AF_OD         0x1C
+#define GPIO_Mode_AF_PP         0x18
+
+void GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_InitStruct);
+uint8_t GPIO_ReadInputDataBit(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+uint8_t GPIO_ReadOutputDataBit(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void GPIO_WriteBit(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, BitAction BitVal);
+void GPIO_SetBits(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void GPIO_ResetBits(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+
+//RCC
+#define RCC_APB2Periph_AFIO     0x00000001
+#define RCC_APB2Periph_GPIOA    0x00000004
+#define RCC_APB2Periph_GPIOC    0x00000010
+#define RCC_APB2Periph_GPIOD    0x00000020
+#define RCC_APB2Periph_SPI1     0x00001000
+#define RCC_APB2Periph_USART1   0x00004000
+#define RCC_AHBPeriph_DMA1      0x00000001
+
+void RCC_APB2PeriphClockCmd(uint32_t RCC_APB2Periph, FunctionalState NewState);
+void RCC_AHBPeriphClockCmd(uint32_t RCC_AHBPeriph, FunctionalState NewState);
+
+//SPI prescaler values (BR[2:0] in CTLR1)
+#define SPI_BaudRatePrescaler_2     0x00
+#define SPI_BaudRatePrescaler_4     0x08
+#define SPI_BaudRatePrescaler_8     0x10
+#define SPI_BaudRatePrescaler_16    0x18
+#define SPI_BaudRatePrescaler_32    0x20
+#define SPI_BaudRatePrescaler_64    0x28
+#define SPI_BaudRatePrescaler_128   0x30
+#define SPI_BaudRatePrescaler_256   0x38
+
+//Interrupt controller: no-ops. The only interrupt is the timer of Emu_SetTimer(), it fires inside Emu_Advance() and so
+//never inside the short critical sections (they clock no SPI bytes). DMA completion runs inside SPI1_DMA_Start()
+#define DMA1_Channel2_IRQn      11
+
+void NVIC_EnableIRQ(int IRQn);
+void NVIC_DisableIRQ(int IRQn);
+void __enable_irq(void);
+void __disable_irq(void);
+
+//SPI mode bits of CTLR1 (SPI_InitTypeDef values of the SDK)
+#define SPI_CPOL_Low                0x0000
+#define SPI_CPOL_High               0x0002
+#define SPI_CPHA_1Edge              0x0000
+#define SPI_CPHA_2Edge              0x0001
+#define SPI_FirstBit_MSB            0x0000
+#define SPI_FirstBit_LSB            0x0080
+
+//SysTick (the benchmark cycle counter)
+typedef struct
+{
+    __IO uint32_t CTLR;
+    __IO uint32_t SR;
+    __IO uint32_t CNT;
+    uint32_t RESERVED0;
+    __IO uint32_t CMP;
+    uint32_t RESERVED1;
+} SysTick_Type;
+
+extern SysTick_Type EmuSysTick;
+#define SysTick (&EmuSysTick)
+
+extern uint32_t SystemCoreClock;
+
+//Flash: only the last 64-byte page exists (the SD_Boot cache), it keeps its contents while the program runs
+extern uint32_t EmuFlashPage[16];
+#define SD_BOOT_FLASH_PTR ((const void *)EmuFlashPage)
+extern uint32_t EmuFlashImageEnd; //End of the emulated program, SD_Boot stays out of the page when it is past its start
+#define SD_BOOT_IMAGE_END EmuFlashImageEnd
+
+void FLASH_Unlock_Fast(void);
+void FLASH_Lock_Fast(void);
+void FLASH_ErasePage_Fast(uint32_t Page_Address);
+void FLASH_BufReset(void);
+void FLASH_BufLoad(uint32_t Address, uint32_t Data0);
+void FLASH_ProgramPage_Fast(uint32_t Page_Address);
+
+#endif //CH32V00X_H
@@ -0,0 +1,2 @@
+//Host stand-in for ch32v00x_gpio.h, everything is in ch32v00x.h
+#include "ch32v00x.h"
@@ -0,0 +1,12 @@
+//Host stand-in for the WCH debug.h: the delays advance the emulated clock, printf() goes to stdout
+#ifndef DEBUG_H
+#define DEBUG_H
+
+#include "ch32v00x.h"
+#include <stdio.h>
+
+void Delay_Init(void);
+void Delay_Us(uint32_t n);
+void Delay_Ms(uint32_t n);
+
+#endif //DEBUG_H
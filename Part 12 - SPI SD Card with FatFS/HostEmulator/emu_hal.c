@@ -0,0 +1,318 @@
+//Emulated CH32V003 peripherals for the host build: GPIO (SD CS on PC4), SysTick, delays and the SPI1 driver API of spi.h.
+//SPI1 is emulated at the spi.h level: every byte goes straight to the card model, a DMA transfer finishes
+//synchronously and calls the completion callback, time advances by the modeled SPI clock.
+#include "ch32v00x.h"
+#include "debug.h"
+#include "spi.h"
+#include "emu_hal.h"
+#include "emu_sdcard.h"
+#include <string.h>
+
+GPIO_TypeDef EmuGPIOA, EmuGPIOC, EmuGPIOD;
+SysTick_Type EmuSysTick;
+uint32_t SystemCoreClock = 48000000;
+
+volatile uint8_t  SPI1_DMA_Done = 1;
+volatile uint32_t SPI1_DMA_WaitCycles = 0;
+
+static uint64_t emuCycles;
+static uint32_t emuSysTickPrescale; //HCLK/8 remainder when SysTick runs from the divided clock
+static uint16_t spiCtlr1 = SPI_BaudRatePrescaler_256; //BR, CPOL, CPHA and LSBFIRST bits of CTLR1
+static SPI1_DMA_Callback spiDmaCallback;
+static Emu_TimerHandler emuTimerHandler;
+static uint64_t emuTimerPeriod;
+static uint64_t emuTimerNext;
+
+uint64_t Emu_Now(void)
+{
+    return emuCycles;
+}
+
+static void Emu_Count(uint32_t cycles)
+{
+    emuCycles += cycles;
+
+    if(SysTick->CTLR & 1)
+    {
+        if(SysTick->CTLR & 4)
+        {
+            SysTick->CNT += cycles; //HCLK
+        }
+        else
+        {
+            emuSysTickPrescale += cycles;
+            SysTick->CNT += emuSysTickPrescale / 8; //HCLK/8
+            emuSysTickPrescale %= 8;
+        }
+    }
+}
+
+void Emu_Advance(uint32_t cycles)
+{
+    Emu_Count(cycles);
+
+    while(emuTimerHandler && emuCycles >= emuTimerNext) //Interrupts that became due while the main code ran
+    {
+        emuTimerNext += emuTimerPeriod;
+        emuTimerHandler();
+        Emu_Count(EMU_ISR_CYCLES);
+    }
+}
+
+void Emu_SetTimer(uint32_t periodCycles, Emu_TimerHandler handler)
+{
+    emuTimerHandler = periodCycles ? handler : 0;
+    emuTimerPeriod = periodCycles;
+    emuTimerNext = emuCycles + periodCycles;
+}
+
+uint32_t Emu_UsToCycles(uint32_t us)
+{
+    return (uint32_t)(((uint64_t)us * SystemCoreClock) / 1000000);
+}
+
+//GPIO
+void GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_InitStruct)
+{
+    (void)GPIOx;
+    (void)GPIO_InitStruct;
+}
+
+uint8_t GPIO_ReadInputDataBit(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    return (GPIOx->INDR & GPIO_Pin) ? Bit_SET : Bit_RESET; //INDR is 0: card detect reads "card present"
+}
+
+uint8_t GPIO_ReadOutputDataBit(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    return (GPIOx->OUTDR & GPIO_Pin) ? Bit_SET : Bit_RESET;
+}
+
+void GPIO_WriteBit(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, BitAction BitVal)
+{
+    if(BitVal == Bit_SET)
+    {
+        GPIOx->OUTDR |= GPIO_Pin;
+    }
+    else
+    {
+        GPIOx->OUTDR &= ~GPIO_Pin;
+    }
+
+    if(GPIOx == GPIOC && (GPIO_Pin & GPIO_Pin_4))
+    {
+        EmuCard_Select(BitVal == Bit_RESET); //SD CS is active low
+    }
+}
+
+void GPIO_SetBits(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    GPIO_WriteBit(GPIOx, GPIO_Pin, Bit_SET);
+}
+
+void GPIO_ResetBits(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+    GPIO_WriteBit(GPIOx, GPIO_Pin, Bit_RESET);
+}
+
+void RCC_APB2PeriphClockCmd(uint32_t RCC_APB2Periph, FunctionalState NewState)
+{
+    (void)RCC_APB2Periph;
+    (void)NewState;
+}
+
+void RCC_AHBPeriphClockCmd(uint32_t RCC_AHBPeriph, FunctionalState NewState)
+{
+    (void)RCC_AHBPeriph;
+    (void)NewState;
+}
+
+void __enable_irq(void)
+{
+}
+
+void __disable_irq(void)
+{
+}
+
+void NVIC_EnableIRQ(int IRQn)
+{
+    (void)IRQn;
+}
+
+void NVIC_DisableIRQ(int IRQn)
+{
+    (void)IRQn;
+}
+
+//Flash: the page of the SD_Boot cache, erased at the start like a new chip (the CH32V003 reads 0xE339E339 when erased).
+//Erase and program take no emulated time.
+#define EMU_FLASH_PAGE_ADDR 0x08003FC0
+#define EMU_FLASH_ERASED    0xE339E339
+
+uint32_t EmuFlashImageEnd = EMU_FLASH_PAGE_ADDR; //The largest program that leaves the page free
+
+uint32_t EmuFlashPage[16] =
+{
+    EMU_FLASH_ERASED, EMU_FLASH_ERASED, EMU_FLASH_ERASED, EMU_FLASH_ERASED, EMU_FLASH_ERASED, EMU_FLASH_ERASED,
+    EMU_FLASH_ERASED, EMU_FLASH_ERASED, EMU_FLASH_ERASED, EMU_FLASH_ERASED, EMU_FLASH_ERASED, EMU_FLASH_ERASED,
+    EMU_FLASH_ERASED, EMU_FLASH_ERASED, EMU_FLASH_ERASED, EMU_FLASH_ERASED
+};
+static uint32_t emuFlashBuffer[16];
+static uint8_t  emuFlashUnlocked;
+
+void FLASH_Unlock_Fast(void)
+{
+    emuFlashUnlocked = 1;
+}
+
+void FLASH_Lock_Fast(void)
+{
+    emuFlashUnlocked = 0;
+}
+
+void FLASH_ErasePage_Fast(uint32_t Page_Address)
+{
+    if(emuFlashUnlocked && Page_Address == EMU_FLASH_PAGE_ADDR)
+    {
+        for(uint8_t i = 0; i < 16; i++)
+        {
+            EmuFlashPage[i] = EMU_FLASH_ERASED;
+        }
+    }
+}
+
+void FLASH_BufReset(void)
+{
+    memset(emuFlashBuffer, 0, sizeof(emuFlashBuffer));
+}
+
+void FLASH_BufLoad(uint32_t Address, uint32_t Data0)
+{
+    if(Address >= EMU_FLASH_PAGE_ADDR && Address < EMU_FLASH_PAGE_ADDR + 64)
+    {
+        emuFlashBuffer[(Address - EMU_FLASH_PAGE_ADDR) / 4] = Data0;
+    }
+}
+
+void FLASH_ProgramPage_Fast(uint32_t Page_Address)
+{
+    if(emuFlashUnlocked && Page_Address == EMU_FLASH_PAGE_ADDR)
+    {
+        memcpy(EmuFlashPage, emuFlashBuffer, sizeof(EmuFlashPage));
+    }
+}
+
+//Delays: SysTick is reloaded by the SDK delays, do the same so the benchmarks see the real behaviour
+void Delay_Init(void)
+{
+}
+
+void Delay_Us(uint32_t n)
+{
+    SysTick->CTLR = 0;
+    Emu_Advance(Emu_UsToCycles(n));
+}
+
+void Delay_Ms(uint32_t n)
+{
+    SysTick->CTLR = 0;
+    Emu_Advance(Emu_UsToCycles(n * 1000));
+}
+
+//SPI1
+//The card only understands mode 0, MSB first: a byte it receives in another mode (a device switch of spi_bus.c left
+//behind while the card is selected) counts as a protocol error
+static void SpiCheckMode(void)
+{
+    if((spiCtlr1 & SPI_CTLR1_MODE_MASK) && GPIO_ReadOutputDataBit(GPIOC, GPIO_Pin_4) == Bit_RESET)
+    {
+        EmuCard_Stats.protocolErrors++;
+    }
+}
+
+static uint32_t SpiByteCycles(void)
+{
+    return 8u * (2u << ((spiCtlr1 & SPI_CTLR1_BR_MASK) >> 3)); //8 bits at HCLK / prescaler
+}
+
+void SPI1_Init(void)
+{
+    GPIO_WriteBit(GPIOC, GPIO_Pin_4, Bit_SET);
+    spiCtlr1 = SPI_BaudRatePrescaler_256;
+}
+
+void SPI1_SetSpeed(uint8_t SPI_BaudRatePrescaler)
+{
+    SPI1_SetMode(SPI_BaudRatePrescaler, SPI_CTLR1_BR_MASK);
+}
+
+uint8_t SPI1_SetMode(uint16_t bits, uint16_t mask)
+{
+    if(((spiCtlr1 ^ bits) & mask) == 0)
+    {
+        return 0;
+    }
+    spiCtlr1 = (spiCtlr1 & ~mask) | (bits & mask);
+    return 1;
+}
+
+uint8_t SPI_TransferByte(uint8_t data)
+{
+    Emu_Advance(SpiByteCycles() + EMU_POLL_OVERHEAD_CYCLES);
+    SpiCheckMode();
+    return EmuCard_Exchange(data);
+}
+
+void SPI1_DMA_Init(void)
+{
+    SPI1_DMA_Done = 1;
+}
+
+void SPI1_DMA_SetCallback(SPI1_DMA_Callback callback)
+{
+    spiDmaCallback = callback;
+}
+
+void SPI1_DMA_Start(const uint8_t *txBuf, uint8_t *rxBuf, uint16_t length)
+{
+    uint8_t rx;
+
+    SPI1_DMA_Done = 0;
+    Emu_Advance(EMU_DMA_SETUP_CYCLES);
+
+    for(uint16_t i = 0; i < length; i++)
+    {
+        Emu_Advance(SpiByteCycles()); //Back-to-back bytes, no CPU in between
+        SpiCheckMode();
+        rx = EmuCard_Exchange(txBuf ? txBuf[i] : 0xFF);
+        if(rxBuf)
+        {
+            rxBuf[i] = rx;
+        }
+    }
+
+    //The host can't run the CPU in parallel with the transfer: the bus time is booked as DMA wait time
+    SPI1_DMA_WaitCycles += (SysTick->CTLR & 4) ? (uint32_t)length * SpiByteCycles() : 0;
+    SPI1_DMA_Done = 1;
+    if(spiDmaCallback)
+    {
+        spiDmaCallback();
+    }
+}
+
+void SPI1_DMA_Abort(void)
+{
+    SPI1_DMA_Done = 1;
+}
+
+uint8_t SPI1_DMA_Wait(void)
+{
+    return 0; //Already finished in SPI1_DMA_Start()
+}
+
+uint8_t SPI1_DMA_Transfer(const uint8_t *txBuf, uint8_t *rxBuf, uint16_t length)
+{
+    SPI1_DMA_Start(txBuf, rxBuf, length);
+    return SPI1_DMA_Wait();
+}
@@ -0,0 +1,21 @@
+//emu_hal.h - emulated clock and peripherals of the host build
+#ifndef EMU_HAL_H
+#define EMU_HAL_H
+
+#include <stdint.h>
+
+#define EMU_POLL_OVERHEAD_CYCLES    24 //CPU cycles around one polled SPI byte (flag checks, call, loop)
+#define EMU_DMA_SETUP_CYCLES        120 //CPU cycles to program and start the two DMA channels
+#define EMU_ISR_CYCLES              60  //CPU cycles of one timer interrupt (entry, handler, exit)
+
+typedef void (*Emu_TimerHandler)(void);
+
+uint64_t Emu_Now(void);                 //Emulated core cycles since start
+void     Emu_Advance(uint32_t cycles);  //Let time pass (also drives SysTick->CNT when it is enabled)
+uint32_t Emu_UsToCycles(uint32_t us);
+
+//Periodic timer interrupt: 'handler' runs whenever Emu_Advance() passes the next period boundary, like an ISR that
+//preempts the driver in the middle of a transfer or busy wait. periodCycles = 0 stops it.
+void     Emu_SetTimer(uint32_t periodCycles, Emu_TimerHandler handler);
+
+#endif //EMU_HAL_H
@@ -0,0 +1,577 @@
+#include "emu_sdcard.h"
+#include "emu_hal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+EmuCardStats EmuCard_Stats;
+
+//Card states
+#define ST_COMMAND      0 //Waiting for (or receiving) a command
+#define ST_WRITE_TOKEN  1 //CMD24/CMD25 accepted, waiting for a data token
+#define ST_WRITE_DATA   2 //Receiving a data block + CRC
+
+#define QUEUE_SIZE      1024
+
+static FILE *image;
+static uint32_t sectors;
+static EmuCardConfig config;
+
+static uint8_t selected;
+static uint8_t state = ST_COMMAND;
+static uint8_t idle = 1;            //1 - in idle state (before ACMD41 finished)
+static uint8_t appCommand;          //1 - the previous command was CMD55
+static uint32_t initPollCount;
+static uint64_t initStart;          //Time of the last CMD0
+static uint32_t powerBlocks = 0xFFFFFFFF; //Blocks that are still stored before the emulated power cut
+
+static uint8_t command[6];
+static uint8_t commandLength;
+
+//Response bytes (R1, R3/R7 payload) are sent right away, data blocks only once dataReadyAt has passed
+static uint8_t response[8];
+static uint8_t responseHead, responseCount;
+static uint8_t dataQueue[QUEUE_SIZE];
+static uint16_t dataHead, dataCount;
+static uint64_t dataReadyAt;
+static uint64_t busyUntil;
+
+static uint8_t  readStream;         //1 - CMD18 is running
+static uint32_t readNext;           //Next block of the CMD18 stream
+
+static uint8_t  writeMulti;         //1 - CMD25, 0 - CMD24
+static uint32_t writeNext;
+static uint8_t  writeBlock[514];    //Data + CRC
+static uint16_t writeLength;
+
+static uint32_t eraseStart, eraseEnd;
+static uint8_t *erased;             //1 bit per block: erased by CMD38 and not written since
+
+EmuCardConfig EmuCard_DefaultConfig(void)
+{
+    EmuCardConfig c;
+
+    c.readLatencyUs = 100;
+    c.writeLatencyUs = 250;
+    c.erasedWriteLatencyUs = 100;
+    c.stopLatencyUs = 50;
+    c.eraseLatencyUs = 1000;
+    c.initPolls = 20;
+    c.initTimeUs = 0;
+    c.highCapacity = 1;
+    return c;
+}
+
+int EmuCard_Open(const char *path, const EmuCardConfig *cardConfig)
+{
+    long size;
+
+    image = fopen(path, "r+b");
+    if(!image)
+    {
+        return -1;
+    }
+
+    fseek(image, 0, SEEK_END);
+    size = ftell(image);
+    sectors = (uint32_t)(size / 512);
+    config = *cardConfig;
+    memset(&EmuCard_Stats, 0, sizeof(EmuCard_Stats));
+    free(erased);
+    erased = calloc(sectors / 8 + 1, 1); //Nothing is known to be erased at the start
+    if(!erased)
+    {
+        fclose(image);
+        image = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void EmuCard_Close(void)
+{
+    if(image)
+    {
+        fclose(image);
+        image = 0;
+    }
+    free(erased);
+    erased = 0;
+}
+
+void EmuCard_PowerCut(uint32_t blocks)
+{
+    powerBlocks = blocks ? blocks : 0xFFFFFFFF;
+}
+
+uint8_t EmuCard_PowerOn(void)
+{
+    return powerBlocks != 0;
+}
+
+uint32_t EmuCard_Sectors(void)
+{
+    return sectors;
+}
+
+void EmuCard_SetInitTime(uint32_t us)
+{
+    config.initTimeUs = us;
+}
+
+void EmuCard_Select(uint8_t cs)
+{
+    selected = cs;
+}
+
+static void Respond(uint8_t byte)
+{
+    response[(responseHead + responseCount) % sizeof(response)] = byte;
+    responseCount++;
+}
+
+static void QueueData(uint8_t byte)
+{
+    dataQueue[(dataHead + dataCount) % QUEUE_SIZE] = byte;
+    dataCount++;
+}
+
+//Queue a data packet: token, payload, CRC (the host ignores the CRC, we send 0xFFFF)
+static void QueuePacket(const uint8_t *data, uint16_t length, uint32_t latencyUs)
+{
+    QueueData(0xFE);
+    for(uint16_t i = 0; i < length; i++)
+    {
+        QueueData(data[i]);
+    }
+    QueueData(0xFF);
+    QueueData(0xFF);
+    dataReadyAt = Emu_Now() + Emu_UsToCycles(latencyUs);
+    EmuCard_Stats.dataBytesRead += length;
+}
+
+static uint8_t QueueBlock(uint32_t block, uint32_t latencyUs)
+{
+    uint8_t data[512];
+
+    if(block >= sectors)
+    {
+        return 1;
+    }
+
+    fseek(image, (long)block * 512, SEEK_SET);
+    if(fread(data, 1, 512, image) != 512)
+    {
+        memset(data, 0, sizeof(data));
+    }
+    QueuePacket(data, 512, latencyUs);
+    EmuCard_Stats.blocksRead++;
+    return 0;
+}
+
+static void StoreBlock(uint32_t block, const uint8_t *data)
+{
+    if(powerBlocks == 0)
+    {
+        return; //Power is gone, the card acknowledges but keeps nothing
+    }
+    fseek(image, (long)block * 512, SEEK_SET);
+    if(powerBlocks != 0xFFFFFFFF && --powerBlocks == 0)
+    {
+        fwrite(data, 1, 256, image); //Torn write: the cut hits the middle of this block
+    }
+    else
+    {
+        fwrite(data, 1, 512, image);
+    }
+    EmuCard_Stats.blocksWritten++;
+    EmuCard_Stats.dataBytesWritten += 512;
+}
+
+static uint8_t Address(uint32_t argument, uint32_t *block) //1 - address error
+{
+    if(!config.highCapacity)
+    {
+        if(argument & 511)
+        {
+            return 1; //SDSC addresses are byte offsets of whole blocks
+        }
+        argument >>= 9;
+    }
+    *block = argument;
+    return argument >= sectors;
+}
+
+static void BuildCSD(uint8_t *csd)
+{
+    memset(csd, 0, 16);
+    if(config.highCapacity)
+    {
+        uint32_t csize = sectors / 1024 - 1; //Capacity = (C_SIZE + 1) * 512 KB
+
+        csd[0] = 0x40; //CSD v2.0
+        csd[1] = 0x0E; //TAAC
+        csd[3] = 0x32; //TRAN_SPEED: 25 MHz
+        csd[4] = 0x5B;
+        csd[5] = 0x59; //CCC, READ_BL_LEN = 9
+        csd[7] = (csize >> 16) & 0x3F;
+        csd[8] = csize >> 8;
+        csd[9] = csize;
+    }
+    else
+    {
+        uint32_t csize = sectors / 512 - 1; //READ_BL_LEN = 9, C_SIZE_MULT = 7 -> (C_SIZE + 1) * 512 blocks
+
+        csd[0] = 0x00; //CSD v1.0
+        csd[1] = 0x26;
+        csd[3] = 0x32;
+        csd[4] = 0x5F;
+        csd[5] = 0x59;
+        csd[6] = 0x80 | ((csize >> 10) & 3);
+        csd[7] = csize >> 2;
+        csd[8] = (csize & 3) << 6;
+        csd[9] = 0x03; //C_SIZE_MULT[2:1]
+        csd[10] = 0x80; //C_SIZE_MULT[0]
+    }
+    csd[10] |= 0x7F; //ERASE_BLK_EN = 1, SECTOR_SIZE[6:1]
+    csd[11] = 0x80;
+    csd[12] = 0x0A;
+    csd[13] = 0x40;
+    csd[15] = 0x01;
+}
+
+static void Execute(void)
+{
+    uint8_t index = command[0] & 0x3F;
+    uint32_t argument = ((uint32_t)command[1] << 24) | ((uint32_t)command[2] << 16) | ((uint32_t)command[3] << 8) | command[4];
+    uint8_t app = appCommand;
+    uint8_t r1;
+    uint32_t block;
+    uint8_t data[64];
+
+    appCommand = 0;
+    responseCount = 0;
+
+    if(readStream)
+    {
+        readStream = 0; //Every command stops the stream, only CMD12 is the legal one
+        dataCount = 0;
+        if(index != 12)
+        {
+            EmuCard_Stats.protocolErrors++;
+        }
+    }
+
+    if(app)
+    {
+        EmuCard_Stats.appCommands[index]++;
+    }
+    else
+    {
+        EmuCard_Stats.commands[index]++;
+    }
+
+    r1 = idle ? 0x01 : 0x00;
+    Respond(0xFF); //NCR: one byte before the response
+
+    if(idle && !(index == 0 || index == 8 || index == 55 || index == 58 || index == 59 || (app && index == 41)))
+    {
+        EmuCard_Stats.illegal++;
+        Respond(r1 | 0x04); //Only the init commands work in idle state
+        return;
+    }
+
+    if(app)
+    {
+        switch(index)
+        {
+            case 41: //SD_SEND_OP_COND
+                ++initPollCount;
+                if(config.initTimeUs ? Emu_Now() - initStart >= Emu_UsToCycles(config.initTimeUs) : initPollCount > config.initPolls)
+                {
+                    idle = 0;
+                }
+                Respond(idle ? 0x01 : 0x00);
+                return;
+
+            case 23: //SET_WR_BLK_ERASE_COUNT
+                Respond(r1);
+                return;
+
+            case 13: //SD_STATUS: R2 + 64-byte data block
+                Respond(r1);
+                Respond(0x00);
+                memset(data, 0, sizeof(data));
+                data[8] = 0x02; //SPEED_CLASS: class 4
+                data[10] = 0x90; //AU_SIZE: 4 MB
+                data[11] = 0x00;
+                data[12] = 0x20; //ERASE_SIZE: 32 AUs
+                data[13] = 0x08; //ERASE_TIMEOUT: 2 s
+                QueuePacket(data, 64, config.readLatencyUs);
+                return;
+        }
+        //Other ACMDs fall through to the standard command set, like a real card
+    }
+
+    switch(index)
+    {
+        case 0: //GO_IDLE_STATE
+            idle = 1;
+            initPollCount = 0;
+            initStart = Emu_Now();
+            state = ST_COMMAND;
+            dataCount = 0;
+            Respond(0x01);
+            break;
+
+        case 8: //SEND_IF_COND (R7)
+            Respond(r1);
+            Respond(0x00);
+            Respond(0x00);
+            Respond((argument >> 8) & 0x0F);
+            Respond(argument & 0xFF);
+            break;
+
+        case 55: //APP_CMD
+            appCommand = 1;
+            Respond(r1);
+            break;
+
+        case 58: //READ_OCR (R3)
+            Respond(r1);
+            Respond((idle ? 0x00 : 0x80) | (config.highCapacity ? 0x40 : 0x00));
+            Respond(0xFF);
+            Respond(0x80);
+            Respond(0x00);
+            break;
+
+        case 59: //CRC_ON_OFF
+        case 16: //SET_BLOCKLEN
+        case 23: //SET_BLOCK_COUNT
+            Respond(r1);
+            break;
+
+        case 9: //SEND_CSD
+            Respond(r1);
+            BuildCSD(data);
+            QueuePacket(data, 16, 0);
+            break;
+
+        case 10: //SEND_CID
+            Respond(r1);
+            memcpy(data, "\x03" "EMSDEMU\x10\x12\x34\x56\x78\x01\x9A\x01", 16);
+            QueuePacket(data, 16, 0);
+            break;
+
+        case 12: //STOP_TRANSMISSION (R1b)
+            Respond(r1);
+            busyUntil = Emu_Now() + Emu_UsToCycles(1);
+            break;
+
+        case 13: //SEND_STATUS (R2)
+            Respond(r1);
+            Respond(0x00);
+            break;
+
+        case 17: //READ_SINGLE_BLOCK
+        case 18: //READ_MULTIPLE_BLOCK
+            if(Address(argument, &block))
+            {
+                EmuCard_Stats.illegal++;
+                Respond(r1 | 0x20); //Address error
+                break;
+            }
+            Respond(r1);
+            QueueBlock(block, config.readLatencyUs);
+            if(index == 18)
+            {
+                readStream = 1;
+                readNext = block + 1;
+            }
+            break;
+
+        case 24: //WRITE_BLOCK
+        case 25: //WRITE_MULTIPLE_BLOCK
+            if(Address(argument, &block))
+            {
+                EmuCard_Stats.illegal++;
+                Respond(r1 | 0x20);
+                break;
+            }
+            Respond(r1);
+            state = ST_WRITE_TOKEN;
+            writeMulti = (index == 25);
+            writeNext = block;
+            break;
+
+        case 32: //ERASE_WR_BLK_START_ADDR
+        case 33: //ERASE_WR_BLK_END_ADDR
+            if(Address(argument, &block))
+            {
+                EmuCard_Stats.illegal++;
+                Respond(r1 | 0x20);
+                break;
+            }
+            if(index == 32)
+            {
+                eraseStart = block;
+            }
+            else
+            {
+                eraseEnd = block;
+            }
+            Respond(r1);
+            break;
+
+        case 38: //ERASE (R1b)
+            if(eraseEnd < eraseStart)
+            {
+                EmuCard_Stats.illegal++;
+                Respond(r1 | 0x10); //Erase sequence error
+                break;
+            }
+            memset(data, 0, sizeof(data));
+            fseek(image, (long)eraseStart * 512, SEEK_SET);
+            for(block = eraseStart; block <= eraseEnd; block++)
+            {
+                for(uint8_t i = 0; i < 8; i++)
+                {
+                    fwrite(data, 1, 64, image); //Erased blocks read back as 0x00 (DATA_STAT_AFTER_ERASE = 0)
+                }
+                EmuCard_Stats.sectorsErased++;
+                erased[block >> 3] |= 1 << (block & 7);
+            }
+            Respond(r1);
+            busyUntil = Emu_Now() + Emu_UsToCycles(config.eraseLatencyUs + (eraseEnd - eraseStart + 1));
+            break;
+
+        default:
+            EmuCard_Stats.illegal++;
+            Respond(r1 | 0x04); //Illegal command
+            break;
+    }
+}
+
+//Byte on MISO, decided before the card sees the MOSI byte of the same exchange
+static uint8_t Output(void)
+{
+    uint8_t out;
+
+    if(responseCount)
+    {
+        out = response[responseHead];
+        responseHead = (responseHead + 1) % sizeof(response);
+        responseCount--;
+        return out;
+    }
+
+    if(Emu_Now() < busyUntil)
+    {
+        EmuCard_Stats.busyBytes++;
+        return 0x00; //DO held low while programming
+    }
+
+    if(dataCount && Emu_Now() >= dataReadyAt)
+    {
+        out = dataQueue[dataHead];
+        dataHead = (dataHead + 1) % QUEUE_SIZE;
+        dataCount--;
+
+        if(!dataCount && readStream)
+        {
+            //CMD18: the next block follows after the access time, until CMD12 arrives
+            if(QueueBlock(readNext, config.readLatencyUs))
+            {
+                readStream = 0; //Out of range: a real card would flag an error in the next R1
+            }
+            readNext++;
+        }
+        return out;
+    }
+
+    return 0xFF;
+}
+
+static void Input(uint8_t in)
+{
+    switch(state)
+    {
+        case ST_WRITE_TOKEN:
+            if(in == 0xFF)
+            {
+                return; //Host polls before the token
+            }
+            if((!writeMulti && in == 0xFE) || (writeMulti && in == 0xFC))
+            {
+                state = ST_WRITE_DATA;
+                writeLength = 0;
+                return;
+            }
+            if(writeMulti && in == 0xFD)
+            {
+                //Stop Tran: one byte gap, then busy while the last blocks are finished
+                state = ST_COMMAND;
+                Respond(0xFF);
+                busyUntil = Emu_Now() + Emu_UsToCycles(config.stopLatencyUs);
+                return;
+            }
+            EmuCard_Stats.protocolErrors++; //Anything else aborts the write
+            state = ST_COMMAND;
+            break; //Maybe it's the start of a command
+
+        case ST_WRITE_DATA:
+            writeBlock[writeLength++] = in;
+            if(writeLength == sizeof(writeBlock))
+            {
+                uint32_t latency = config.writeLatencyUs;
+
+                if(writeNext < sectors)
+                {
+                    if(erased[writeNext >> 3] & (1 << (writeNext & 7)))
+                    {
+                        erased[writeNext >> 3] &= ~(1 << (writeNext & 7));
+                        latency = config.erasedWriteLatencyUs; //No erase before programming
+                    }
+                    StoreBlock(writeNext, writeBlock);
+                    Respond(0xE5); //Data accepted
+                }
+                else
+                {
+                    Respond(0xED); //Write error
+                }
+                writeNext++;
+                busyUntil = Emu_Now() + Emu_UsToCycles(latency);
+                state = writeMulti ? ST_WRITE_TOKEN : ST_COMMAND;
+            }
+            return;
+    }
+
+    if(commandLength == 0)
+    {
+        if((in & 0xC0) != 0x40)
+        {
+            return; //Not a command start (0xFF fill bytes, or our own data while streaming)
+        }
+    }
+    command[commandLength++] = in;
+    if(commandLength == 6)
+    {
+        commandLength = 0;
+        Execute();
+    }
+}
+
+uint8_t EmuCard_Exchange(uint8_t in)
+{
+    uint8_t out;
+
+    if(!selected || !image)
+    {
+        return 0xFF; //DO is released, the pull-up reads as 0xFF
+    }
+
+    EmuCard_Stats.bytesClocked++;
+    out = Output();
+    Input(in);
+    return out;
+}
@@ -0,0 +1,50 @@
+//emu_sdcard.h - SPI mode SD card model backed by an image file (host emulator)
+#ifndef EMU_SDCARD_H
+#define EMU_SDCARD_H
+
+#include <stdint.h>
+
+typedef struct
+{
+    uint32_t readLatencyUs;     //Time from a read command (or the previous block of CMD18) to the data token
+    uint32_t writeLatencyUs;    //Busy time after every accepted data block
+    uint32_t erasedWriteLatencyUs; //Busy time after a block written into an area erased by CMD38 (nothing to erase first)
+    uint32_t stopLatencyUs;     //Busy time after the Stop Tran token of CMD25
+    uint32_t eraseLatencyUs;    //Busy time of CMD38 (per erase command, plus 1 us / sector)
+    uint32_t initPolls;         //Number of ACMD41 calls that still report "idle"
+    uint32_t initTimeUs;        //If not 0: the card reports "idle" for this long after CMD0 instead (initPolls is ignored)
+    uint8_t  highCapacity;      //1 - SDHC (block addressing, CSD v2), 0 - SDSC (byte addressing, CSD v1)
+} EmuCardConfig;
+
+typedef struct
+{
+    uint32_t commands[64];      //CMDx received
+    uint32_t appCommands[64];   //ACMDx received (CMD55 + CMDx)
+    uint32_t illegal;           //Commands answered with "illegal command" or "address error"
+    uint32_t protocolErrors;    //Bytes that make no sense in the current state (e.g. a command in a data phase)
+    uint64_t bytesClocked;      //Every byte exchanged while the card was selected
+    uint64_t busyBytes;         //Bytes clocked while the card held DO low (busy polling)
+    uint64_t dataBytesRead;     //Payload bytes sent by the card (blocks, CSD, CID, SD status)
+    uint64_t dataBytesWritten;  //Payload bytes received by the card
+    uint32_t blocksRead;
+    uint32_t blocksWritten;
+    uint32_t sectorsErased;
+} EmuCardStats;
+
+extern EmuCardStats EmuCard_Stats;
+
+EmuCardConfig EmuCard_DefaultConfig(void);
+int  EmuCard_Open(const char *path, const EmuCardConfig *config); //0 - ok, -1 - the image can't be opened
+void EmuCard_Close(void);
+uint32_t EmuCard_Sectors(void);
+void EmuCard_SetInitTime(uint32_t us); //Change EmuCardConfig.initTimeUs of the open card
+
+//Emulated power cut: the next 'blocks' - 1 written blocks are stored, the one after it only half (torn write), every
+//later write is acknowledged but lost. 0 restores the power (call it before the "reboot", then mount again).
+void EmuCard_PowerCut(uint32_t blocks);
+uint8_t EmuCard_PowerOn(void); //0 - the power cut has happened
+
+void    EmuCard_Select(uint8_t selected); //CS line: 1 - low (selected), 0 - high
+uint8_t EmuCard_Exchange(uint8_t in);     //One SPI byte: MOSI in, MISO out
+
+#endif //EMU_SDCARD_H
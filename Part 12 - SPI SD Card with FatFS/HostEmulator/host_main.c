@@ -0,0 +1,1380 @@
+/*
+    Host test bench for the SD card driver: sd.c, diskio.c and FatFs run unchanged on Linux against
+    the emulated SPI1 bus and an SD card model that stores its sectors in an image file.
+
+    Every file operation is bracketed by Op_Begin()/Op_End(), which print the SD commands and SPI bytes
+    it caused, so the effect of a driver change (sessions, caches, busy handling...) can be seen without hardware.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ch32v00x.h"
+#include "debug.h"
+#include "ff.h"
+#include "diskio.h"
+#include "sd.h"
+#include "spi.h"
+#include "emu_hal.h"
+#include "emu_sdcard.h"
+#include "sd_bench.h"
+#include "sd_log.h"
+#include "sd_binlog.h"
+#include "sd_ringlog.h"
+#include "sd_index.h"
+#include "sd_linereader.h"
+#include "sd_capture.h"
+#include "sd_journal.h"
+#include "sd_boot.h"
+#include "spi_bus.h"
+
+#define LOG_SAMPLES     50      //Default number of logger samples (open, lseek, write, close like main.c)
+#define BIG_FILE_SIZE   65536   //Size of the sequential write/read test file
+#define BOOT_INIT_US    100000  //Card init time (CMD0 to ready) of the boot comparison, unless -i is given
+#define BOOT_SENSOR_US  750000  //DS18B20 12-bit conversion
+#define ACCEL_RATE_HZ   3200    //ADXL345 output rate of the shared bus test (Part 10 FIFO stream mode)
+#define ACCEL_WATERMARK 16      //FIFO entries per watermark interrupt
+#define ACCEL_SLACK_US  (1000000 * (32 - ACCEL_WATERMARK) / ACCEL_RATE_HZ) //Until the 32-entry FIFO overflows
+#define CACHE_CHECK_SECTORS 32  //Region of the sector cache / read-ahead check, more than the cache slots
+#define CACHE_ERASED    0xFF    //Generation of a trimmed sector: reads back as zeros
+
+FATFS fs;
+FIL file;
+SD_Log logger;
+SD_BinLog binLogger;
+SD_RingLog ringLogger;
+SD_Index logIndex;
+uint8_t buffer[512];
+uint8_t captureBuffer[512];     //Second buffer of the capture pipeline
+
+static SD_RawLog captureLog;
+static SD_Journal journal;
+static SD_Capture capture;
+static uint32_t captureNumber;  //Sample value of the emulated timer interrupt: a running number
+
+static EmuCardStats opStats; //Card counters at Op_Begin()
+static uint64_t opStart;
+static const char *opName;
+
+static void Op_Begin(const char *name)
+{
+    opName = name;
+    opStats = EmuCard_Stats;
+    opStart = Emu_Now();
+}
+
+//One CSV line per operation, "calls" divides the numbers to get per-call figures
+static void Op_End(uint32_t calls)
+{
+    EmuCardStats *s = &EmuCard_Stats;
+    uint32_t commands = 0;
+
+    for(uint8_t i = 0; i < 64; i++)
+    {
+        commands += (s->commands[i] - opStats.commands[i]) + (s->appCommands[i] - opStats.appCommands[i]);
+    }
+
+    printf("%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%llu,%llu,%lu,%lu,%llu\n", opName, (unsigned long)calls, (unsigned long)commands,
+           (unsigned long)(s->commands[17] - opStats.commands[17]),
+           (unsigned long)(s->commands[18] - opStats.commands[18]),
+           (unsigned long)(s->commands[24] - opStats.commands[24]),
+           (unsigned long)(s->commands[25] - opStats.commands[25]),
+           (unsigned long)(s->commands[12] - opStats.commands[12]),
+           (unsigned long long)(s->bytesClocked - opStats.bytesClocked),
+           (unsigned long long)(s->busyBytes - opStats.busyBytes),
+           (unsigned long)(s->blocksRead - opStats.blocksRead),
+           (unsigned long)(s->blocksWritten - opStats.blocksWritten),
+           (unsigned long long)((Emu_Now() - opStart) * 1000000 / SystemCoreClock));
+}
+
+//Write an empty FAT16 volume (no partition table, like a "super floppy") - the driver only needs a mountable card
+static int FormatImage(const char *path, uint32_t megabytes)
+{
+    FILE *f;
+    uint32_t totalSectors = megabytes * 2048;
+    uint8_t sectorsPerCluster = 1;
+    uint32_t fatSectors;
+    uint32_t clusters;
+    uint8_t reservedSectors;
+
+    if(megabytes < 4 || megabytes > 2048)
+    {
+        fprintf(stderr, "Image size must be 4...2048 MB\n");
+        return -1;
+    }
+
+    while(totalSectors / sectorsPerCluster > 65000)
+    {
+        sectorsPerCluster <<= 1; //FAT16 needs 4085 < clusters < 65525
+    }
+    clusters = totalSectors / sectorsPerCluster;
+    fatSectors = ((clusters + 2) * 2 + 511) / 512;
+    reservedSectors = sectorsPerCluster - (2 * fatSectors + 32) % sectorsPerCluster; //Cluster aligned data area, like f_mkfs()
+
+    f = fopen(path, "w+b");
+    if(!f)
+    {
+        return -1;
+    }
+
+    //Sparse file of the full size
+    fseek(f, (long)totalSectors * 512 - 1, SEEK_SET);
+    fputc(0, f);
+
+    memset(buffer, 0, sizeof(buffer));
+    buffer[0] = 0xEB; buffer[1] = 0x3C; buffer[2] = 0x90; //Jump
+    memcpy(&buffer[3], "MSWIN4.1", 8);
+    buffer[11] = 0x00; buffer[12] = 0x02;                 //512 bytes per sector
+    buffer[13] = sectorsPerCluster;
+    buffer[14] = reservedSectors;                         //Reserved sectors
+    buffer[16] = 2;                                       //Number of FATs
+    buffer[17] = 0x00; buffer[18] = 0x02;                 //512 root directory entries
+    if(totalSectors < 65536)
+    {
+        buffer[19] = totalSectors; buffer[20] = totalSectors >> 8;
+    }
+    else
+    {
+        buffer[32] = totalSectors; buffer[33] = totalSectors >> 8; buffer[34] = totalSectors >> 16; buffer[35] = totalSectors >> 24;
+    }
+    buffer[21] = 0xF8;                                    //Media
+    buffer[22] = fatSectors; buffer[23] = fatSectors >> 8;
+    buffer[24] = 63; buffer[26] = 255;                    //Geometry
+    buffer[36] = 0x80;                                    //Drive number
+    buffer[38] = 0x29;                                    //Extended boot signature
+    buffer[39] = 0x78; buffer[40] = 0x56; buffer[41] = 0x34; buffer[42] = 0x12;
+    memcpy(&buffer[43], "NO NAME    ", 11);
+    memcpy(&buffer[54], "FAT16   ", 8);
+    buffer[510] = 0x55; buffer[511] = 0xAA;
+    fseek(f, 0, SEEK_SET);
+    fwrite(buffer, 1, 512, f);
+
+    //FAT[0] and FAT[1] of both copies, the rest of the FAT and the root directory are already zero
+    memset(buffer, 0, sizeof(buffer));
+    buffer[0] = 0xF8; buffer[1] = 0xFF; buffer[2] = 0xFF; buffer[3] = 0xFF;
+    for(uint8_t copy = 0; copy < 2; copy++)
+    {
+        fseek(f, (long)(reservedSectors + copy * fatSectors) * 512, SEEK_SET);
+        fwrite(buffer, 1, 512, f);
+    }
+
+    fclose(f);
+    printf("Formatted %s: %lu MB FAT16, %u sectors/cluster, %lu clusters\n", path, (unsigned long)megabytes, sectorsPerCluster, (unsigned long)clusters);
+    return 0;
+}
+
+//Count the records of a binary log, -1 if the sequence has a gap or a record is out of place (record n must have the
+//timestamp n * 1000). Damaged frames are skipped like binlog2csv does, a shadow copy of the frame before it only adds
+//the records past that frame's count
+static long BinLogRecords(const char *path)
+{
+    UINT readBytes;
+    long records = 0;
+    uint32_t sequence = 0;
+    uint32_t frameSequence;
+    uint16_t count;
+    uint16_t lastCount = 0;
+    uint16_t from;
+    uint16_t crc;
+
+    if(f_open(&file, path, FA_READ) != FR_OK)
+    {
+        return -1;
+    }
+
+    while(f_read(&file, buffer, SD_BINLOG_FRAME_SIZE, &readBytes) == FR_OK && readBytes == SD_BINLOG_FRAME_SIZE)
+    {
+        crc = buffer[10] | (buffer[11] << 8);
+        buffer[10] = buffer[11] = 0;
+        if(buffer[0] != (SD_BINLOG_MAGIC & 0xFF) || buffer[1] != (SD_BINLOG_MAGIC >> 8) || crc != SD_BinLog_Crc16(0, buffer, SD_BINLOG_FRAME_SIZE))
+        {
+            continue; //Torn by a power cut, or a slot the cut left unwritten
+        }
+
+        frameSequence = buffer[4] | (buffer[5] << 8) | (buffer[6] << 16) | ((uint32_t)buffer[7] << 24);
+        count = buffer[8] | (buffer[9] << 8);
+        from = 0;
+        if((frameSequence & SD_BINLOG_SHADOW) && sequence && (frameSequence & ~SD_BINLOG_SHADOW) == sequence - 1)
+        {
+            from = lastCount; //Newer copy of the frame before it
+        }
+        else if((frameSequence & ~SD_BINLOG_SHADOW) == sequence)
+        {
+            sequence++;
+            lastCount = 0;
+        }
+        else
+        {
+            records = -1;
+            break;
+        }
+
+        for(uint16_t i = from; i < count; i++)
+        {
+            const uint8_t *record = &buffer[SD_BINLOG_HEADER_SIZE + i * sizeof(SD_BinRecord)];
+
+            if((uint32_t)(record[0] | (record[1] << 8) | (record[2] << 16) | ((uint32_t)record[3] << 24)) != (uint32_t)records * 1000)
+            {
+                f_close(&file);
+                return -1;
+            }
+            records++;
+        }
+        if(count > lastCount)
+        {
+            lastCount = count;
+        }
+    }
+
+    f_close(&file);
+    return records;
+}
+
+//1 if the volume has a free run of 'size' bytes that starts on an erase block boundary, checked with f_expand() without
+//allocation from every boundary (a file of the name is created empty first, so its own old clusters count as free)
+static uint8_t AlignedRunFree(const char *path, FSIZE_t size)
+{
+    DWORD saved = fs.last_clst;
+    DWORD block = SD_Info.auSectors;
+    DWORD cluster = 2 + ((block - fs.database % block) % block) / fs.csize;
+    uint8_t found = 0;
+
+    if(f_open(&file, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+    {
+        return 0;
+    }
+    for(; !found && cluster < fs.n_fatent; cluster += block / fs.csize)
+    {
+        fs.last_clst = cluster; //The scan of f_expand() starts at last_clst and leaves it one before the run
+        found = (f_expand(&file, size, 0) == FR_OK && fs.last_clst + 1 == cluster);
+    }
+    fs.last_clst = saved;
+    f_close(&file);
+    return found;
+}
+
+//Host CPU time of f_gets() vs. SD_LineReader over a file. The card model has no CPU cost, so the bench lines of
+//SD_Bench_LineRead() only show bus time here; this gives the ratio of the parsing work itself.
+static void LineReaderCpu(const char *path)
+{
+    SD_LineReader reader;
+    char line[64];
+    clock_t start;
+    double getsTime;
+    double readerTime;
+
+    if(f_open(&file, path, FA_READ) != FR_OK)
+    {
+        return;
+    }
+    start = clock();
+    while(f_gets(line, sizeof(line), &file));
+    getsTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    f_lseek(&file, 0);
+    SD_LineReader_Init(&reader, &file, (char *)buffer, sizeof(buffer));
+    start = clock();
+    while(SD_LineReader_Next(&reader, 0));
+    readerTime = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    printf("#host cpu %s: f_gets %.1f ns/byte, SD_LineReader %.1f ns/byte\n", path, getsTime * 1e9 / f_size(&file),
+           readerTime * 1e9 / f_size(&file));
+    f_close(&file);
+}
+
+static void CaptureTimerIrq(void)
+{
+    uint32_t sample = captureNumber++;
+
+    SD_Capture_Put(&capture, &sample);
+}
+
+//Capture 'sectors' sectors of 4-byte samples from an emulated timer interrupt at 'rate' samples/s, the main loop only
+//services the pipeline. Checks that the file holds exactly the stored samples in order, returns the overruns or -1.
+static long CaptureRun(uint32_t rate, uint32_t sectors)
+{
+    uint32_t expected = 0;
+    uint32_t gaps = 0;
+    UINT readBytes;
+    FRESULT res;
+
+    res = SD_RawLog_Create(&captureLog, "0:CAPTURE.BIN", sectors * SD_CAPTURE_SECTOR, 0, 64);
+    if(res != FR_OK)
+    {
+        return -1;
+    }
+    SD_Capture_Init(&capture, &captureLog, buffer, captureBuffer, sizeof(uint32_t));
+    captureNumber = 0;
+
+    Emu_SetTimer(SystemCoreClock / rate, CaptureTimerIrq);
+    while(res == FR_OK && capture.sectors < sectors - 1)
+    {
+        if(capture.full)
+        {
+            res = SD_Capture_Service(&capture);
+        }
+        else
+        {
+            Emu_Advance(40); //Main loop polling
+        }
+    }
+    Emu_SetTimer(0, 0);
+    if(SD_Capture_Stop(&capture) != FR_OK || res != FR_OK)
+    {
+        return -1;
+    }
+
+    if(f_open(&file, "0:CAPTURE.BIN", FA_READ) != FR_OK)
+    {
+        return -1;
+    }
+    if(f_size(&file) != capture.samples * sizeof(uint32_t))
+    {
+        f_close(&file);
+        return -1;
+    }
+    while(f_read(&file, buffer, sizeof(buffer), &readBytes) == FR_OK && readBytes)
+    {
+        for(UINT i = 0; i < readBytes; i += sizeof(uint32_t))
+        {
+            uint32_t sample;
+
+            memcpy(&sample, &buffer[i], sizeof(sample));
+            if(sample < expected)
+            {
+                f_close(&file);
+                return -1; //Out of order or duplicated
+            }
+            gaps += sample - expected;
+            expected = sample + 1;
+        }
+    }
+    f_close(&file);
+
+    gaps += captureNumber - expected; //Dropped at the end
+    return (gaps == capture.overruns) ? (long)capture.overruns : -1;
+}
+
+//ADXL345 on the same SPI1: CPOL high, 2nd edge, 48 MHz / 32, CS on PC3. The emulated watermark interrupt goes
+//through SPI_Bus_Run(), the drain reads what the FIFO holds by now: one 7-byte read (address + X/Y/Z) per entry.
+static SPI_BusDevice accelDevice;
+static uint32_t accelIrqs;
+static uint32_t accelEntries;
+static uint32_t accelLate;
+static uint32_t accelModeErrors;
+static uint64_t accelIrqAt;
+static uint64_t accelMaxDelay;
+
+static void AccelDrain(void)
+{
+    uint64_t delay = Emu_Now() - accelIrqAt;
+
+    if(delay > accelMaxDelay)
+    {
+        accelMaxDelay = delay;
+    }
+    if(delay > Emu_UsToCycles(ACCEL_SLACK_US))
+    {
+        accelLate++; //The FIFO would have overflowed
+    }
+    if(SPI1_SetMode(accelDevice.ctlr1, SPI_BUS_CTLR1_MASK))
+    {
+        accelModeErrors++; //The bus wasn't set up for the accelerometer
+    }
+
+    while(accelEntries < accelIrqs * ACCEL_WATERMARK)
+    {
+        GPIO_WriteBit(GPIOC, GPIO_Pin_3, Bit_RESET);
+        SPI_TransferByte(0xF2); //Read, multi-byte, DATAX0
+        for(uint8_t i = 0; i < 6; i++)
+        {
+            SPI_TransferByte(0xFF);
+        }
+        GPIO_WriteBit(GPIOC, GPIO_Pin_3, Bit_SET);
+        accelEntries++;
+    }
+}
+
+static void AccelIrq(void)
+{
+    accelIrqs++;
+    accelIrqAt = Emu_Now();
+    SPI_Bus_Run(&accelDevice, AccelDrain);
+}
+
+//Write and read back 'sectors' sectors while the accelerometer interrupt shares SPI1. Returns the errors: file data,
+//SPI mode, FIFO entries that were never read
+static uint32_t BusSharedRun(uint32_t sectors)
+{
+    uint32_t errors = 0;
+    uint32_t switches = SPI_Bus_Switches;
+    uint32_t deferred = SPI_Bus_Deferred;
+    UINT count;
+
+    SPI_Bus_Register(&accelDevice, GPIOC, GPIO_Pin_3, SPI_CPOL_High | SPI_CPHA_2Edge | SPI_FirstBit_MSB, SPI_BaudRatePrescaler_32);
+    accelIrqs = accelEntries = accelLate = accelModeErrors = 0;
+    accelMaxDelay = 0;
+
+    Emu_SetTimer(SystemCoreClock / (ACCEL_RATE_HZ / ACCEL_WATERMARK), AccelIrq);
+    if(f_open(&file, "0:ACCEL.BIN", FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+    {
+        errors++;
+    }
+    for(uint32_t i = 0; i < sectors && !errors; i++)
+    {
+        memset(buffer, (uint8_t)i, sizeof(buffer));
+        errors += (f_write(&file, buffer, sizeof(buffer), &count) != FR_OK || count != sizeof(buffer));
+    }
+    errors += (f_close(&file) != FR_OK);
+    if(!errors && f_open(&file, "0:ACCEL.BIN", FA_READ) == FR_OK)
+    {
+        for(uint32_t i = 0; i < sectors; i++)
+        {
+            if(f_read(&file, buffer, sizeof(buffer), &count) != FR_OK || count != sizeof(buffer) || buffer[0] != (uint8_t)i || buffer[511] != (uint8_t)i)
+            {
+                errors++;
+                break;
+            }
+        }
+        f_close(&file);
+    }
+    Emu_SetTimer(0, 0);
+
+    printf("#bus_shared: %lu interrupts, %lu deferred, %lu device switches, worst delay %lu us (FIFO slack %u us), %lu late\n",
+           (unsigned long)accelIrqs, (unsigned long)(SPI_Bus_Deferred - deferred), (unsigned long)(SPI_Bus_Switches - switches),
+           (unsigned long)(accelMaxDelay * 1000000 / SystemCoreClock), ACCEL_SLACK_US, (unsigned long)accelLate);
+
+    return errors + accelModeErrors + (accelEntries != accelIrqs * ACCEL_WATERMARK);
+}
+
+//Check every record of the journal (record n holds timestamp n), returns the number of records or -1
+static long JournalCheck(void)
+{
+    const SD_BinRecord *records;
+
+    for(uint32_t sector = 0; sector <= journal.next && sector < journal.sectors; sector++)
+    {
+        uint16_t count = journal.perSector;
+
+        if(sector == journal.next)
+        {
+            records = (const SD_BinRecord *)&journal.buffer[SD_JOURNAL_SECTOR_HEADER]; //Partial sector
+            count = journal.count;
+        }
+        else
+        {
+            if(disk_read(0, captureBuffer, journal.startSector + 1 + sector, 1) != RES_OK)
+            {
+                return -1;
+            }
+            records = (const SD_BinRecord *)&captureBuffer[SD_JOURNAL_SECTOR_HEADER];
+        }
+
+        for(uint16_t i = 0; i < count; i++)
+        {
+            if(records[i].timestamp != sector * journal.perSector + i)
+            {
+                return -1;
+            }
+        }
+    }
+    return (long)SD_Journal_Records(&journal);
+}
+
+//Expected content of sector 's' of the cache check after its 'generation'-th write
+static void CachePattern(uint8_t *data, uint32_t s, uint8_t generation)
+{
+    for(uint16_t i = 0; i < 512; i++)
+    {
+        data[i] = (generation == CACHE_ERASED) ? 0 : (uint8_t)(s * 7 + i + generation * 101);
+    }
+}
+
+//Single-sector disk_write()/disk_read() calls on the sectors of a preallocated file, like the FatFs window makes them,
+//for the sector cache and the read-ahead of diskio.c (build with -DDISKIO_CACHE_SECTORS=4 -DDISKIO_READAHEAD_SECTORS=4):
+//scattered writes that evict dirty slots (LRU), rewrites that merge into a cached slot, reads served from the cache,
+//TRIM of a sector that is dirty in the cache, the ascending-LBA write-back of CTRL_SYNC (checked on the card itself,
+//past diskio.c) and a write into a prefetched run. Without them the same calls go straight to the card.
+static long DiskCacheCheck(void)
+{
+    uint8_t generation[CACHE_CHECK_SECTORS] = {0};
+    LBA_t first, trim[2];
+    long errors = 0;
+    uint32_t s;
+
+    if(SD_RawLog_Create(&captureLog, "0:CACHECHK.BIN", CACHE_CHECK_SECTORS * 512, 0, 0) != FR_OK)
+    {
+        return 1;
+    }
+    first = captureLog.startSector;
+
+    for(uint32_t i = 0; i < CACHE_CHECK_SECTORS; i++) //13 is odd: every sector once, never two neighbours in a row
+    {
+        s = (i * 13) % CACHE_CHECK_SECTORS;
+        CachePattern(buffer, s, generation[s] = 1);
+        errors += disk_write(0, buffer, first + s, 1) != RES_OK;
+    }
+    for(s = CACHE_CHECK_SECTORS - 3; s < CACHE_CHECK_SECTORS; s++) //Among the last written: still in the cache
+    {
+        CachePattern(buffer, s, generation[s] = 2);
+        errors += disk_write(0, buffer, first + s, 1) != RES_OK;
+    }
+
+    CachePattern(buffer, 5, generation[5] = 3); //Dirty in the cache, then erased: the cached copy must not come back
+    errors += disk_write(0, buffer, first + 5, 1) != RES_OK;
+    trim[0] = trim[1] = first + 5;
+    errors += disk_ioctl(0, CTRL_TRIM, trim) != RES_OK;
+    generation[5] = CACHE_ERASED;
+
+    for(uint32_t i = 0; i < CACHE_CHECK_SECTORS; i++)
+    {
+        s = (i * 7) % CACHE_CHECK_SECTORS;
+        CachePattern(captureBuffer, s, generation[s]);
+        errors += disk_read(0, buffer, first + s, 1) != RES_OK || memcmp(buffer, captureBuffer, 512);
+    }
+
+    errors += disk_ioctl(0, CTRL_SYNC, 0) != RES_OK;
+    for(s = 0; s < CACHE_CHECK_SECTORS; s++) //The card itself
+    {
+        CachePattern(captureBuffer, s, generation[s]);
+        errors += SD_ReadDisk(buffer, first + s, 1) || memcmp(buffer, captureBuffer, 512);
+    }
+
+    for(s = 0; s < CACHE_CHECK_SECTORS; s++) //Sequential: the read-ahead fetches a run from the second sector on
+    {
+        CachePattern(captureBuffer, s, generation[s]);
+        errors += disk_read(0, buffer, first + s, 1) != RES_OK || memcmp(buffer, captureBuffer, 512);
+        if(s == 2) //Sector 4 is prefetched now, its new content must win
+        {
+            CachePattern(buffer, 4, generation[4] = 4);
+            errors += disk_write(0, buffer, first + 4, 1) != RES_OK;
+        }
+    }
+    errors += disk_ioctl(0, CTRL_SYNC, 0) != RES_OK;
+
+    captureLog.next = CACHE_CHECK_SECTORS; //Written here: the file keeps its size
+    SD_RawLog_Close(&captureLog);
+    return errors;
+}
+
+//Reset to the first logged sample: the SD part of main.c without the countdown, the read/write demo and the prints.
+//  legacy  SD_Initialize() at 187.5 kHz, SD_TuneSpeed(), f_mount() (initializes the card again), then the DS18B20
+//          conversion and the sample
+//  fast    the conversion starts first, SD_Boot_Init() + SD_Boot_Mount(), the sample waits for the rest of the conversion
+static FRESULT BootRun(uint8_t fast)
+{
+    SD_SpeedResult results[7];
+    uint8_t steps;
+    uint64_t sensorReady;
+    FRESULT result;
+    UINT count;
+
+    f_unmount("0:");
+    SD_SpiPrescaler = SPI_BaudRatePrescaler_4; //Power-on values
+    SD_InitPrescaler = fast ? SD_INIT_PRESCALER_AUTO : SPI_BaudRatePrescaler_256;
+    sensorReady = Emu_Now() + Emu_UsToCycles(BOOT_SENSOR_US);
+
+    if(fast)
+    {
+        if(SD_Boot_Init(fs.win))
+        {
+            return FR_NOT_READY;
+        }
+        result = SD_Boot_Mount(&fs);
+    }
+    else
+    {
+        if(SD_Initialize())
+        {
+            return FR_NOT_READY;
+        }
+        SD_TuneSpeed(fs.win, 0, results, &steps);
+        SD_HighSpeed();
+        result = f_mount(&fs, "0:", 1);
+        sensorReady = Emu_Now() + Emu_UsToCycles(BOOT_SENSOR_US); //The conversion starts in the logging loop
+    }
+    SD_InitPrescaler = SD_INIT_PRESCALER_AUTO;
+    if(result != FR_OK)
+    {
+        return result;
+    }
+
+    if(Emu_Now() < sensorReady)
+    {
+        Emu_Advance((uint32_t)(sensorReady - Emu_Now()));
+    }
+
+    result = f_open(&file, "0:BOOT.TXT", FA_OPEN_APPEND | FA_WRITE);
+    if(result == FR_OK)
+    {
+        result = f_write(&file, "21.5\n", 5, &count);
+        f_close(&file); //The sample is on the card
+    }
+    return result;
+}
+
+static void Usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s <image> [-f MB] [-n samples] [-r read_us] [-w write_us] [-e erased_us] [-i init_us] [-s] [-b] [-l kB]\n"
+                    "  -f MB       create a fresh FAT16 image of the given size first\n"
+                    "  -n samples  logger samples (default %d)\n"
+                    "  -r us       card read latency (token delay)\n"
+                    "  -w us       card busy time after every written block\n"
+                    "  -e us       card busy time after a block written into an erased area (CMD38)\n"
+                    "  -i us       card init time from CMD0 to ready (default: 20 ACMD41 polls, %d us for the boot comparison)\n"
+                    "  -s          emulate an SDSC card (byte addressing) instead of SDHC\n"
+                    "  -b          also run the benchmark suite of sd_bench.c\n"
+                    "  -l kB       log growth benchmark: reopen per sample vs. SD_Log, kB per mode\n", name, LOG_SAMPLES, BOOT_INIT_US);
+}
+
+int main(int argc, char **argv)
+{
+    EmuCardConfig config = EmuCard_DefaultConfig();
+    uint32_t samples = LOG_SAMPLES;
+    uint32_t formatMb = 0;
+    const char *path;
+    FRESULT result;
+    UINT count;
+    char line[64];
+    uint32_t errors = 0;
+    uint8_t benchmark = 0;
+    uint32_t growthKb = 0;
+
+    if(argc < 2)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+    path = argv[1];
+
+    for(int i = 2; i < argc; i++)
+    {
+        if(!strcmp(argv[i], "-f") && i + 1 < argc)
+        {
+            formatMb = strtoul(argv[++i], 0, 0);
+        }
+        else if(!strcmp(argv[i], "-n") && i + 1 < argc)
+        {
+            samples = strtoul(argv[++i], 0, 0);
+        }
+        else if(!strcmp(argv[i], "-r") && i + 1 < argc)
+        {
+            config.readLatencyUs = strtoul(argv[++i], 0, 0);
+        }
+        else if(!strcmp(argv[i], "-w") && i + 1 < argc)
+        {
+            config.writeLatencyUs = strtoul(argv[++i], 0, 0);
+        }
+        else if(!strcmp(argv[i], "-e") && i + 1 < argc)
+        {
+            config.erasedWriteLatencyUs = strtoul(argv[++i], 0, 0);
+        }
+        else if(!strcmp(argv[i], "-i") && i + 1 < argc)
+        {
+            config.initTimeUs = strtoul(argv[++i], 0, 0);
+        }
+        else if(!strcmp(argv[i], "-l") && i + 1 < argc)
+        {
+            growthKb = strtoul(argv[++i], 0, 0);
+        }
+        else if(!strcmp(argv[i], "-b"))
+        {
+            benchmark = 1;
+        }
+        else if(!strcmp(argv[i], "-s"))
+        {
+            config.highCapacity = 0;
+        }
+        else
+        {
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if(formatMb && FormatImage(path, formatMb))
+    {
+        return 1;
+    }
+
+    if(EmuCard_Open(path, &config))
+    {
+        fprintf(stderr, "Can't open %s\n", path);
+        return 1;
+    }
+
+    printf("op,calls,commands,cmd17,cmd18,cmd24,cmd25,cmd12,spi_bytes,busy_bytes,blocks_read,blocks_written,time_us\n");
+
+    Op_Begin("init");
+    if(SD_Initialize())
+    {
+        fprintf(stderr, "SD_Initialize failed\n");
+        return 1;
+    }
+    SD_HighSpeed();
+    Op_End(1);
+    printf("#card type %u, %lu sectors, erase block %lu sectors\n", SD_Type, (unsigned long)SD_GetSectorCount(), (unsigned long)SD_Info.auSectors);
+
+    Op_Begin("mount");
+    result = f_mount(&fs, "0:", 1);
+    Op_End(1);
+    if(result != FR_OK)
+    {
+        fprintf(stderr, "f_mount failed: %u\n", result);
+        return 1;
+    }
+
+    //The geometry comes from SD_Initialize(): no command may reach the card here
+    Op_Begin("geometry");
+    for(uint8_t i = 0; i < 100; i++)
+    {
+        DWORD value = 0;
+
+        disk_ioctl(0, GET_SECTOR_COUNT, &value);
+        if(value != EmuCard_Sectors())
+        {
+            errors++;
+        }
+        disk_ioctl(0, GET_BLOCK_SIZE, &value);
+        if(value != SD_Info.auSectors)
+        {
+            errors++;
+        }
+    }
+    Op_End(100);
+
+    //Same pattern as the logger in main.c: create the file, then open, seek to the end, write and close per sample
+    Op_Begin("create");
+    result = f_open(&file, "0:Writetes.txt", FA_CREATE_ALWAYS | FA_WRITE);
+    if(result == FR_OK)
+    {
+        f_write(&file, "Temperature log\n", 16, &count);
+        f_close(&file);
+    }
+    Op_End(1);
+
+    Op_Begin("log_sample");
+    for(uint32_t i = 0; i < samples; i++)
+    {
+        int length = snprintf(line, sizeof(line), "%lu,%d.%02d\n", (unsigned long)i, 20 + (int)(i % 5), (int)(i * 7 % 100));
+
+        result = f_open(&file, "0:Writetes.txt", FA_OPEN_ALWAYS | FA_WRITE);
+        if(result == FR_OK)
+        {
+            f_lseek(&file, f_size(&file));
+            f_write(&file, line, length, &count);
+            f_close(&file);
+        }
+        else
+        {
+            errors++;
+        }
+#if SD_USE_WRITE_SESSION
+        SD_WriteSessionTick(1000);
+#endif
+    }
+    Op_End(samples);
+
+    //The same samples through SD_Log: the file stays open, f_sync() every 5 samples, every 4th sample is indexed
+    Op_Begin("log_keep_open");
+    result = f_open(&file, "0:Writetes.idx", FA_CREATE_ALWAYS | FA_WRITE);
+    f_close(&file);
+    if(result == FR_OK)
+    {
+        result = SD_Log_Open(&logger, "0:Writetes.txt", 5, 0);
+    }
+    if(result == FR_OK)
+    {
+        result = SD_Index_Open(&logIndex, "0:Writetes.idx", 4);
+        SD_Log_SetIndex(&logger, (result == FR_OK) ? &logIndex : 0);
+    }
+    for(uint32_t i = 0; result == FR_OK && i < samples; i++)
+    {
+        int length = snprintf(line, sizeof(line), "%lu,%d.%02d\n", (unsigned long)(samples + i), 20 + (int)(i % 5), (int)(i * 7 % 100));
+
+        result = SD_Log_WriteStamped(&logger, samples + i, line, length);
+    }
+    SD_Log_Close(&logger);
+    Op_End(samples);
+    if(result != FR_OK)
+    {
+        errors++;
+    }
+
+    //Time lookups through the index: every sample must be found, the unindexed log_sample lines from the start of the file
+    Op_Begin("index_lookup");
+    result = SD_Index_Open(&logIndex, "0:Writetes.idx", 4);
+    if(result == FR_OK)
+    {
+        result = f_open(&file, "0:Writetes.txt", FA_READ);
+    }
+    for(uint32_t t = 0; result == FR_OK && t < 2 * samples; t++)
+    {
+        uint32_t found = 0xFFFFFFFF;
+
+        result = SD_Index_Seek(&logIndex, &file, t);
+        while(result == FR_OK && f_gets(line, sizeof(line), &file))
+        {
+            if(line[0] >= '0' && line[0] <= '9' && (found = strtoul(line, 0, 10)) >= t)
+            {
+                break;
+            }
+        }
+        if(found != t)
+        {
+            errors++;
+        }
+    }
+    f_close(&file);
+    SD_Index_Close(&logIndex);
+    Op_End(2 * samples);
+    if(result != FR_OK)
+    {
+        errors++;
+    }
+
+    //Binary records: two sessions, the second one continues the flushed partial frame of the first
+    f_open(&file, "0:TEMP.BIN", FA_CREATE_ALWAYS | FA_WRITE); //Start empty, the image may come from an earlier run
+    f_close(&file);
+    Op_Begin("binlog_append");
+    for(uint8_t session = 0; session < 2; session++)
+    {
+        result = SD_BinLog_Open(&binLogger, "0:TEMP.BIN", buffer, 4);
+        for(uint32_t i = 0; result == FR_OK && i < samples; i++)
+        {
+            result = SD_BinLog_Append(&binLogger, (session * samples + i) * 1000, 1, (int16_t)(400 + i % 16), session);
+        }
+        SD_BinLog_Close(&binLogger);
+    }
+    Op_End(2 * samples);
+    if(result != FR_OK || BinLogRecords("0:TEMP.BIN") != 2 * samples)
+    {
+        errors++;
+    }
+
+    //Binary records with a flush per record and power cuts at different points. After every "reboot" the records flushed
+    //before the cut must be back, in order, and the log continues behind them
+    f_open(&file, "0:CUT.BIN", FA_CREATE_ALWAYS | FA_WRITE);
+    f_close(&file);
+    Op_Begin("binlog_powercut");
+    {
+        uint32_t next = 0;
+
+        for(uint32_t trial = 0; trial < 48; trial++)
+        {
+            uint32_t durable = next;
+            long found;
+
+            result = SD_BinLog_Open(&binLogger, "0:CUT.BIN", buffer, 0);
+            if(trial & 1)
+            {
+                EmuCard_PowerCut(1 + (trial * 7) % 19);
+            }
+            else //Around the write of the full frame: a block for the data and one for the directory per record
+            {
+                EmuCard_PowerCut(2 * (SD_BINLOG_RECORDS_PER_FRAME - next % SD_BINLOG_RECORDS_PER_FRAME) - 2 + trial % 6);
+            }
+            for(uint32_t i = 0; i < samples && result == FR_OK; i++)
+            {
+                result = SD_BinLog_Append(&binLogger, next * 1000, 1, (int16_t)i, 0);
+                if(result == FR_OK)
+                {
+                    next++;
+                    result = SD_BinLog_Flush(&binLogger);
+                }
+                if(result == FR_OK && EmuCard_PowerOn())
+                {
+                    durable = next; //This flush reached the card
+                }
+            }
+
+            disk_ioctl(0, CTRL_SYNC, 0); //The MCU reset: the log is never closed
+            EmuCard_PowerCut(0);
+            f_mount(&fs, "0:", 1);
+            found = BinLogRecords("0:CUT.BIN");
+            if(result != FR_OK || found < (long)durable)
+            {
+                printf("binlog: %ld records after the cut, %lu were flushed\n", found, (unsigned long)durable);
+                errors++;
+                break;
+            }
+            next = (uint32_t)found;
+        }
+    }
+    Op_End(1);
+
+    //The same with one flush per frame: the shadow copy of a full frame lies past the size of the last f_sync(), the
+    //cut hits the writes that follow it. The flushed records must survive a torn write of the frame's own slot too
+    Op_Begin("binlog_frame_cut");
+    {
+        uint32_t next = (uint32_t)BinLogRecords("0:CUT.BIN");
+
+        for(uint32_t trial = 0; trial < 24; trial++)
+        {
+            uint32_t durable = next;
+            long found;
+
+            result = SD_BinLog_Open(&binLogger, "0:CUT.BIN", buffer, 0);
+            for(uint32_t i = 0; i < 1 + (trial * 13) % 60 && result == FR_OK; i++)
+            {
+                result = SD_BinLog_Append(&binLogger, next * 1000, 1, (int16_t)i, 0);
+                next += (result == FR_OK);
+            }
+            if(result == FR_OK)
+            {
+                result = SD_BinLog_Flush(&binLogger);
+            }
+            if(result == FR_OK)
+            {
+                durable = next;
+            }
+            EmuCard_PowerCut(1 + trial % 6);
+            for(uint32_t i = 0; i < 2 * SD_BINLOG_RECORDS_PER_FRAME && result == FR_OK; i++)
+            {
+                result = SD_BinLog_Append(&binLogger, next * 1000, 1, (int16_t)i, 0);
+                next += (result == FR_OK);
+            }
+
+            disk_ioctl(0, CTRL_SYNC, 0); //The MCU reset: the log is never closed
+            EmuCard_PowerCut(0);
+            f_mount(&fs, "0:", 1);
+            found = BinLogRecords("0:CUT.BIN");
+            if(found < (long)durable)
+            {
+                printf("binlog: %ld records after the cut, %lu were flushed\n", found, (unsigned long)durable);
+                errors++;
+                break;
+            }
+            next = (uint32_t)found;
+        }
+    }
+    Op_End(1);
+
+    //Ring log: 8 data sectors (504 records) filled several times over, with a simulated power cut
+    //(the log is reopened without closing it, so the header is behind) before it is read back
+    f_open(&file, "0:RING.LOG", FA_CREATE_ALWAYS | FA_WRITE);
+    f_close(&file);
+    Op_Begin("ring_append");
+    result = SD_RingLog_Open(&ringLogger, "0:RING.LOG", 8, sizeof(SD_BinRecord), buffer, 4);
+    for(uint32_t i = 0; result == FR_OK && i < 20 * samples; i++)
+    {
+        SD_BinRecord record = {i, (int16_t)i, 2, 0};
+
+        result = SD_RingLog_Append(&ringLogger, &record);
+    }
+    if(result == FR_OK)
+    {
+        result = SD_RingLog_Flush(&ringLogger);
+    }
+    Op_End(20 * samples);
+
+    Op_Begin("ring_reopen");
+    if(result == FR_OK)
+    {
+        result = SD_RingLog_Open(&ringLogger, "0:RING.LOG", 8, sizeof(SD_BinRecord), buffer, 4);
+    }
+    Op_End(1);
+
+    Op_Begin("ring_read_last");
+    if(result == FR_OK)
+    {
+        SD_BinRecord last[100];
+        uint16_t expected = (20 * samples < 100) ? 20 * samples : 100;
+        uint16_t found = SD_RingLog_ReadLast(&ringLogger, last, 100);
+
+        if(found != expected || SD_RingLog_Count(&ringLogger) != ((20 * samples < 441) ? 20 * samples : 441 + (20 * samples - 441) % 63))
+        {
+            errors++;
+        }
+        for(uint16_t i = 0; i < found; i++)
+        {
+            if(last[i].timestamp != 20 * samples - found + i)
+            {
+                errors++;
+                break;
+            }
+        }
+        result = SD_RingLog_Close(&ringLogger);
+    }
+    Op_End(1);
+    if(result != FR_OK)
+    {
+        errors++;
+    }
+
+    //Power cut during a header write: the newest header copy is torn, the older one and the sector sequence numbers
+    //must give back the same ring. Once for each of the two copies
+    Op_Begin("ring_torn_header");
+    for(uint8_t round = 0; result == FR_OK && round < 2; round++)
+    {
+        uint32_t count = SD_RingLog_Count(&ringLogger);
+        SD_BinRecord last;
+
+        if(round) //Closing after the repair wrote the newest header into the torn copy again: move it to the other one
+        {
+            result = SD_RingLog_Open(&ringLogger, "0:RING.LOG", 8, sizeof(SD_BinRecord), buffer, 4);
+            if(result == FR_OK)
+            {
+                result = SD_RingLog_Close(&ringLogger);
+            }
+        }
+        memset(buffer, 0xA5, 512);
+        disk_write(0, buffer, ringLogger.startSector + (ringLogger.headerCopy ^ 1), 1);
+        result = SD_RingLog_Open(&ringLogger, "0:RING.LOG", 8, sizeof(SD_BinRecord), buffer, 4);
+        if(result == FR_OK && (SD_RingLog_Count(&ringLogger) != count || SD_RingLog_ReadLast(&ringLogger, &last, 1) != 1
+                               || last.timestamp != 20 * samples - 1))
+        {
+            errors++;
+        }
+        if(result == FR_OK)
+        {
+            result = SD_RingLog_Close(&ringLogger); //Rewrites the torn copy
+        }
+    }
+    Op_End(2);
+    if(result != FR_OK)
+    {
+        errors++;
+    }
+
+    //Power cut during a flush, or during the sector write that follows one: the records of the previous flush must
+    //survive, the newest 100 records read back in order and end no earlier than the last of them. The flush before the
+    //cut is at 30 records in the head sector, in the second half after one at 29, so it lands in either slot
+    Op_Begin("ring_torn_flush");
+    {
+        uint32_t next = 20 * samples;
+
+        for(uint8_t round = 0; result == FR_OK && round < 16; round++)
+        {
+            static const uint8_t more[4] = {10, 33, 40, 70};
+            SD_BinRecord last[100];
+            uint32_t durable = next;
+            uint16_t found;
+            uint8_t extra = 0;
+            uint8_t cut = 0;
+
+            result = SD_RingLog_Open(&ringLogger, "0:RING.LOG", 8, sizeof(SD_BinRecord), buffer, 4);
+            while(result == FR_OK && extra < more[round % 4])
+            {
+                SD_BinRecord record = {next, (int16_t)next, 2, 0};
+
+                result = SD_RingLog_Append(&ringLogger, &record);
+                next += (result == FR_OK);
+                if(cut)
+                {
+                    extra++;
+                }
+                else if(result == FR_OK && ringLogger.count == 29 && round >= 8)
+                {
+                    result = SD_RingLog_Flush(&ringLogger);
+                }
+                else if(result == FR_OK && ringLogger.count == 30)
+                {
+                    result = SD_RingLog_Flush(&ringLogger);
+                    durable = next;
+                    EmuCard_PowerCut(1 + (round / 4) % 2);
+                    cut = 1;
+                }
+            }
+            if(result == FR_OK)
+            {
+                SD_RingLog_Flush(&ringLogger); //Torn or lost with the power
+            }
+
+            disk_ioctl(0, CTRL_SYNC, 0); //The MCU reset: the log is never closed
+            EmuCard_PowerCut(0);
+            f_mount(&fs, "0:", 1);
+            result = SD_RingLog_Open(&ringLogger, "0:RING.LOG", 8, sizeof(SD_BinRecord), buffer, 4);
+            found = (result == FR_OK) ? SD_RingLog_ReadLast(&ringLogger, last, 100) : 0;
+            if(found != 100 || last[99].timestamp + 1 < durable)
+            {
+                printf("ring: %u records after the cut, the last %lu, %lu were flushed\n", found,
+                       found ? (unsigned long)last[found - 1].timestamp : 0UL, (unsigned long)durable);
+                errors++;
+                break;
+            }
+            for(uint16_t i = 1; i < found; i++)
+            {
+                if(last[i].timestamp != last[i - 1].timestamp + 1)
+                {
+                    errors++;
+                    break;
+                }
+            }
+            next = last[99].timestamp + 1;
+            if(result == FR_OK)
+            {
+                result = SD_RingLog_Close(&ringLogger);
+            }
+        }
+    }
+    Op_End(16);
+    if(result != FR_OK)
+    {
+        errors++;
+    }
+
+    Op_Begin("big_write");
+    result = f_open(&file, "0:BIGFILE.BIN", FA_CREATE_ALWAYS | FA_WRITE);
+    for(uint32_t offset = 0; result == FR_OK && offset < BIG_FILE_SIZE; offset += sizeof(buffer))
+    {
+        for(uint16_t i = 0; i < sizeof(buffer); i++)
+        {
+            buffer[i] = (uint8_t)((offset + i) * 31 + ((offset + i) >> 9));
+        }
+        result = f_write(&file, buffer, sizeof(buffer), &count);
+    }
+    f_close(&file);
+    Op_End(BIG_FILE_SIZE / sizeof(buffer));
+
+    Op_Begin("big_read");
+    result = f_open(&file, "0:BIGFILE.BIN", FA_READ);
+    for(uint32_t offset = 0; result == FR_OK && offset < BIG_FILE_SIZE; offset += sizeof(buffer))
+    {
+        result = f_read(&file, buffer, sizeof(buffer), &count);
+        for(uint16_t i = 0; i < count; i++)
+        {
+            if(buffer[i] != (uint8_t)((offset + i) * 31 + ((offset + i) >> 9)))
+            {
+                errors++;
+                break;
+            }
+        }
+    }
+    f_close(&file);
+    Op_End(BIG_FILE_SIZE / sizeof(buffer));
+
+    Op_Begin("gets_scan");
+    count = 0;
+    result = f_open(&file, "0:Writetes.txt", FA_READ);
+    while(result == FR_OK && f_gets(line, sizeof(line), &file))
+    {
+        count++;
+    }
+    f_close(&file);
+    Op_End(count);
+    if(count != 2 * samples + 1)
+    {
+        errors++;
+    }
+
+    //The same file through SD_LineReader with a small buffer (lines cross its end), compared with f_gets()
+    Op_Begin("lines_scan");
+    {
+        FIL gets;
+        SD_LineReader reader;
+        char small[20];
+        char *next;
+        uint16_t length;
+
+        count = 0;
+        result = f_open(&file, "0:Writetes.txt", FA_READ);
+        if(result == FR_OK && f_open(&gets, "0:Writetes.txt", FA_READ) == FR_OK)
+        {
+            SD_LineReader_Init(&reader, &file, small, sizeof(small));
+            while((next = SD_LineReader_Next(&reader, &length)) != 0)
+            {
+                if(!f_gets(line, sizeof(line), &gets) || strlen(line) != length + 1u || memcmp(line, next, length) != 0)
+                {
+                    errors++;
+                    break;
+                }
+                count++;
+            }
+            f_close(&gets);
+        }
+        f_close(&file);
+    }
+    Op_End(count);
+    if(count != 2 * samples + 1)
+    {
+        errors++;
+    }
+
+    //Journal with a commit per sample and power cuts at different points (torn block, later writes lost). After every
+    //"reboot" all records that were committed before the cut must be back, in order
+    Op_Begin("journal_powercut");
+    result = SD_Journal_Open(&journal, "0:JOURNAL.LOG", 64, sizeof(SD_BinRecord), buffer, 8);
+    for(uint32_t trial = 0; result == FR_OK && trial < 24; trial++)
+    {
+        uint32_t durable = SD_Journal_Records(&journal);
+        long found;
+
+        if(JournalCheck() != (long)durable)
+        {
+            errors++;
+        }
+
+        EmuCard_PowerCut(1 + (trial * 7) % 19);
+        for(uint32_t i = 0; i < samples && result == FR_OK; i++)
+        {
+            SD_BinRecord record = {SD_Journal_Records(&journal), (int16_t)i, 3, 0};
+
+            result = SD_Journal_Append(&journal, &record);
+            if(result == FR_OK)
+            {
+                result = SD_Journal_Commit(&journal);
+            }
+            if(EmuCard_PowerOn())
+            {
+                durable = SD_Journal_Records(&journal); //This commit reached the card
+            }
+        }
+        if(result == FR_DENIED)
+        {
+            break; //Full
+        }
+
+        disk_ioctl(0, CTRL_SYNC, 0); //Stands in for the MCU reset: the driver lets go of the card, nothing more is stored
+        EmuCard_PowerCut(0);
+        f_mount(&fs, "0:", 1);
+        result = SD_Journal_Open(&journal, "0:JOURNAL.LOG", 64, sizeof(SD_BinRecord), buffer, 8);
+        found = JournalCheck();
+        if(found < (long)durable)
+        {
+            printf("journal: %ld records after the cut, %lu were committed\n", found, (unsigned long)durable);
+            errors++;
+        }
+    }
+    SD_Journal_Close(&journal);
+    Op_End(1);
+    if(result != FR_OK && result != FR_DENIED)
+    {
+        errors++;
+    }
+
+    //Interrupt-driven capture: 4-byte samples at 5 kHz through the double buffer, no sample may be lost
+    Op_Begin("capture");
+    if(CaptureRun(5000, 32) != 0)
+    {
+        errors++;
+    }
+    Op_End(capture.samples);
+
+    if(benchmark)
+    {
+        //The benchmark suite of main.c (SD_BENCHMARK), raw transfers at the end of the card
+        SD_Bench_RawSuite(buffer, EmuCard_Sectors() - 64, 64, 1);
+        SD_Bench_WriteSession(buffer, EmuCard_Sectors() - 64, 64);
+        SD_Bench_FileSuite("0:BENCH.TXT", buffer);
+        SD_Bench_FileScan("0:BIGFILE.BIN", buffer, 64); //Line-sized reads, with the read-ahead if it is built in
+        SD_Bench_StreamLog("0:STREAM.LOG", buffer, 512, 64);
+        SD_Bench_RecordFormats("0:TEMP.TXT", "0:TEMP.BIN", buffer, 1000);
+        SD_Bench_RingLog("0:BENCH.RNG", buffer, 64, 20000);
+        SD_Bench_IndexLookup("0:BENCH.LOG", "0:BENCH.IDX", 40000, 16);
+        SD_Bench_LineRead("0:BENCH.LOG", buffer);
+        LineReaderCpu("0:BENCH.LOG");
+        SD_Bench_Capture("0:CAPTURE.BIN", buffer, captureBuffer, 256, 4, 64);
+        SD_Bench_Durability("0:DURABLE.LOG", "0:DURABLE.JRN", buffer, 500);
+        SD_Bench_SpiQueue(buffer);
+        SD_Bench_BusSwitch();
+
+        //Highest interrupt rate that the pipeline sustains for 256 sectors without an overrun, with a real producer
+        uint32_t low = 1000;
+        uint32_t high = 1000000;
+        while(high - low > low / 100)
+        {
+            uint32_t rate = low + (high - low) / 2;
+            long overruns = CaptureRun(rate, 256);
+
+            if(overruns < 0)
+            {
+                errors++;
+                break;
+            }
+            if(overruns == 0)
+            {
+                low = rate;
+            }
+            else
+            {
+                high = rate;
+            }
+        }
+        printf("capture_sustained,4,%lu\n", (unsigned long)low);
+    }
+
+    if(growthKb)
+    {
+        SD_Bench_LogGrowth("0:LOGBENCH.TXT", buffer, growthKb, 32);
+    }
+
+    //Preallocated logs start on an erase block (allocation unit) boundary while there is a free one, with other files
+    //created in between
+    Op_Begin("alloc_aligned");
+    for(uint8_t i = 0; i < 3; i++)
+    {
+        char name[16];
+        uint8_t aligned;
+
+        snprintf(name, sizeof(name), "0:ALIGN%u.BIN", i);
+        aligned = AlignedRunFree(name, 64 * 512); //With -b the benchmark files may take every boundary: then first fit
+        result = SD_RawLog_Create(&captureLog, name, 64 * 512, 0, 0);
+        if(result != FR_OK || (aligned && captureLog.startSector % SD_Info.auSectors))
+        {
+            printf("alloc_aligned: %s at sector %lu\n", name, (unsigned long)captureLog.startSector);
+            errors++;
+        }
+        SD_RawLog_Close(&captureLog);
+        f_open(&file, "0:ALIGNGAP.TXT", FA_OPEN_APPEND | FA_WRITE); //Takes the next free cluster
+        f_write(&file, name, 16, &count);
+        f_close(&file);
+    }
+    Op_End(3);
+
+    Op_Begin("disk_cache");
+    disk_cache_reset_stats();
+    errors += DiskCacheCheck();
+    Op_End(CACHE_CHECK_SECTORS);
+#if DISKIO_CACHE_SECTORS > 0 || DISKIO_READAHEAD_SECTORS > 0
+    {
+        DISK_CACHE_STATS stats;
+
+        disk_cache_stats(&stats);
+        printf("#disk_cache: %u slots, %u read-ahead, %lu hits, %lu misses, %lu prefetch hits\n", DISKIO_CACHE_SECTORS,
+               DISKIO_READAHEAD_SECTORS, (unsigned long)stats.hits, (unsigned long)stats.misses,
+               (unsigned long)stats.prefetchHits);
+    }
+#endif
+
+    //Accelerometer at 3200 Hz and the card on one SPI1: the card must never see the accelerometer mode, every
+    //watermark interrupt must be served before the FIFO overflows
+    Op_Begin("bus_shared");
+    errors += BusSharedRun(256);
+    Op_End(256);
+
+    Op_Begin("sync");
+    disk_ioctl(0, CTRL_SYNC, 0);
+    Op_End(1);
+
+    //Time from reset to the first logged sample, the flash cache of SD_Boot is empty at the start of the program
+    EmuCard_SetInitTime(config.initTimeUs ? config.initTimeUs : BOOT_INIT_US);
+    Op_Begin("boot_legacy");
+    errors += (BootRun(0) != FR_OK);
+    Op_End(1);
+    Op_Begin("boot_fast_cold");
+    errors += (BootRun(1) != FR_OK || SD_Boot_Status != SD_BOOT_COLD);
+    Op_End(1);
+    Op_Begin("boot_fast_cached");
+    errors += (BootRun(1) != FR_OK || SD_Boot_Status != SD_BOOT_CACHED || SD_Info.sectors != EmuCard_Sectors());
+    Op_End(1);
+
+    //A program that grew into the cache page: the page must be neither used nor erased
+    {
+        uint32_t page[16];
+
+        memcpy(page, EmuFlashPage, sizeof(page));
+        EmuFlashImageEnd += 4;
+        errors += (SD_Boot_PageFree() || BootRun(1) != FR_OK || SD_Boot_Status != SD_BOOT_COLD);
+        SD_Boot_Forget();
+        errors += (memcmp(page, EmuFlashPage, sizeof(page)) != 0);
+        EmuFlashImageEnd -= 4;
+    }
+
+    f_unmount("0:");
+    EmuCard_Close();
+
+    printf("#illegal commands %lu, protocol errors %lu, data errors %lu\n", (unsigned long)EmuCard_Stats.illegal,
+           (unsigned long)EmuCard_Stats.protocolErrors, (unsigned long)errors);
+    return (EmuCard_Stats.protocolErrors || errors) ? 2 : 0;
+}
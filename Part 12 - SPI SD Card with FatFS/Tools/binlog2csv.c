@@ -0,0 +1,130 @@
+/*
+    binlog2csv - convert SD_BinLog files (User/sd_binlog.h) to CSV on a PC
+
+    Build (from this folder):  gcc -O2 -I../User binlog2csv.c -o binlog2csv
+    Usage:                     ./binlog2csv [-s scale] LOG.BIN [more files...] > log.csv
+
+    Every 512-byte block of the input is checked: blocks with the frame magic and a matching CRC are decoded,
+    blocks with the magic but a bad CRC (torn by a power cut) are reported and skipped, anything else is ignored.
+    So the input can also be a raw dump of the card (dd if=/dev/sdX of=card.img) if the directory was lost.
+    A shadow frame (SD_BinLog_Flush() copy in the slot after its own) right after its frame only adds the records past
+    that frame's count, so every record is output once.
+    -s multiplies the value column, e.g. -s 0.0625 gives degC for DS18B20 raw readings.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sd_binlog.h"
+
+static uint16_t Get16(const uint8_t *p)
+{
+    return p[0] | ((uint16_t)p[1] << 8);
+}
+
+static uint32_t Get32(const uint8_t *p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+int main(int argc, char **argv)
+{
+    uint8_t frame[SD_BINLOG_FRAME_SIZE];
+    double scale = 0;
+    unsigned long frames = 0, damaged = 0, records = 0, gaps = 0;
+    uint32_t lastSequence = 0;
+    uint16_t lastCount = 0;
+    int haveSequence = 0;
+    int first = 1;
+
+    if(argc > 2 && !strcmp(argv[1], "-s"))
+    {
+        scale = strtod(argv[2], 0);
+        first = 3;
+    }
+
+    if(first >= argc)
+    {
+        fprintf(stderr, "Usage: %s [-s scale] LOG.BIN [more files...]\n", argv[0]);
+        return 1;
+    }
+
+    printf(scale ? "sequence,timestamp_ms,channel,flags,value,scaled\n" : "sequence,timestamp_ms,channel,flags,value\n");
+
+    for(int arg = first; arg < argc; arg++)
+    {
+        FILE *f = fopen(argv[arg], "rb");
+        unsigned long block = 0;
+
+        if(!f)
+        {
+            perror(argv[arg]);
+            return 1;
+        }
+
+        while(fread(frame, 1, sizeof(frame), f) == sizeof(frame))
+        {
+            uint16_t crc;
+            uint16_t count;
+            uint32_t sequence;
+            uint16_t from = 0;
+
+            block++;
+            if(Get16(&frame[0]) != SD_BINLOG_MAGIC || frame[2] != SD_BINLOG_VERSION)
+            {
+                continue; //Not a frame
+            }
+
+            crc = Get16(&frame[10]);
+            frame[10] = frame[11] = 0;
+            count = Get16(&frame[8]);
+            if(crc != SD_BinLog_Crc16(0, frame, SD_BINLOG_FRAME_SIZE) || frame[3] != sizeof(SD_BinRecord) || count > SD_BINLOG_RECORDS_PER_FRAME)
+            {
+                fprintf(stderr, "%s: damaged frame at block %lu\n", argv[arg], block - 1);
+                damaged++;
+                continue;
+            }
+
+            sequence = Get32(&frame[4]);
+            if((sequence & SD_BINLOG_SHADOW) && haveSequence && (sequence & ~SD_BINLOG_SHADOW) == lastSequence)
+            {
+                from = lastCount; //Newer (or older) copy of the frame before it
+            }
+            else
+            {
+                sequence &= ~SD_BINLOG_SHADOW; //The own slot of the frame was torn or overwritten
+                if(haveSequence && sequence != lastSequence + 1)
+                {
+                    fprintf(stderr, "%s: sequence jumps from %lu to %lu at block %lu\n", argv[arg], (unsigned long)lastSequence, (unsigned long)sequence, block - 1);
+                    gaps++;
+                }
+                lastSequence = sequence;
+                lastCount = 0;
+                haveSequence = 1;
+                frames++;
+            }
+            sequence &= ~SD_BINLOG_SHADOW;
+            if(count > lastCount)
+            {
+                lastCount = count;
+            }
+
+            for(uint16_t i = from; i < count; i++)
+            {
+                const uint8_t *r = &frame[SD_BINLOG_HEADER_SIZE + i * sizeof(SD_BinRecord)];
+                int16_t value = (int16_t)Get16(&r[4]);
+
+                printf("%lu,%lu,%u,%u,%d", (unsigned long)sequence, (unsigned long)Get32(&r[0]), r[6], r[7], value);
+                if(scale)
+                {
+                    printf(",%.4f", value * scale);
+                }
+                printf("\n");
+                records++;
+            }
+        }
+        fclose(f);
+    }
+
+    fprintf(stderr, "%lu frames, %lu records, %lu damaged frames, %lu sequence gaps\n", frames, records, damaged, gaps);
+    return damaged ? 2 : 0;
+}
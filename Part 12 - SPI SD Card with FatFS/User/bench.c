@@ -0,0 +1,101 @@
+#include "bench.h"
+#include "debug.h"
+#include <string.h>
+
+static uint32_t benchSavedCtlr; //SysTick configuration of the delay functions
+
+void Bench_Start(void)
+{
+    benchSavedCtlr = SysTick->CTLR;
+
+    SysTick->CTLR = 0; //Stop the counter before touching CNT
+    SysTick->CNT = 0;
+    SysTick->CTLR = BENCH_STK_STCLK | BENCH_STK_STE; //Count up from 0 with the core clock
+}
+
+uint32_t Bench_Stop(void)
+{
+    uint32_t cycles = SysTick->CNT;
+
+    SysTick->CTLR = benchSavedCtlr; //Restore HCLK/8, otherwise Delay_Us() would be 8x shorter
+
+    return cycles;
+}
+
+void Bench_PrintResult(const char *label, uint32_t ops, uint32_t bytes, uint32_t cycles)
+{
+    uint32_t perOp = 0;
+    uint32_t kbps = 0;
+
+    if(ops)
+    {
+        perOp = cycles / ops;
+    }
+
+    if(cycles)
+    {
+        kbps = (uint32_t)(((uint64_t)bytes * SystemCoreClock) / ((uint64_t)cycles * 1024)); //bytes / (cycles / f_core) / 1024
+    }
+
+    printf("%s,%lu,%lu,%lu,%lu,%lu\n", label, (unsigned long)ops, (unsigned long)bytes, (unsigned long)cycles, (unsigned long)perOp, (unsigned long)kbps);
+}
+
+void Bench_HistReset(Bench_Histogram *hist)
+{
+    memset(hist, 0, sizeof(Bench_Histogram));
+    hist->min = 0xFFFFFFFF;
+}
+
+void Bench_HistAdd(Bench_Histogram *hist, uint32_t cycles)
+{
+    uint8_t bin = 0;
+
+    while(bin < BENCH_HIST_BINS - 1 && (cycles >> (BENCH_HIST_SHIFT + bin)))
+    {
+        bin++; //log2 bins, no division needed
+    }
+
+    if(hist->bins[bin] != 0xFFFF)
+    {
+        hist->bins[bin]++;
+    }
+
+    hist->count++;
+    hist->sum += cycles;
+    if(cycles < hist->min)
+    {
+        hist->min = cycles;
+    }
+    if(cycles > hist->max)
+    {
+        hist->max = cycles;
+    }
+}
+
+void Bench_PrintHistHeader(void)
+{
+    printf("hist,label,count,min,mean,max");
+    for(uint8_t bin = 0; bin < BENCH_HIST_BINS - 1; bin++)
+    {
+        printf(",<%lu", (unsigned long)1 << (BENCH_HIST_SHIFT + bin));
+    }
+    printf(",inf\n");
+}
+
+void Bench_PrintHist(const char *label, const Bench_Histogram *hist)
+{
+    uint32_t mean = 0;
+
+    if(hist->count)
+    {
+        mean = (uint32_t)(hist->sum / hist->count);
+    }
+
+    printf("hist,%s,%lu,%lu,%lu,%lu", label, (unsigned long)hist->count, (unsigned long)(hist->count ? hist->min : 0),
+           (unsigned long)mean, (unsigned long)hist->max);
+    for(uint8_t bin = 0; bin < BENCH_HIST_BINS; bin++)
+    {
+        printf(",%u", hist->bins[bin]);
+    }
+    printf("\n");
+}
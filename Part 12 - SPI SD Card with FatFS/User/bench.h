@@ -0,0 +1,43 @@
+//bench.h - SysTick based cycle counter for the SD card benchmarks
+#ifndef BENCH_H
+#define BENCH_H
+
+#include "ch32v00x.h"
+
+//SysTick CTLR bits
+#define BENCH_STK_STE       (1 << 0) //Counter enable
+#define BENCH_STK_STCLK     (1 << 2) //1: HCLK, 0: HCLK/8 (Delay_Us() and Delay_Ms() count with HCLK/8)
+
+//Note: Delay_Us()/Delay_Ms() reload the SysTick counter, so don't call them between Bench_Start() and Bench_Stop()!
+
+void Bench_Start(void); //Start a free-running up-counter at HCLK -> 1 tick = 1 CPU cycle
+uint32_t Bench_Stop(void); //Return the elapsed cycles and give SysTick back to the delay functions
+
+static inline uint32_t Bench_Now(void) //Current cycle count since Bench_Start()
+{
+    return SysTick->CNT;
+}
+
+//Latency histogram: bin 0 counts ops shorter than 2^BENCH_HIST_SHIFT cycles, every next bin is twice as wide,
+//the last bin collects everything above (16 bins: <1024 cycles = 21 us ... >=2^24 cycles = 350 ms at 48 MHz)
+#define BENCH_HIST_BINS     16
+#define BENCH_HIST_SHIFT    10
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint16_t bins[BENCH_HIST_BINS];
+} Bench_Histogram;
+
+//Print one result line: "label,ops,bytes,cycles,cycles/op,KB/s"
+void Bench_PrintResult(const char *label, uint32_t ops, uint32_t bytes, uint32_t cycles);
+
+void Bench_HistReset(Bench_Histogram *hist);
+void Bench_HistAdd(Bench_Histogram *hist, uint32_t cycles);
+void Bench_PrintHistHeader(void); //"hist,label,count,min,mean,max," + the upper edge of every bin
+void Bench_PrintHist(const char *label, const Bench_Histogram *hist); //"hist,label,count,min,mean,max,bin0,...,bin15"
+
+#endif //BENCH_H
@@ -12,9 +12,221 @@
 #include "sd.h"			/* SD card communication */
 #include "spi.h"		/* SPI configuration */
 
+#include <string.h>		/* memcpy() for the sector cache */
+
 /* Definitions of physical drive number for each drive */
 #define DEV_MMC		0 // Example: Map MMC/SD card to physical drive 0
 
+/*-----------------------------------------------------------------------*/
+/* Write-back sector cache and read-ahead                                */
+/*-----------------------------------------------------------------------*/
+
+static DISK_CACHE_STATS cacheStats; //Hit/miss/write counters (also counted with the cache disabled)
+
+#if DISKIO_CACHE_SECTORS > 0
+typedef struct
+{
+	LBA_t sector;	//Cached sector
+	DWORD stamp;	//Last access time for the LRU eviction, 0 = empty slot
+	BYTE dirty;		//1 - newer than the card, must be written back
+	BYTE data[512];
+} CACHE_SLOT;
+
+static CACHE_SLOT cacheSlots[DISKIO_CACHE_SECTORS];
+static DWORD cacheClock = 0; //Incremented on every access, it orders the slots by age
+#endif
+
+#if DISKIO_READAHEAD_SECTORS > 0
+static BYTE readaheadBuf[DISKIO_READAHEAD_SECTORS][512]; //Sectors fetched ahead of the reader
+static LBA_t readaheadStart = 0; //First sector in readaheadBuf
+static UINT readaheadCount = 0; //Valid sectors in readaheadBuf, 0 = empty
+static LBA_t readaheadLast = 0; //Last single sector that was requested, for the sequential detection
+static BYTE readaheadEnabled = 1;
+
+void disk_readahead_enable (BYTE enable)
+{
+	readaheadEnabled = enable;
+	readaheadCount = 0;
+}
+#else
+void disk_readahead_enable (BYTE enable)
+{
+	(void)enable; //Not compiled in
+}
+#endif
+
+static uint8_t card_write(const BYTE *buff, LBA_t sector, UINT count) //Every sector that reaches the card goes through here
+{
+	uint8_t result = SD_WriteDisk((u8*)buff, sector, count);
+
+	if(!result)
+	{
+		cacheStats.sectorsWritten += count;
+	}
+
+#if DISKIO_READAHEAD_SECTORS > 0
+	if(readaheadCount && sector < readaheadStart + readaheadCount && sector + count > readaheadStart)
+	{
+		readaheadCount = 0; //The prefetched copies are stale now
+	}
+#endif
+	return result;
+}
+
+static uint8_t card_read(BYTE *buff, LBA_t sector, UINT count) //Every sector that is read from the card goes through here
+{
+	uint8_t result;
+
+#if DISKIO_READAHEAD_SECTORS > 0
+	if(readaheadEnabled && count == 1)
+	{
+		if(readaheadCount && sector >= readaheadStart && sector < readaheadStart + readaheadCount)
+		{
+			cacheStats.prefetchHits++; //Already fetched by the previous CMD18
+			memcpy(buff, readaheadBuf[sector - readaheadStart], 512);
+			readaheadLast = sector;
+			return 0;
+		}
+
+		if(sector == readaheadLast + 1) //Second sequential sector: fetch the next run with one CMD18
+		{
+			readaheadLast = sector;
+			readaheadCount = 0;
+
+			if(SD_ReadDisk(readaheadBuf[0], sector, DISKIO_READAHEAD_SECTORS) == 0)
+			{
+				cacheStats.sectorsRead += DISKIO_READAHEAD_SECTORS;
+				readaheadStart = sector;
+				readaheadCount = DISKIO_READAHEAD_SECTORS;
+				memcpy(buff, readaheadBuf[0], 512);
+				return 0;
+			}
+			//Failed (e.g. the run goes past the end of the card): fall back to the single sector
+		}
+		readaheadLast = sector;
+	}
+#endif
+
+	result = SD_ReadDisk(buff, sector, count);
+	if(!result)
+	{
+		cacheStats.sectorsRead += count;
+	}
+	return result;
+}
+
+#if DISKIO_CACHE_SECTORS > 0
+static CACHE_SLOT* cache_find(LBA_t sector)
+{
+	for(UINT i = 0; i < DISKIO_CACHE_SECTORS; i++)
+	{
+		if(cacheSlots[i].stamp && cacheSlots[i].sector == sector)
+		{
+			return &cacheSlots[i];
+		}
+	}
+	return 0;
+}
+
+static CACHE_SLOT* cache_alloc(LBA_t sector, uint8_t *result) //Take an empty or the least recently used slot
+{
+	CACHE_SLOT *slot = &cacheSlots[0];
+
+	for(UINT i = 0; i < DISKIO_CACHE_SECTORS; i++)
+	{
+		if(cacheSlots[i].stamp < slot->stamp)
+		{
+			slot = &cacheSlots[i]; //Empty slots have stamp 0, so they always win
+		}
+	}
+
+	*result = 0;
+	if(slot->stamp && slot->dirty)
+	{
+		*result = card_write(slot->data, slot->sector, 1); //Evicting a dirty sector: write it back first
+		if(*result)
+		{
+			return 0;
+		}
+	}
+
+	slot->sector = sector;
+	slot->dirty = 0;
+	slot->stamp = ++cacheClock;
+	return slot;
+}
+#endif
+
+BYTE disk_cache_flush (void)
+{
+#if DISKIO_CACHE_SECTORS > 0
+	CACHE_SLOT *slot;
+	uint8_t result;
+
+	while(1)
+	{
+		slot = 0;
+		for(UINT i = 0; i < DISKIO_CACHE_SECTORS; i++) //Write back in ascending LBA order, so neighbours can share a CMD25
+		{
+			if(cacheSlots[i].stamp && cacheSlots[i].dirty && (!slot || cacheSlots[i].sector < slot->sector))
+			{
+				slot = &cacheSlots[i];
+			}
+		}
+
+		if(!slot)
+		{
+			return 0; //Everything is on the card
+		}
+
+		result = card_write(slot->data, slot->sector, 1);
+		if(result)
+		{
+			return result;
+		}
+		slot->dirty = 0;
+	}
+#else
+	return 0;
+#endif
+}
+
+static void cache_discard(LBA_t start, LBA_t end) //Forget the cached copies of erased sectors (dirty ones too)
+{
+#if DISKIO_CACHE_SECTORS > 0
+	for(UINT i = 0; i < DISKIO_CACHE_SECTORS; i++)
+	{
+		if(cacheSlots[i].stamp && cacheSlots[i].sector >= start && cacheSlots[i].sector <= end)
+		{
+			cacheSlots[i].stamp = 0;
+			cacheSlots[i].dirty = 0;
+		}
+	}
+#endif
+#if DISKIO_READAHEAD_SECTORS > 0
+	if(readaheadCount && start < readaheadStart + readaheadCount && end >= readaheadStart)
+	{
+		readaheadCount = 0;
+	}
+#endif
+	(void)start;
+	(void)end;
+}
+
+void disk_cache_stats (DISK_CACHE_STATS *stats)
+{
+	*stats = cacheStats;
+}
+
+void disk_cache_reset_stats (void)
+{
+	cacheStats.hits = 0;
+	cacheStats.misses = 0;
+	cacheStats.sectorsWritten = 0;
+	cacheStats.sectorsRead = 0;
+	cacheStats.prefetchHits = 0;
+}
+
 /*-----------------------------------------------------------------------*/
 /* Get Drive Status                                                      */
 /*-----------------------------------------------------------------------*/
@@ -31,11 +243,29 @@ DSTATUS disk_status (
 /* Initialize a Drive                                                    */
 /*-----------------------------------------------------------------------*/
 
+static BYTE cardReady = 0; //1 - the next disk_initialize() only checks the card
+
+void disk_mark_ready (void)
+{
+	cardReady = 1;
+}
+
 DSTATUS disk_initialize (
 	BYTE pdrv				/* Physical drive nmuber to identify the drive */
 )
 {	
 	uint8_t result = 1;
+
+	cache_discard(0, (LBA_t)-1); //After a reset or a card change the cached copies (dirty ones too) belong to nobody
+
+	if(cardReady)
+	{
+		cardReady = 0;
+		if(SD_CheckStatus() == 0)
+		{
+			return 0; //Initialized before the mount (SD_Boot_Init()), CMD13 shows it still answers at the data clock
+		}
+	}
 	
 	result = SD_Initialize(); //SD_Initialize()
 
@@ -50,6 +280,7 @@ DSTATUS disk_initialize (
     }
     else
     {
+    	SD_HighSpeed(); //SD_Initialize() leaves SPI1 at the init clock, go back to the (tuned) data clock
     	return 0; //Successful initialization
     } 
 }
@@ -67,12 +298,53 @@ DRESULT disk_read (
 {	
 	uint8_t result = 1;
 
-	result = SD_ReadDisk(buff,sector,count);
+#if DISKIO_CACHE_SECTORS > 0
+	CACHE_SLOT *slot;
+
+	if(count == 1 && (slot = cache_find(sector)) != 0) //Single sector reads (FatFs window) are served from the cache
+	{
+		cacheStats.hits++;
+		slot->stamp = ++cacheClock;
+		memcpy(buff, slot->data, 512);
+		return RES_OK;
+	}
+#endif
+
+	result = card_read(buff,sector,count);
 
 	if(result)
 	{
 		SPI_TransferByte(0xff);
 	}
+#if DISKIO_CACHE_SECTORS > 0
+	else
+	{
+		for(UINT i = 0; i < count; i++) //The card may be older than the cache: overlay the cached copies
+		{
+			slot = cache_find(sector + i);
+			if(slot)
+			{
+				cacheStats.hits++;
+				memcpy(buff + i * 512, slot->data, 512);
+			}
+			else
+			{
+				cacheStats.misses++;
+			}
+		}
+
+		if(count == 1 && !cache_find(sector)) //Keep single sectors (FAT, directory) for the next read-modify-write
+		{
+			uint8_t evictResult; //A failed write-back only costs the caching, the read itself succeeded
+
+			slot = cache_alloc(sector, &evictResult);
+			if(slot)
+			{
+				memcpy(slot->data, buff, 512);
+			}
+		}
+	}
+#endif
 
 	if(!result)
     {
@@ -98,7 +370,46 @@ DRESULT disk_write (
 {
 	uint8_t result = 0;
 
-	result = SD_WriteDisk((u8*)buff,sector,count);
+#if DISKIO_CACHE_SECTORS > 0
+	CACHE_SLOT *slot;
+
+	if(count == 1) //Single sector: write-back, the card is updated on eviction or flush
+	{
+		slot = cache_find(sector);
+		if(slot)
+		{
+			cacheStats.hits++;
+			slot->stamp = ++cacheClock;
+		}
+		else
+		{
+			cacheStats.misses++;
+			slot = cache_alloc(sector, &result);
+		}
+
+		if(slot)
+		{
+			memcpy(slot->data, buff, 512);
+			slot->dirty = 1;
+		}
+	}
+	else //Multi-sector writes bypass the cache, but the cached copies must follow the new data
+	{
+		result = card_write(buff, sector, count);
+
+		for(UINT i = 0; i < count && !result; i++)
+		{
+			slot = cache_find(sector + i);
+			if(slot)
+			{
+				memcpy(slot->data, buff + i * 512, 512);
+				slot->dirty = 0;
+			}
+		}
+	}
+#else
+	result = card_write(buff,sector,count);
+#endif
 
 	if(!result)
     {
@@ -127,23 +438,38 @@ DRESULT disk_ioctl (
     switch(cmd)
     {
         case CTRL_SYNC:
-            SD_ChipSelect_Low;
-            if(SD_WaitReady()==0)res = RES_OK;
+            if(disk_cache_flush()) //Write back the dirty sectors (f_sync() and f_close() end up here)
+            {
+                res = RES_ERROR;
+                break;
+            }
+#if SD_USE_WRITE_SESSION
+            SD_WriteSessionClose(); //Finish the streaming write, FatFs expects everything on the card now
+#endif
+#if SD_USE_READ_SESSION
+            SD_ReadSessionClose(); //Release the card, the next read opens a new stream anyway
+#endif
+            if(SD_Select()==0)res = RES_OK; //Through the bus arbiter: SD_Select() waits until the card is ready
             else res = RES_ERROR;
-            SD_ChipSelect_High;
+            SD_Deselect();
             break;
         case GET_SECTOR_SIZE:
             *(WORD*)buff = 512;
             res = RES_OK;
             break;
-        case GET_BLOCK_SIZE:
-            *(WORD*)buff = 8;
+        case GET_BLOCK_SIZE: //Erase block in sectors (DWORD): the allocation unit read by SD_Initialize(), 1 if unknown
+            *(DWORD*)buff = SD_Info.auSectors ? SD_Info.auSectors : 1;
             res = RES_OK;
             break;
         case GET_SECTOR_COUNT:
             *(DWORD*)buff = SD_GetSectorCount();
             res = RES_OK;
             break;
+        case CTRL_TRIM: //buff: LBA_t[2], first and last sector (FatFs sends it for freed clusters with FF_USE_TRIM)
+            cache_discard(((LBA_t*)buff)[0], ((LBA_t*)buff)[1]);
+            if(SD_Erase(((LBA_t*)buff)[0], ((LBA_t*)buff)[1]))res = RES_ERROR;
+            else res = RES_OK;
+            break;
         default:
             res = RES_PARERR;
             break;
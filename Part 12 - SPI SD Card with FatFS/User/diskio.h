@@ -70,6 +70,33 @@ DRESULT disk_ioctl (BYTE pdrv, BYTE cmd, void* buff);
 #define ATA_GET_MODEL		21	/* Get model name */
 #define ATA_GET_SN			22	/* Get serial number */
 
+/*---------------------------------------*/
+/* SD card glue: sector cache, read-ahead */
+
+#ifndef DISKIO_CACHE_SECTORS
+#define DISKIO_CACHE_SECTORS	0	/* Number of 512-byte cache slots (0: no cache). Each slot costs 520 bytes of RAM, */
+									/* the CH32V003 (2 kB) has no room for it next to FatFs, use it on bigger chips */
+#endif
+
+#ifndef DISKIO_READAHEAD_SECTORS
+#define DISKIO_READAHEAD_SECTORS	0	/* Sectors fetched ahead with one CMD18 when single-sector reads run sequentially */
+											/* (0: off). Costs K * 512 bytes of RAM, tune K to what is left next to FatFs */
+#endif
+
+typedef struct {
+	DWORD hits;				/* Sectors served from / merged into the cache */
+	DWORD misses;			/* Sectors that were not in the cache */
+	DWORD sectorsWritten;	/* Sectors actually written to the card */
+	DWORD sectorsRead;		/* Sectors actually read from the card (including the read-ahead) */
+	DWORD prefetchHits;		/* Single-sector reads served from the read-ahead buffer */
+} DISK_CACHE_STATS;
+
+BYTE disk_cache_flush (void);		/* Write all dirty sectors to the card (also done by CTRL_SYNC), 0: OK */
+void disk_cache_stats (DISK_CACHE_STATS *stats);
+void disk_cache_reset_stats (void);
+void disk_readahead_enable (BYTE enable);	/* Turn the read-ahead on/off at run time (it is flushed either way) */
+void disk_mark_ready (void);			/* The card is initialized already: the next disk_initialize() only sends CMD13 */
+
 #ifdef __cplusplus
 }
 #endif
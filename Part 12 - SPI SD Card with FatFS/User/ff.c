@@ -59,6 +59,9 @@
 #define FA_SEEKEND	0x20	/* Seek to end of the file on file open */
 #define FA_MODIFIED	0x40	/* File has been modified */
 #define FA_DIRTY	0x80	/* FIL.buf[] needs to be written-back */
+#if defined(FF_FA_MODIFIED) && FF_FA_MODIFIED != FA_MODIFIED
+#error Wrong FF_FA_MODIFIED in ffconf.h
+#endif
 
 
 /* Additional file attribute bits for internal use */
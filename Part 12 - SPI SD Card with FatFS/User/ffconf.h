@@ -38,9 +38,13 @@
 /* This option switches fast seek feature. (0:Disable or 1:Enable) */
 
 
-#define FF_USE_EXPAND	0
+#define FF_USE_EXPAND	1
 /* This option switches f_expand(). (0:Disable or 1:Enable) */
 
+#define FF_FA_MODIFIED	0x40
+/* FA_MODIFIED of ff.c (internal "file has been modified" flag). SD_RawLog_SetDirSize()
+/  sets it so that f_sync() writes the new size; ff.c stops the build if it differs. */
+
 
 #define FF_USE_CHMOD	0
 /* This option switches attribute control API functions, f_chmod() and f_utime().
@@ -213,7 +217,7 @@
 /  f_fdisk(). 2^32 sectors maximum. This option has no effect when FF_LBA64 == 0. */
 
 
-#define FF_USE_TRIM		0
+#define FF_USE_TRIM		1
 /* This option switches support for ATA-TRIM. (0:Disable or 1:Enable)
 /  To enable this feature, also CTRL_TRIM command should be implemented to
 /  the disk_ioctl(). */
@@ -1,21 +1,165 @@
 #include "sd.h"
 #include "spi.h"
 #include "ch32v00x_gpio.h"
+#include "bench.h"
+#include "debug.h"
 
 uint8_t  SD_Type = 0; //SD card type
+SD_CardInfo SD_Info; //Card geometry of the last SD_Initialize()
+uint8_t  SD_SpiPrescaler = SPI_BaudRatePrescaler_4; //Data transfer clock used by SD_HighSpeed()
+uint8_t  SD_InitPrescaler = SD_INIT_PRESCALER_AUTO; //Init clock used by SD_LowSpeed()
+SPI_BusDevice SD_BusDevice;
+volatile uint8_t SD_CardBusy = 0; //1 - a block was accepted, but the card may still be programming it
+#if SD_USE_DMA
+uint8_t  SD_TransferMode = SD_XFER_DMA; //Data blocks are moved by the DMA
+#else
+uint8_t  SD_TransferMode = SD_XFER_POLLING; //Data blocks are moved byte by byte
+#endif
 GPIO_TypeDef* SD_CD_PORT;
 uint16_t      SD_CD_PIN;
 
+#if SD_USE_WRITE_SESSION
+uint8_t  SD_WriteSessionEnabled = 1; //Sequential writes are streamed into one CMD25
+static uint8_t  sdWriteSessionOpen = 0; //1 - a CMD25 is open and the card is selected
+static uint32_t sdWriteSessionNext = 0; //LBA that continues the open session
+static uint32_t sdWriteSessionIdleMs = 0; //Time since the last block was appended
+#endif
+
+#if SD_USE_READ_SESSION
+uint8_t  SD_ReadSessionEnabled = 1; //Sequential reads are streamed from one CMD18
+static uint8_t  sdReadSessionOpen = 0; //1 - a CMD18 is open and the card is selected
+static uint32_t sdReadSessionNext = 0; //LBA that continues the open stream
+#endif
+
+//Prescaler of the init clock: SD_InitPrescaler, or the fastest clock that is still legal in the idle state
+//(48 MHz / 128 = 375 kHz)
+static uint8_t SD_LowSpeedPrescaler(void)
+{
+    uint8_t br = 0;
+
+    if(SD_InitPrescaler != SD_INIT_PRESCALER_AUTO)
+    {
+        return SD_InitPrescaler;
+    }
+
+    while(br < 7 && (SystemCoreClock >> (br + 1)) > SD_INIT_CLOCK_HZ) //f_PCLK / 2^(BR+1)
+    {
+        br++;
+    }
+    return br << 3; //BR[2:0] of SPI_BaudRatePrescaler_x
+}
+
 //Low speed to initialize SD card
 void SD_LowSpeed(void)
 {
-    SPI1_SetSpeed(SPI_BaudRatePrescaler_256);
+    SPI_Bus_SetSpeed(&SD_BusDevice, SD_LowSpeedPrescaler());
 }
 
 //High speed to run SD card
 void SD_HighSpeed(void)
 {
-    SPI1_SetSpeed(SPI_BaudRatePrescaler_4);    
+    SPI_Bus_SetSpeed(&SD_BusDevice, SD_SpiPrescaler); //SPI_BaudRatePrescaler_4 unless SD_TuneSpeed() found something better
+}
+
+//CRC-16/CCITT of a block, used to compare reads at different clocks without a second 512-byte buffer
+static uint16_t SD_Crc16(const uint8_t *data, uint16_t length)
+{
+    uint16_t crc = 0;
+
+    for(uint16_t i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for(uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+//Read CSD, CID and the test sector, return their CRC (0xFFFF if any of the reads failed)
+static uint16_t SD_SpeedProbe(uint8_t *buffer, uint32_t testSector)
+{
+    uint16_t crc;
+
+    if(SD_GetCSD(buffer) || SD_GetCID(buffer + 16))
+    {
+        return 0xFFFF;
+    }
+    crc = SD_Crc16(buffer, 32);
+
+    if(SD_ReadDisk(buffer, testSector, 1))
+    {
+        return 0xFFFF;
+    }
+    return crc ^ SD_Crc16(buffer, 512);
+}
+
+//Try the prescalers from the fastest one, keep the first that reads the same CSD, CID and test sector as the init clock.
+//The test sector and the next SD_TUNE_READS-1 sectors are read to measure the throughput of every step.
+uint8_t SD_TuneSpeed(uint8_t *buffer, uint32_t testSector, SD_SpeedResult *results, uint8_t *steps)
+{
+    static const uint8_t prescalers[] =
+    {
+        SPI_BaudRatePrescaler_2, SPI_BaudRatePrescaler_4, SPI_BaudRatePrescaler_8, SPI_BaudRatePrescaler_16,
+        SPI_BaudRatePrescaler_32, SPI_BaudRatePrescaler_64, SPI_BaudRatePrescaler_128
+    };
+    uint16_t reference;
+    uint32_t cycles;
+    uint8_t  error;
+    uint8_t  n = 0;
+
+    *steps = 0;
+
+    SD_LowSpeed(); //Reference at the init clock
+    reference = SD_SpeedProbe(buffer, testSector);
+    if(reference == 0xFFFF)
+    {
+        return 1; //The card doesn't even work slowly
+    }
+
+    for(uint8_t i = 0; i < sizeof(prescalers); i++)
+    {
+        SPI_Bus_SetSpeed(&SD_BusDevice, prescalers[i]);
+
+        results[n].prescaler = prescalers[i];
+        results[n].clockHz = SystemCoreClock >> ((prescalers[i] >> 3) + 1); //f_PCLK / 2^(BR+1)
+        results[n].passed = (SD_SpeedProbe(buffer, testSector) == reference);
+        results[n].kbps = 0;
+
+        if(results[n].passed)
+        {
+            error = 0;
+            Bench_Start();
+            for(uint8_t r = 0; r < SD_TUNE_READS; r++)
+            {
+                error |= SD_ReadDisk(buffer, testSector + r, 1);
+            }
+            cycles = Bench_Stop();
+
+            if(error || cycles == 0)
+            {
+                results[n].passed = 0;
+            }
+            else
+            {
+                results[n].kbps = (uint32_t)(((uint64_t)SD_TUNE_READS * 512 * SystemCoreClock) / ((uint64_t)cycles * 1024));
+            }
+        }
+
+        n++;
+        *steps = n;
+
+        if(results[n - 1].passed)
+        {
+            SD_SpiPrescaler = prescalers[i]; //Fastest working clock, SD_HighSpeed() uses it from now on
+            return 0;
+        }
+    }
+
+    SD_SpiPrescaler = SD_LowSpeedPrescaler(); //Nothing faster works, stay at the init clock that just passed
+    SD_LowSpeed();
+    return 0;
 }
 
 //SD card insertion detection - User can select the CD pin - Not be mistaken with chip select!
@@ -54,7 +198,20 @@ void SD_SetChipDetect(GPIO_TypeDef* port, uint16_t pin) //Call before SD_Detect(
 void SD_SPI_Init(void)
 {
     SPI1_Init();
-    SD_ChipSelect_High;
+#if SD_USE_DMA
+    SPI1_DMA_Init();
+#endif
+    SPI_Bus_Register(&SD_BusDevice, GPIOC, GPIO_Pin_4, SPI_CPOL_Low | SPI_CPHA_1Edge | SPI_FirstBit_MSB, SPI_BaudRatePrescaler_256);
+}
+
+//Select how the data blocks are transferred (the commands are always polled, they are only a few bytes)
+void SD_SetTransferMode(uint8_t mode)
+{
+#if SD_USE_DMA
+    SD_TransferMode = mode;
+#else
+    SD_TransferMode = SD_XFER_POLLING; //DMA is not compiled in
+#endif
 }
 
 //Unselect SD and release SPI bus
@@ -62,11 +219,16 @@ void SD_Deselect(void)
 {
     SD_ChipSelect_High;
     SPI_TransferByte(0xff);
+    SPI_Bus_Release(&SD_BusDevice); //Deferred work of other devices runs here
 }
 
 //Select SD card
 uint8_t SD_Select(void)
 {
+    if(SPI_Bus_Acquire(&SD_BusDevice))
+    {
+        return 1; //Another device holds the bus (only possible from its deferred work)
+    }
     SD_ChipSelect_Low;
     
     if(SD_WaitReady() == 0)
@@ -87,6 +249,7 @@ uint8_t SD_WaitReady(void)
         //While the card does not return 0xFF, we keep running the loop. Once the card is not busy, it returns 0xFF and the if() is performed
         if(SPI_TransferByte(0xff) == 0xff)
         {
+            SD_CardBusy = 0; //A deferred write (if any) is finished
             return 0; //jump out when the 0xff is received
         }
         t++;
@@ -124,10 +287,23 @@ uint8_t SD_ReceiveData(uint8_t *buffer, uint16_t length)
         return 1;    //wait for data token 0xFE
     } 
 
-    //Polling version йдйд
-    for (u16 i = 0; i < length; i++) 
+#if SD_USE_DMA
+    if(SD_TransferMode == SD_XFER_DMA)
     {
-        buffer[i] = SPI_TransferByte(0xFF);
+        //DMA version: TX keeps clocking 0xFF, RX drains the data register into the buffer
+        if(SPI1_DMA_Transfer(0, buffer, length))
+        {
+            return 1; //DMA timeout
+        }
+    }
+    else
+#endif
+    {
+        //Polling version
+        for (u16 i = 0; i < length; i++) 
+        {
+            buffer[i] = SPI_TransferByte(0xFF);
+        }
     }
 
     //discard CRC
@@ -147,10 +323,35 @@ uint8_t SD_SendBlock(uint8_t *buffer, uint8_t command)
 
     SPI_TransferByte(command);           //send data token
 
-    //Polling version
-    for (u16 i = 0; i < 512; i++) 
+    if(command == 0xFD)
+    {
+        //Stop Tran token of CMD25: no data block and no data response follows, the card just goes busy
+        SPI_TransferByte(0xFF);
+#if SD_USE_DEFERRED_BUSY
+        SD_CardBusy = 1; //The next command (or SD_PollBusy()) waits for the card
+#else
+        while (SPI_TransferByte(0xFF) == 0);
+#endif
+        return 0;
+    }
+
+#if SD_USE_DMA
+    if(SD_TransferMode == SD_XFER_DMA)
+    {
+        //DMA version: TX feeds the block, RX is discarded
+        if(SPI1_DMA_Transfer(buffer, 0, 512))
+        {
+            return 1; //DMA timeout
+        }
+    }
+    else
+#endif
     {
-        SPI_TransferByte(buffer[i]);
+        //Polling version
+        for (u16 i = 0; i < 512; i++) 
+        {
+            SPI_TransferByte(buffer[i]);
+        }
     }
 
     //dummy CRC
@@ -164,15 +365,59 @@ uint8_t SD_SendBlock(uint8_t *buffer, uint8_t command)
         return 2;   //data accepted token is 0x05
     }
 
+#if SD_USE_DEFERRED_BUSY
+    //Don't wait for the programming here: SD_Select()/SD_SendBlock() check the card before the next transfer
+    SD_CardBusy = 1;
+#else
     //wait until write complete (bus idle = 0xFF)
     while (SPI_TransferByte(0xFF) == 0);
+#endif
     return 0;   //success
 }
 
+//Check a deferred write without blocking: 1 - the card is still programming, 0 - ready
+uint8_t SD_PollBusy(void)
+{
+    uint8_t selected;
+
+    if(!SD_CardBusy)
+    {
+        return 0;
+    }
+
+    selected = (GPIO_ReadOutputDataBit(GPIOC, GPIO_Pin_4) == Bit_RESET); //Selected inside an open write session
+    if(!selected)
+    {
+        if(SPI_Bus_Acquire(&SD_BusDevice))
+        {
+            return SD_CardBusy; //Ask again later
+        }
+        SD_ChipSelect_Low;
+    }
+
+    if(SPI_TransferByte(0xFF) == 0xFF) //The card holds DO low while it is busy
+    {
+        SD_CardBusy = 0;
+    }
+
+    if(!selected)
+    {
+        SD_Deselect(); //Release DO and the bus
+    }
+
+    return SD_CardBusy;
+}
+
 uint8_t SD_SendCommand(uint8_t command, uint32_t argument, uint8_t crc)
 {
     uint8_t r1;
     uint8_t retry=0;
+#if SD_USE_WRITE_SESSION
+    SD_WriteSessionClose(); //Any other command ends the streaming write
+#endif
+#if SD_USE_READ_SESSION
+    SD_ReadSessionClose(); //Any other command (including writes) ends the streaming read
+#endif
     SD_Deselect();
 
     if(SD_Select())
@@ -236,17 +481,12 @@ uint8_t SD_GetCSD(uint8_t *csd_data)
 }
 
 
-uint32_t SD_GetSectorCount(void)
+static uint32_t SD_CsdSectors(const uint8_t *csd)
 {
-    uint8_t csd[16];
     uint64_t Capacity;
     uint8_t n;
     uint16_t csize;
 
-    if(SD_GetCSD(csd)!=0) 
-    {
-        return 0;
-    }
     if((csd[0]&0xC0)==0x40)  //SDHC card
     {
         csize = csd[9] + ((uint16_t)csd[8] << 8) + 1;
@@ -261,15 +501,142 @@ uint32_t SD_GetSectorCount(void)
     return Capacity;
 }
 
+uint32_t SD_GetSectorCount(void)
+{
+    uint8_t csd[16];
 
-uint8_t SD_Initialize(void)
+    if(SD_Info.sectors)
+    {
+        return SD_Info.sectors; //Read by SD_Initialize(), the CSD doesn't change
+    }
+    if(SD_GetCSD(csd)!=0) 
+    {
+        return 0;
+    }
+    return SD_CsdSectors(csd);
+}
+
+//Get SD card's SD status (ACMD13): R2 response, then a 64-byte data block
+uint8_t SD_GetSDStatus(uint8_t *status)
+{
+    uint8_t r1;
+    SD_SendCommand(CMD55,0,0X01);
+    r1=SD_SendCommand(CMD13,0,0X01);
+    if(r1==0)
+    {
+        SPI_TransferByte(0xFF); //Second byte of R2
+        r1=SD_ReceiveData(status, 64);
+    }
+    SD_Deselect();
+    if(r1)return 1;
+    else return 0;
+}
+
+uint8_t SD_ReadCardInfo(void)
+{
+    static const uint8_t auLarge[6] = {2, 3, 4, 6, 8, 16}; //AU_SIZE 0xA...0xF: 8, 12, 16, 24, 32, 64 MB in 4 MB steps
+    uint8_t data[64];
+    uint8_t au;
+
+    SD_Info.sectors = 0;
+    SD_Info.auSectors = 1;
+    SD_Info.eraseBlockEn = 0;
+
+    if(SD_GetCSD(data))
+    {
+        return 1;
+    }
+    SD_Info.sectors = SD_CsdSectors(data);
+    if(SD_Type == SD_TYPE_MMC)
+    {
+        return 0; //No SD status, MMC erase groups are described differently
+    }
+    SD_Info.eraseBlockEn = (data[10] >> 6) & 1; //ERASE_BLK_EN (always 1 in CSD v2)
+    SD_Info.auSectors = (((data[10] & 0x3F) << 1) | (data[11] >> 7)) + 1; //SECTOR_SIZE: erase sector in write blocks
+
+    if(SD_GetSDStatus(data) == 0)
+    {
+        au = data[10] >> 4; //AU_SIZE, 0: not defined
+        if(au >= 1 && au <= 9)
+        {
+            SD_Info.auSectors = 32UL << (au - 1); //16 kB...4 MB
+        }
+        else if(au > 9)
+        {
+            SD_Info.auSectors = (uint32_t)auLarge[au - 10] << 13;
+        }
+    }
+    return 0;
+}
+
+//Erase a range of sectors: written blocks are erased in the background, later writes to them don't wait for an erase.
+//Erased sectors read back as all 0x00 or all 0xFF (DATA_STAT_AFTER_ERASE in the SCR).
+uint8_t SD_Erase(uint32_t start, uint32_t end)
+{
+    uint32_t last;
+    uint8_t r1 = 0;
+
+    if(SD_Type == SD_TYPE_MMC || SD_Type == SD_TYPE_ERR || end < start)
+    {
+        return 1; //MMC erases with CMD35/36
+    }
+    if(!SD_Info.eraseBlockEn)
+    {
+        return 1; //Whole erase sectors only, that could hit data outside the range
+    }
+
+    while(r1 == 0)
+    {
+        last = (end - start >= SD_ERASE_CHUNK) ? start + SD_ERASE_CHUNK - 1 : end;
+
+        r1 = SD_SendCommand(CMD32, (SD_Type != SD_TYPE_V2HC) ? (start << 9) : start, 0X01);
+        if(r1 == 0)
+        {
+            r1 = SD_SendCommand(CMD33, (SD_Type != SD_TYPE_V2HC) ? (last << 9) : last, 0X01);
+        }
+        if(r1 == 0)
+        {
+            r1 = SD_SendCommand(CMD38, 0, 0X01);
+            if(r1 == 0 && SD_WaitReady())
+            {
+                r1 = 0xFF; //R1b: DO stays low until the erase is done
+            }
+        }
+        SD_Deselect();
+
+        if(last == end)
+        {
+            break;
+        }
+        start = last + 1;
+    }
+    return r1;
+}
+
+
+//One ACMD41/CMD1 poll: wait SD_INIT_POLL_US, 0 after SD_INIT_TIMEOUT_MS.
+//The timeout is the same at every init clock, a retry count would shrink with a faster clock.
+static uint8_t SD_InitWait(uint16_t *polls)
+{
+    if(++(*polls) > (uint32_t)SD_INIT_TIMEOUT_MS * 1000 / SD_INIT_POLL_US)
+    {
+        return 0;
+    }
+    Delay_Us(SD_INIT_POLL_US);
+    return 1;
+}
+
+uint8_t SD_InitializeCard(void)
 {
     uint8_t r1;     
     uint16_t retry = 20;  
+    uint16_t polls = 0;
     uint8_t buf[4];
     uint16_t i;
 
     SD_SPI_Init();    
+    SD_LowSpeed();
+    SPI_Bus_Acquire(&SD_BusDevice); //The 74+ clocks with CS high need the SD mode too
 
     for(i = 0; i < 10; i++)
     {
@@ -282,6 +649,7 @@ uint8_t SD_Initialize(void)
     }while((r1!=0X01) && retry--);
 
     SD_Type=0;
+    SD_Info.sectors=0; //Forget the geometry of the previous card
     
     if(r1==0X01)
     {
@@ -293,14 +661,13 @@ uint8_t SD_Initialize(void)
             }
             if(buf[2]==0X01&&buf[3]==0XAA)
             {
-                retry=0XFFFE;
                 do
                 {
                     SD_SendCommand(CMD55,0,0X01);   
                     r1=SD_SendCommand(CMD41,0x40000000,0X01);
-                }while(r1&&retry--);
+                }while(r1&&SD_InitWait(&polls));
 
-                if(retry&&SD_SendCommand(CMD58,0,0X01) == 0)
+                if(r1==0&&SD_SendCommand(CMD58,0,0X01) == 0)
                 {
                     for(i=0;i<4;i++)
                     {
@@ -324,22 +691,20 @@ uint8_t SD_Initialize(void)
             if(r1<=1)
             {
                 SD_Type=SD_TYPE_V1;
-                retry=0XFFFE;
                 do 
                 {
                     SD_SendCommand(CMD55,0,0X01);  
                     r1=SD_SendCommand(CMD41,0,0X01);
-                }while(r1&&retry--);
+                }while(r1&&SD_InitWait(&polls));
             }else
             {
                 SD_Type=SD_TYPE_MMC;
-                retry=0XFFFE;
                 do 
                 {
                     r1=SD_SendCommand(CMD1,0,0X01);
-                }while(r1&&retry--);
+                }while(r1&&SD_InitWait(&polls));
             }
-            if(retry==0||SD_SendCommand(CMD16,512,0X01)!=0)
+            if(r1||SD_SendCommand(CMD16,512,0X01)!=0)
             {
                 SD_Type=SD_TYPE_ERR;
             }
@@ -361,9 +726,41 @@ uint8_t SD_Initialize(void)
     }
 }
 
+uint8_t SD_Initialize(void)
+{
+    uint8_t result = SD_InitializeCard();
+
+    if(result == 0)
+    {
+        SD_ReadCardInfo(); //Capacity and erase geometry, read once
+    }
+    return result;
+}
+
+//SEND_STATUS: R2 = R1 + a second status byte (card locked, write protect violation, ECC, CC and internal errors...)
+uint8_t SD_CheckStatus(void)
+{
+    uint8_t r1;
+    uint8_t r2 = 0xFF;
+
+    r1=SD_SendCommand(CMD13,0,0X01);
+    if(r1==0)
+    {
+        r2=SPI_TransferByte(0xFF);
+    }
+    SD_Deselect();
+    return (r1||r2) ? 1 : 0;
+}
+
 uint8_t SD_ReadDisk(uint8_t*buffer,uint32_t sector,uint8_t count)
 {
     uint8_t r1;
+#if SD_USE_READ_SESSION
+    if(SD_ReadSessionEnabled)
+    {
+        return SD_ReadSessionFetch(buffer, sector, count);
+    }
+#endif
     if(SD_Type!=SD_TYPE_V2HC)sector <<= 9;
 
     if(count==1)
@@ -387,9 +784,102 @@ uint8_t SD_ReadDisk(uint8_t*buffer,uint32_t sector,uint8_t count)
     return r1;
 }
 
+#if SD_SHARED_BUS && (SD_USE_READ_SESSION || SD_USE_WRITE_SESSION)
+//An open session lets go of CS and the bus between two calls, so the other spi_bus.h devices don't wait for the session
+//timeout. A deselected card keeps its state and ignores the clock: CMD18 goes on with the next data token, CMD25 with
+//the next block (the card may go on programming meanwhile, SD_SendBlock() waits for it).
+static void SD_SessionPark(void)
+{
+    SD_Deselect();
+}
+
+static void SD_SessionResume(void)
+{
+    SPI_Bus_Acquire(&SD_BusDevice);
+    SD_ChipSelect_Low;
+}
+#endif
+
+#if SD_USE_READ_SESSION
+//Persistent CMD18 session: reads of sequential LBAs keep clocking blocks out of one open multi-block read.
+//The card is kept selected while the session is open (between two calls only without SD_SHARED_BUS), every other command
+//closes it with CMD12 (see SD_SendCommand()).
+void SD_SetReadSession(uint8_t enable)
+{
+    SD_ReadSessionClose();
+    SD_ReadSessionEnabled = enable;
+}
+
+uint8_t SD_ReadSessionFetch(uint8_t *buffer, uint32_t sector, uint8_t count)
+{
+    uint8_t r1 = 0;
+
+    if(sdReadSessionOpen && sector != sdReadSessionNext)
+    {
+        SD_ReadSessionClose(); //Non-contiguous access: stop the old stream
+    }
+
+    if(!sdReadSessionOpen)
+    {
+        r1 = SD_SendCommand(CMD18, (SD_Type != SD_TYPE_V2HC) ? (sector << 9) : sector, 0X01);
+        if(r1)
+        {
+            SD_Deselect();
+            return r1;
+        }
+        sdReadSessionOpen = 1;
+    }
+#if SD_SHARED_BUS
+    else
+    {
+        SD_SessionResume();
+    }
+#endif
+
+    do
+    {
+        r1 = SD_ReceiveData(buffer, 512); //The card sends the next data token as soon as we clock again
+        buffer += 512;
+        sector++;
+    }while(--count && r1 == 0);
+
+    sdReadSessionNext = sector;
+
+    if(r1)
+    {
+        SD_ReadSessionClose(); //Lost the stream (e.g. end of the card), start over on the next call
+    }
+#if SD_SHARED_BUS
+    else
+    {
+        SD_SessionPark();
+    }
+#endif
+    return r1;
+}
+
+void SD_ReadSessionClose(void)
+{
+    if(!sdReadSessionOpen)
+    {
+        return; //Nothing to close
+    }
+
+    sdReadSessionOpen = 0; //Clear it first, SD_SendCommand() calls back into here
+    SD_SendCommand(CMD12, 0, 0X01); //Stop transmission
+    SD_Deselect();
+}
+#endif
+
 uint8_t SD_WriteDisk(uint8_t*buffer,uint32_t sector,uint8_t cnt)
 {
     uint8_t r1;
+#if SD_USE_WRITE_SESSION
+    if(SD_WriteSessionEnabled)
+    {
+        return SD_WriteSessionAppend(buffer, sector, cnt);
+    }
+#endif
     if(SD_Type!=SD_TYPE_V2HC)sector *= 512;
     if(cnt==1)
     {
@@ -420,3 +910,100 @@ uint8_t SD_WriteDisk(uint8_t*buffer,uint32_t sector,uint8_t cnt)
     SD_Deselect();
     return r1;
 }
+
+#if SD_USE_WRITE_SESSION
+//Persistent CMD25 session: consecutive writes to sequential LBAs are appended to one open multi-block write.
+//The card is kept selected while the session is open (between two calls only without SD_SHARED_BUS), every other command
+//closes it first (see SD_SendCommand()).
+void SD_SetWriteSession(uint8_t enable)
+{
+    SD_WriteSessionClose();
+    SD_WriteSessionEnabled = enable;
+}
+
+uint8_t SD_WriteSessionAppend(uint8_t *buffer, uint32_t sector, uint8_t cnt)
+{
+    uint8_t r1 = 0;
+
+    if(sdWriteSessionOpen && sector != sdWriteSessionNext)
+    {
+        r1 = SD_WriteSessionClose(); //Non-sequential write: finish the previous run
+        if(r1)
+        {
+            return r1;
+        }
+    }
+
+    if(!sdWriteSessionOpen)
+    {
+        //Open-ended CMD25 (no ACMD23 pre-erase, we don't know how long the run will be)
+        r1 = SD_SendCommand(CMD25, (SD_Type != SD_TYPE_V2HC) ? (sector << 9) : sector, 0X01);
+        if(r1)
+        {
+            SD_Deselect();
+            return r1;
+        }
+        sdWriteSessionOpen = 1;
+    }
+#if SD_SHARED_BUS
+    else
+    {
+        SD_SessionResume();
+    }
+#endif
+
+    do
+    {
+        r1 = SD_SendBlock(buffer, 0xFC);
+        buffer += 512;
+        sector++;
+    }while(--cnt && r1 == 0);
+
+    sdWriteSessionNext = sector;
+    sdWriteSessionIdleMs = 0;
+
+    if(r1)
+    {
+        SD_WriteSessionClose(); //The card rejected a block, don't keep a broken session open
+    }
+#if SD_SHARED_BUS
+    else
+    {
+        SD_SessionPark();
+    }
+#endif
+    return r1;
+}
+
+uint8_t SD_WriteSessionClose(void)
+{
+    uint8_t r1;
+
+    if(!sdWriteSessionOpen)
+    {
+        return 0; //Nothing to close
+    }
+
+    sdWriteSessionOpen = 0; //Clear it first, SD_SendBlock() must not recurse into here
+#if SD_SHARED_BUS
+    SD_SessionResume();
+#endif
+    r1 = SD_SendBlock(0, 0xFD); //Stop Tran token, then wait for the last block to be programmed
+    SD_Deselect();
+    return r1;
+}
+
+void SD_WriteSessionTick(uint16_t elapsedMs)
+{
+    if(!sdWriteSessionOpen)
+    {
+        return;
+    }
+
+    sdWriteSessionIdleMs += elapsedMs;
+    if(sdWriteSessionIdleMs >= SD_WRITE_SESSION_TIMEOUT_MS)
+    {
+        SD_WriteSessionClose(); //Idle for too long, let the card finish and release the bus
+    }
+}
+#endif
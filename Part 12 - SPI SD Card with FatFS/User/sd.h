@@ -1,5 +1,28 @@
+#ifndef SD_H
+#define SD_H
+
 #include "ch32v00x.h"
 #include "ch32v00x_gpio.h"
+#include "spi_bus.h"
+
+//------------------------User-tunable driver config------------------------
+#define SD_USE_DMA      1 //1: 512-byte data blocks are moved by DMA1 CH2 (RX) + CH3 (TX), 0: polling only (saves flash)
+#define SD_USE_WRITE_SESSION 1 //1: sequential disk_write() calls are streamed into one open CMD25
+#define SD_WRITE_SESSION_TIMEOUT_MS 2000 //Idle time after which SD_WriteSessionTick() closes the open CMD25
+#define SD_USE_READ_SESSION 1 //1: sequential disk_read() calls are streamed from one open CMD18
+#define SD_USE_DEFERRED_BUSY 1 //1: SD_SendBlock() returns after the data response, the busy wait moves to the next access
+#define SD_SHARED_BUS   1 //1: an open read/write session releases CS and SPI1 between calls, other spi_bus.h devices can run
+
+#define SD_ERASE_CHUNK  8192 //Sectors per CMD38 of SD_Erase(): 4 MB, so one erase stays well inside the SD_WaitReady() timeout
+#define SD_TUNE_READS   8 //Sectors read at every step of SD_TuneSpeed() for the throughput measurement
+#define SD_INIT_CLOCK_HZ    400000 //Highest SPI clock allowed before the card left the idle state (SD spec: 100...400 kHz)
+#define SD_INIT_TIMEOUT_MS  1000 //ACMD41/CMD1 is repeated for at least this long (SD spec: the card is ready within 1 s)
+#define SD_INIT_POLL_US     500 //Pause between two ACMD41/CMD1 polls
+#define SD_INIT_PRESCALER_AUTO 0xFF //SD_InitPrescaler: fastest prescaler that stays at or below SD_INIT_CLOCK_HZ
+
+//Transfer modes for SD_SetTransferMode()
+#define SD_XFER_POLLING 0 //SPI_TransferByte() for every byte
+#define SD_XFER_DMA     1 //SPI1_DMA_Transfer() for the data blocks
 
 #define SD_TYPE_ERR     0X00
 #define SD_TYPE_MMC     0X01
@@ -13,12 +36,16 @@
 #define CMD9    9       
 #define CMD10   10      
 #define CMD12   12      
+#define CMD13   13
 #define CMD16   16      
 #define CMD17   17      
 #define CMD18   18      
 #define CMD23   23      
 #define CMD24   24      
 #define CMD25   25      
+#define CMD32   32
+#define CMD33   33
+#define CMD38   38
 #define CMD41   41      
 #define CMD55   55      
 #define CMD58   58      
@@ -41,20 +68,69 @@
 #define SD_ChipSelect_High  GPIO_WriteBit(GPIOC,GPIO_Pin_4, Bit_SET)    
 #define SD_ChipSelect_Low GPIO_WriteBit(GPIOC,GPIO_Pin_4, Bit_RESET)
 
+typedef struct
+{
+    uint8_t  prescaler; //SPI_BaudRatePrescaler_x
+    uint8_t  passed;    //1 - CSD, CID and the test sector matched the low speed reference
+    uint32_t clockHz;   //SPI clock of this step
+    uint32_t kbps;      //Measured sector read throughput (KB/s), 0 if the step failed
+} SD_SpeedResult;
+
+typedef struct
+{
+    uint32_t sectors;       //Capacity in 512-byte sectors (0: not read)
+    uint32_t auSectors;     //Erase block: allocation unit (ACMD13 AU_SIZE), else the CSD erase sector, 1 if unknown
+    uint8_t  eraseBlockEn;  //1 - CMD38 erases single blocks (CSD ERASE_BLK_EN), 0 - only whole erase sectors
+} SD_CardInfo;
+
 extern uint8_t  SD_Type; 
+extern SD_CardInfo SD_Info; //Card geometry, read once by SD_Initialize()
+extern uint8_t  SD_SpiPrescaler; //Prescaler of SD_HighSpeed()
+extern uint8_t  SD_InitPrescaler; //Prescaler of SD_LowSpeed(), SD_INIT_PRESCALER_AUTO or SPI_BaudRatePrescaler_x
+extern uint8_t  SD_TransferMode; //SD_XFER_POLLING or SD_XFER_DMA
+extern uint8_t  SD_WriteSessionEnabled; //1 - SD_WriteDisk() uses the persistent CMD25 session
+extern uint8_t  SD_ReadSessionEnabled; //1 - SD_ReadDisk() uses the persistent CMD18 session
+extern SPI_BusDevice SD_BusDevice; //Mode 0, MSB first, PC4: the SD card on the shared SPI1 (spi_bus.h)
+extern volatile uint8_t SD_CardBusy; //1 - the card may still be programming the last block (SD_USE_DEFERRED_BUSY)
 extern GPIO_TypeDef* SD_CD_PORT; //CD port (GPIOx)
 extern uint16_t      SD_CD_PIN; //CD pin (GPIO_Pin_x)
 
 //Functions
 void SD_SetChipDetect(GPIO_TypeDef* SD_CD_PORT, uint16_t SD_CD_PIN); //Set chip detect port and pin
 void SD_HighSpeed(void);
-void SD_LowSpeed(void);
+uint8_t SD_TuneSpeed(uint8_t *buffer, uint32_t testSector, SD_SpeedResult *results, uint8_t *steps); //results: 7 entries, buffer: 512 bytes
+void SD_LowSpeed(void); //Init clock (SD_InitPrescaler)
 uint8_t SD_Detect(GPIO_TypeDef* SD_CD_PORT, uint16_t SD_CD_PIN); //Detect SD
 uint8_t SD_WaitReady(void);                          
+uint8_t SD_Select(void); //0 - card selected and ready, 1 - timeout
+void SD_Deselect(void);
+uint8_t SD_SendCommand(uint8_t command, uint32_t argument, uint8_t crc); //Returns R1, the card stays selected
+uint8_t SD_ReceiveData(uint8_t *buffer, uint16_t length); //Data token + block + CRC
+uint8_t SD_SendBlock(uint8_t *buffer, uint8_t command); //command: 0xFE (CMD24), 0xFC (CMD25 block), 0xFD (CMD25 stop)
 uint8_t SD_GetResponse(uint8_t Response);                 
-uint8_t SD_Initialize(void);                         
+uint8_t SD_Initialize(void); //SD_InitializeCard() + SD_ReadCardInfo()
+uint8_t SD_InitializeCard(void); //CMD0/CMD8/ACMD41 only, SD_Info stays empty, 0 - ok
+uint8_t SD_CheckStatus(void); //CMD13: 0 - the card is initialized and reports no error
 uint8_t SD_ReadDisk(uint8_t*buf,uint32_t sector,uint8_t cnt);       
 uint8_t SD_WriteDisk(uint8_t*buf,uint32_t sector,uint8_t cnt);      
-uint32_t SD_GetSectorCount(void);                    
+uint32_t SD_GetSectorCount(void); //From SD_Info after SD_Initialize()
 uint8_t SD_GetCID(uint8_t *cid_data);                     
-uint8_t SD_GetCSD(uint8_t *csd_data); 
\ No newline at end of file
+uint8_t SD_GetCSD(uint8_t *csd_data);
+uint8_t SD_GetSDStatus(uint8_t *status); //ACMD13, 64 bytes
+uint8_t SD_ReadCardInfo(void); //Fill SD_Info from the CSD and the SD status (SD_Initialize() does it)
+uint8_t SD_Erase(uint32_t start, uint32_t end); //Erase sectors start...end (inclusive) with CMD32/33/38, 0 - ok
+void SD_SetTransferMode(uint8_t mode); //Select polling or DMA for the data blocks
+uint8_t SD_PollBusy(void); //Non-blocking check of a deferred write, 1 - still busy, 0 - ready (call it from the main loop)
+
+//Persistent multi-block write session (SD_USE_WRITE_SESSION)
+void SD_SetWriteSession(uint8_t enable); //Closes the open session, then turns streaming on/off
+uint8_t SD_WriteSessionAppend(uint8_t *buffer, uint32_t sector, uint8_t cnt); //Append to (or open/restart) the CMD25 run
+uint8_t SD_WriteSessionClose(void); //Send the stop token and wait until the card finished programming
+void SD_WriteSessionTick(uint16_t elapsedMs); //Call from the main loop, closes the session after SD_WRITE_SESSION_TIMEOUT_MS idle time
+
+//Persistent multi-block read session (SD_USE_READ_SESSION)
+void SD_SetReadSession(uint8_t enable); //Closes the open stream, then turns streaming on/off
+uint8_t SD_ReadSessionFetch(uint8_t *buffer, uint32_t sector, uint8_t count); //Continue (or open/restart) the CMD18 stream
+void SD_ReadSessionClose(void); //Send CMD12 and release the card
+
+#endif //SD_H
@@ -0,0 +1,1309 @@
+#include "sd_bench.h"
+#include "sd.h"
+#include "spi.h"
+#include "spi_queue.h"
+#include "spi_bus.h"
+#include "bench.h"
+#include "ff.h"
+#include "diskio.h"
+#include "sd_log.h"
+#include "sd_rawlog.h"
+#include "sd_binlog.h"
+#include "sd_ringlog.h"
+#include "sd_linereader.h"
+#include "sd_capture.h"
+#include "sd_journal.h"
+#include <stdlib.h>
+#include <string.h>
+#include "debug.h"
+
+static void SD_Bench_RunMode(uint8_t *buffer, uint32_t sector, uint16_t sectors, uint8_t write, uint8_t mode)
+{
+    uint32_t cycles;
+    uint32_t cpuCycles;
+    uint8_t  error = 0;
+    const char *label;
+
+    SD_SetTransferMode(mode);
+    SPI1_DMA_WaitCycles = 0; //Only the DMA path spins here, the CPU could do something else meanwhile
+
+    Bench_Start();
+    for(uint16_t i = 0; i < sectors; i++)
+    {
+        if(write)
+        {
+            error |= SD_WriteDisk(buffer, sector + i, 1);
+        }
+        else
+        {
+            error |= SD_ReadDisk(buffer, sector + i, 1);
+        }
+    }
+    cycles = Bench_Stop();
+
+    cpuCycles = cycles;
+    if(mode == SD_XFER_DMA)
+    {
+        cpuCycles -= SPI1_DMA_WaitCycles; //Time spent waiting for the DMA is free for other work
+    }
+
+    if(mode == SD_XFER_DMA)
+    {
+        label = write ? "write_dma" : "read_dma";
+    }
+    else
+    {
+        label = write ? "write_polled" : "read_polled";
+    }
+
+    Bench_PrintResult(label, sectors, (uint32_t)sectors * 512, cycles);
+    printf("%s_cpu,%lu\n", label, (unsigned long)(cpuCycles / sectors));
+
+    if(error)
+    {
+        printf("%s: transfer error!\n", label);
+    }
+}
+
+void SD_Bench_TransferModes(uint8_t *buffer, uint32_t sector, uint16_t sectors, uint8_t write)
+{
+    uint8_t savedMode = SD_TransferMode;
+
+    if(sectors == 0)
+    {
+        return;
+    }
+
+    printf("label,sectors,bytes,cycles,cycles/sector,KB/s\n");
+
+    SD_Bench_RunMode(buffer, sector, sectors, 0, SD_XFER_POLLING);
+#if SD_USE_DMA
+    SD_Bench_RunMode(buffer, sector, sectors, 0, SD_XFER_DMA);
+#endif
+
+    if(write)
+    {
+        //The buffer still holds the last sector that was read, it is copied over the whole range
+        SD_Bench_RunMode(buffer, sector, sectors, 1, SD_XFER_POLLING);
+#if SD_USE_DMA
+        SD_Bench_RunMode(buffer, sector, sectors, 1, SD_XFER_DMA);
+#endif
+    }
+
+    SD_SetTransferMode(savedMode);
+}
+
+#if SD_USE_WRITE_SESSION
+static void SD_Bench_RunWriteSession(uint8_t *buffer, uint32_t sector, uint16_t sectors, uint8_t session, uint8_t erased)
+{
+    uint32_t start;
+    uint32_t latency;
+    uint32_t maxLatency = 0;
+    uint32_t cycles;
+    uint8_t  error = 0;
+    const char *label = erased ? "write_session_erased" : session ? "write_session" : "write_cmd24";
+
+    SD_SetWriteSession(session);
+
+    if(erased)
+    {
+        Bench_Start();
+        error = SD_Erase(sector, sector + sectors - 1); //Pre-erase, like SD_RawLog_PreErase() before a logging run
+        cycles = Bench_Stop();
+        printf("erase,%u,%lu\n", sectors, (unsigned long)cycles);
+    }
+
+    Bench_Start();
+    for(uint16_t i = 0; i < sectors; i++)
+    {
+        start = Bench_Now();
+        error |= SD_WriteDisk(buffer, sector + i, 1); //One disk_write() per sector, like FatFs appending a file
+        latency = Bench_Now() - start;
+
+        if(latency > maxLatency)
+        {
+            maxLatency = latency;
+        }
+    }
+    error |= SD_WriteSessionClose(); //The last block is only safe after the stop token (CTRL_SYNC)
+    cycles = Bench_Stop();
+
+    Bench_PrintResult(label, sectors, (uint32_t)sectors * 512, cycles);
+    printf("%s_max,%lu\n", label, (unsigned long)maxLatency);
+
+    if(error)
+    {
+        printf("%s: transfer error!\n", label);
+    }
+}
+#endif
+
+void SD_Bench_WriteSession(uint8_t *buffer, uint32_t sector, uint16_t sectors)
+{
+#if SD_USE_WRITE_SESSION
+    uint8_t savedSession = SD_WriteSessionEnabled;
+
+    if(sectors == 0)
+    {
+        return;
+    }
+
+    printf("label,sectors,bytes,cycles,cycles/sector,KB/s\n");
+
+    SD_Bench_RunWriteSession(buffer, sector, sectors, 0, 0);
+    SD_Bench_RunWriteSession(buffer, sector, sectors, 1, 0);
+    SD_Bench_RunWriteSession(buffer, sector, sectors, 1, 1);
+
+    SD_SetWriteSession(savedSession);
+#else
+    printf("SD_USE_WRITE_SESSION is disabled\n");
+#endif
+}
+
+#if SD_USE_READ_SESSION
+static void SD_Bench_RunReadSession(uint8_t *buffer, uint32_t sector, uint16_t sectors, uint8_t session)
+{
+    uint32_t cycles;
+    uint8_t  error = 0;
+    const char *label = session ? "read_session" : "read_cmd17";
+
+    SD_SetReadSession(session);
+
+    Bench_Start();
+    for(uint16_t i = 0; i < sectors; i++)
+    {
+        error |= SD_ReadDisk(buffer, sector + i, 1); //One disk_read() per sector, like FatFs filling its window
+    }
+    SD_ReadSessionClose();
+    cycles = Bench_Stop();
+
+    Bench_PrintResult(label, sectors, (uint32_t)sectors * 512, cycles);
+
+    if(error)
+    {
+        printf("%s: transfer error!\n", label);
+    }
+}
+
+static void SD_Bench_RunFileRead(const char *path, uint8_t *buffer, uint8_t session)
+{
+    FIL file;
+    UINT readBytes;
+    uint32_t total = 0;
+    uint32_t chunks = 0;
+    uint32_t cycles;
+    FRESULT res;
+
+    SD_SetReadSession(session);
+
+    if(f_open(&file, path, FA_READ) != FR_OK)
+    {
+        printf("%s: f_open failed\n", path);
+        return;
+    }
+
+    Bench_Start();
+    do
+    {
+        res = f_read(&file, buffer, 512, &readBytes);
+        total += readBytes;
+        chunks++;
+    }while(res == FR_OK && readBytes == 512);
+    cycles = Bench_Stop();
+
+    f_close(&file);
+
+    Bench_PrintResult(session ? "file_read_session" : "file_read_cmd17", chunks, total, cycles);
+}
+#endif
+
+void SD_Bench_ReadSession(uint8_t *buffer, uint32_t sector, uint16_t sectors)
+{
+#if SD_USE_READ_SESSION
+    uint8_t savedSession = SD_ReadSessionEnabled;
+
+    if(sectors == 0)
+    {
+        return;
+    }
+
+    printf("label,sectors,bytes,cycles,cycles/sector,KB/s\n");
+
+    SD_Bench_RunReadSession(buffer, sector, sectors, 0);
+    SD_Bench_RunReadSession(buffer, sector, sectors, 1);
+
+    SD_SetReadSession(savedSession);
+#else
+    printf("SD_USE_READ_SESSION is disabled\n");
+#endif
+}
+
+void SD_Bench_FileRead(const char *path, uint8_t *buffer)
+{
+#if SD_USE_READ_SESSION
+    uint8_t savedSession = SD_ReadSessionEnabled;
+
+    printf("label,chunks,bytes,cycles,cycles/chunk,KB/s\n");
+
+    SD_Bench_RunFileRead(path, buffer, 0);
+    SD_Bench_RunFileRead(path, buffer, 1);
+
+    SD_SetReadSession(savedSession);
+#else
+    printf("SD_USE_READ_SESSION is disabled\n");
+#endif
+}
+
+static void SD_Bench_RunFileScan(const char *path, uint8_t *buffer, uint16_t chunk, uint8_t readahead)
+{
+    FIL file;
+    UINT readBytes;
+    uint32_t total = 0;
+    uint32_t cycles;
+    FRESULT res;
+    DISK_CACHE_STATS stats;
+
+    disk_readahead_enable(readahead);
+    disk_cache_reset_stats();
+
+    if(f_open(&file, path, FA_READ) != FR_OK)
+    {
+        printf("%s: f_open failed\n", path);
+        return;
+    }
+
+    Bench_Start();
+    do
+    {
+        res = f_read(&file, buffer, chunk, &readBytes);
+        total += readBytes;
+    }while(res == FR_OK && readBytes == chunk);
+    cycles = Bench_Stop();
+
+    f_close(&file);
+
+    disk_cache_stats(&stats);
+    Bench_PrintResult(readahead ? "scan_readahead" : "scan_plain", stats.sectorsRead, total, cycles);
+    printf("%s_prefetch_hits,%lu\n", readahead ? "scan_readahead" : "scan_plain", (unsigned long)stats.prefetchHits);
+}
+
+void SD_Bench_FileScan(const char *path, uint8_t *buffer, uint16_t chunk)
+{
+    if(chunk == 0)
+    {
+        return;
+    }
+
+    printf("label,card sectors,bytes,cycles,cycles/sector,KB/s\n");
+
+    SD_Bench_RunFileScan(path, buffer, chunk, 0);
+#if DISKIO_READAHEAD_SECTORS > 0
+    SD_Bench_RunFileScan(path, buffer, chunk, 1);
+#else
+    printf("scan_readahead: not built in (DISKIO_READAHEAD_SECTORS 0)\n"); //A second run would be the same code
+#endif
+
+    disk_readahead_enable(1);
+}
+
+//One 'count'-sector transfer, the same command sequence as SD_ReadDisk()/SD_WriteDisk(), but every block uses 'buffer'
+static uint8_t SD_Bench_Transfer(uint8_t *buffer, uint32_t sector, uint8_t count, uint8_t write)
+{
+    uint8_t r1;
+
+    if(SD_Type != SD_TYPE_V2HC)
+    {
+        sector <<= 9; //Byte addressing
+    }
+
+    if(write)
+    {
+        if(count == 1)
+        {
+            r1 = SD_SendCommand(CMD24, sector, 0X01);
+            if(r1 == 0)
+            {
+                r1 = SD_SendBlock(buffer, 0xFE);
+            }
+        }
+        else
+        {
+            if(SD_Type != SD_TYPE_MMC)
+            {
+                SD_SendCommand(CMD55, 0, 0X01);
+                SD_SendCommand(CMD23, count, 0X01); //Pre-erase, like SD_WriteDisk()
+            }
+            r1 = SD_SendCommand(CMD25, sector, 0X01);
+            if(r1 == 0)
+            {
+                do
+                {
+                    r1 = SD_SendBlock(buffer, 0xFC);
+                }while(--count && r1 == 0);
+
+                if(r1 == 0)
+                {
+                    r1 = SD_SendBlock(0, 0xFD);
+                }
+            }
+        }
+    }
+    else
+    {
+        if(count == 1)
+        {
+            r1 = SD_SendCommand(CMD17, sector, 0X01);
+            if(r1 == 0)
+            {
+                r1 = SD_ReceiveData(buffer, 512);
+            }
+        }
+        else
+        {
+            r1 = SD_SendCommand(CMD18, sector, 0X01);
+            if(r1 == 0)
+            {
+                do
+                {
+                    r1 = SD_ReceiveData(buffer, 512);
+                }while(--count && r1 == 0);
+            }
+            SD_SendCommand(CMD12, 0, 0X01);
+        }
+    }
+
+    SD_Deselect();
+    return r1;
+}
+
+static void SD_Bench_RunRaw(uint8_t *buffer, uint32_t sector, uint16_t sectors, uint8_t count, uint8_t write)
+{
+    Bench_Histogram hist;
+    char label[16];
+    uint16_t transfers = sectors / count;
+    uint32_t start;
+    uint32_t cycles;
+    uint8_t  error = 0;
+
+    if(transfers == 0)
+    {
+        return; //Range is shorter than one transfer
+    }
+
+    snprintf(label, sizeof(label), "raw_%s_%u", write ? "write" : "read", count);
+    Bench_HistReset(&hist);
+
+    Bench_Start();
+    for(uint16_t i = 0; i < transfers; i++)
+    {
+        start = Bench_Now();
+        error |= SD_Bench_Transfer(buffer, sector + (uint32_t)i * count, count, write);
+        Bench_HistAdd(&hist, Bench_Now() - start);
+    }
+#if SD_USE_DEFERRED_BUSY
+    while(SD_PollBusy()); //The last block has to be programmed before the time stops
+#endif
+    cycles = Bench_Stop();
+
+    Bench_PrintResult(label, transfers, (uint32_t)transfers * count * 512, cycles);
+    Bench_PrintHist(label, &hist);
+
+    if(error)
+    {
+        printf("%s: transfer error!\n", label);
+    }
+}
+
+void SD_Bench_RawSuite(uint8_t *buffer, uint32_t sector, uint16_t sectors, uint8_t write)
+{
+    static const uint8_t counts[] = {1, 4, 8, 32};
+
+    printf("label,transfers,bytes,cycles,cycles/transfer,KB/s\n");
+    Bench_PrintHistHeader();
+
+    if(write)
+    {
+        for(uint8_t i = 0; i < sizeof(counts); i++)
+        {
+            SD_Bench_RunRaw(buffer, sector, sectors, counts[i], 1);
+        }
+    }
+
+    for(uint8_t i = 0; i < sizeof(counts); i++)
+    {
+        SD_Bench_RunRaw(buffer, sector, sectors, counts[i], 0);
+    }
+}
+
+static void SD_Bench_RunAppend(const char *path, uint8_t *buffer, uint16_t recordSize)
+{
+    FIL file;
+    UINT written;
+    Bench_Histogram hist;
+    char label[16];
+    uint16_t records = SD_BENCH_APPEND_BYTES / recordSize;
+    uint32_t start;
+    uint32_t cycles;
+    FRESULT res = FR_OK;
+
+    snprintf(label, sizeof(label), "append_%u", recordSize);
+    Bench_HistReset(&hist);
+
+    if(f_open(&file, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+    {
+        printf("%s: f_open failed\n", path);
+        return;
+    }
+
+    Bench_Start();
+    for(uint16_t i = 0; i < records && res == FR_OK; i++)
+    {
+        start = Bench_Now();
+        res = f_write(&file, buffer, recordSize, &written);
+        Bench_HistAdd(&hist, Bench_Now() - start);
+    }
+    f_close(&file); //The last partial sector is written here, it belongs to the append cost
+    cycles = Bench_Stop();
+
+    Bench_PrintResult(label, records, (uint32_t)records * recordSize, cycles);
+    Bench_PrintHist(label, &hist);
+
+    if(res != FR_OK)
+    {
+        printf("%s: f_write failed (%u)\n", label, res);
+    }
+}
+
+void SD_Bench_FileSuite(const char *path, uint8_t *buffer)
+{
+    static const uint16_t recordSizes[] = {16, 64, 512};
+    FIL file;
+    Bench_Histogram histCycle;
+    Bench_Histogram histOpen;
+    Bench_Histogram histSeek;
+    Bench_Histogram histClose;
+    uint32_t start;
+    uint32_t t1;
+    uint32_t t2;
+    uint32_t end;
+    uint32_t cycles;
+
+    for(uint16_t i = 0; i < 512; i++)
+    {
+        buffer[i] = (i & 15) == 15 ? '\n' : 'a' + (i & 15); //Text records, so the file can be checked on a PC
+    }
+
+    printf("label,records,bytes,cycles,cycles/record,KB/s\n");
+    Bench_PrintHistHeader();
+
+    for(uint8_t i = 0; i < sizeof(recordSizes) / sizeof(recordSizes[0]); i++)
+    {
+        SD_Bench_RunAppend(path, buffer, recordSizes[i]);
+    }
+
+    //Open/seek/close cycle of the logger in main.c, on the file that is now SD_BENCH_APPEND_BYTES long
+    Bench_HistReset(&histCycle);
+    Bench_HistReset(&histOpen);
+    Bench_HistReset(&histSeek);
+    Bench_HistReset(&histClose);
+
+    Bench_Start();
+    for(uint16_t i = 0; i < SD_BENCH_OPEN_CYCLES; i++)
+    {
+        start = Bench_Now();
+        if(f_open(&file, path, FA_OPEN_ALWAYS | FA_WRITE) != FR_OK)
+        {
+            printf("%s: f_open failed\n", path);
+            break;
+        }
+        t1 = Bench_Now();
+        f_lseek(&file, f_size(&file));
+        t2 = Bench_Now();
+        f_close(&file);
+        end = Bench_Now();
+
+        Bench_HistAdd(&histOpen, t1 - start);
+        Bench_HistAdd(&histSeek, t2 - t1);
+        Bench_HistAdd(&histClose, end - t2);
+        Bench_HistAdd(&histCycle, end - start);
+    }
+    cycles = Bench_Stop();
+
+    Bench_PrintResult("open_cycle", histCycle.count, 0, cycles);
+    Bench_PrintHist("open_cycle", &histCycle);
+    Bench_PrintHist("f_open", &histOpen);
+    Bench_PrintHist("f_lseek", &histSeek);
+    Bench_PrintHist("f_close", &histClose);
+}
+
+static void SD_Bench_RunLogGrowth(const char *path, uint8_t *buffer, uint32_t total, uint16_t sampleSize, uint8_t keepOpen)
+{
+    SD_Log log;
+    FIL file;
+    UINT written;
+    uint32_t logged = 0;
+    uint32_t stepEnd;
+    uint32_t samples;
+    uint32_t cycles;
+    FRESULT res = FR_OK;
+    const char *label = keepOpen ? "log_keep_open" : "log_reopen";
+
+    //Start from an empty file
+    if(f_open(&file, path, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
+    {
+        printf("%s: f_open failed\n", path);
+        return;
+    }
+    f_close(&file);
+
+    if(keepOpen && SD_Log_Open(&log, path, SD_BENCH_LOG_SYNC, 0) != FR_OK)
+    {
+        printf("%s: SD_Log_Open failed\n", path);
+        return;
+    }
+
+    while(logged < total && res == FR_OK)
+    {
+        stepEnd = logged + (uint32_t)SD_BENCH_LOG_STEP_KB * 1024;
+        samples = 0;
+
+        Bench_Start();
+        while(logged < stepEnd && logged < total)
+        {
+            if(keepOpen)
+            {
+                res = SD_Log_Write(&log, buffer, sampleSize);
+            }
+            else
+            {
+                res = f_open(&file, path, FA_OPEN_ALWAYS | FA_WRITE);
+                if(res == FR_OK)
+                {
+                    res = f_lseek(&file, f_size(&file)); //Walks the cluster chain from the start of the file
+                    if(res == FR_OK)
+                    {
+                        res = f_write(&file, buffer, sampleSize, &written);
+                    }
+                    f_close(&file);
+                }
+            }
+
+            if(res != FR_OK)
+            {
+                break;
+            }
+            logged += sampleSize;
+            samples++;
+        }
+        cycles = Bench_Stop();
+
+        if(samples)
+        {
+            printf("%s,%lu,%lu\n", label, (unsigned long)(logged / 1024), (unsigned long)(cycles / samples));
+        }
+    }
+
+    if(keepOpen)
+    {
+        SD_Log_Close(&log);
+    }
+
+    if(res != FR_OK)
+    {
+        printf("%s: write failed (%u)\n", label, res);
+    }
+}
+
+void SD_Bench_LogGrowth(const char *path, uint8_t *buffer, uint16_t totalKB, uint16_t sampleSize)
+{
+    if(sampleSize == 0 || sampleSize > 512)
+    {
+        return;
+    }
+
+    for(uint16_t i = 0; i < sampleSize; i++)
+    {
+        buffer[i] = (i == sampleSize - 1) ? '\n' : '0' + (i % 10);
+    }
+
+    printf("label,file_kb,cycles/sample\n");
+
+    SD_Bench_RunLogGrowth(path, buffer, (uint32_t)totalKB * 1024, sampleSize, 0);
+    SD_Bench_RunLogGrowth(path, buffer, (uint32_t)totalKB * 1024, sampleSize, 1);
+}
+
+static void SD_Bench_RunStreamLog(const char *path, uint8_t *buffer, uint32_t total, uint16_t checkpointSectors, uint8_t raw)
+{
+    union
+    {
+        SD_Log    fat;
+        SD_RawLog raw;
+    } log;
+    FIL file;
+    uint8_t sample[32];
+    Bench_Histogram hist;
+    DISK_CACHE_STATS stats;
+    uint32_t samples = total / sizeof(sample);
+    uint32_t start;
+    uint32_t cycles;
+    FRESULT res;
+    const char *label = raw ? "stream_raw" : "stream_fatfs";
+
+    for(uint8_t i = 0; i < sizeof(sample); i++)
+    {
+        sample[i] = (i == sizeof(sample) - 1) ? '\n' : 'A' + (i % 26);
+    }
+
+    if(raw)
+    {
+        res = SD_RawLog_Create(&log.raw, path, total, buffer, checkpointSectors);
+    }
+    else
+    {
+        res = f_open(&file, path, FA_CREATE_ALWAYS | FA_WRITE); //Start from an empty file
+        if(res == FR_OK)
+        {
+            f_close(&file);
+            res = SD_Log_Open(&log.fat, path, 0, (uint32_t)checkpointSectors * 512);
+        }
+    }
+
+    if(res != FR_OK)
+    {
+        printf("%s: open failed (%u)\n", label, res);
+        return;
+    }
+
+    Bench_HistReset(&hist);
+    disk_cache_reset_stats();
+
+    Bench_Start();
+    for(uint32_t i = 0; i < samples && res == FR_OK; i++)
+    {
+        start = Bench_Now();
+        res = raw ? SD_RawLog_Write(&log.raw, sample, sizeof(sample)) : SD_Log_Write(&log.fat, sample, sizeof(sample));
+        Bench_HistAdd(&hist, Bench_Now() - start);
+    }
+    if(raw)
+    {
+        SD_RawLog_Close(&log.raw);
+    }
+    else
+    {
+        SD_Log_Close(&log.fat);
+    }
+    cycles = Bench_Stop();
+
+    disk_cache_stats(&stats);
+    Bench_PrintResult(label, hist.count, hist.count * sizeof(sample), cycles);
+    Bench_PrintHist(label, &hist);
+    printf("%s_sectors,%lu\n", label, (unsigned long)stats.sectorsWritten);
+
+    if(res != FR_OK)
+    {
+        printf("%s: write failed (%u)\n", label, res);
+    }
+}
+
+void SD_Bench_StreamLog(const char *path, uint8_t *buffer, uint16_t totalKB, uint16_t checkpointSectors)
+{
+    printf("label,samples,bytes,cycles,cycles/sample,KB/s\n");
+    Bench_PrintHistHeader();
+
+    SD_Bench_RunStreamLog(path, buffer, (uint32_t)totalKB * 1024, checkpointSectors, 0);
+    SD_Bench_RunStreamLog(path, buffer, (uint32_t)totalKB * 1024, checkpointSectors, 1);
+}
+
+static void SD_Bench_RunRecordFormat(const char *path, uint8_t *buffer, uint16_t samples, uint8_t binary)
+{
+    union
+    {
+        SD_Log    text;
+        SD_BinLog bin;
+    } log;
+    FIL file;
+    char line[24];
+    uint32_t cpuCycles = 0;
+    uint16_t cpuSamples = 0; //Samples in cpuCycles
+    uint32_t cycles;
+    uint32_t start;
+    uint32_t size = 0;
+    FRESULT res;
+    const char *label = binary ? "record_binary" : "record_ascii";
+
+    res = f_open(&file, path, FA_CREATE_ALWAYS | FA_WRITE); //Start from an empty file
+    if(res == FR_OK)
+    {
+        f_close(&file);
+        res = binary ? SD_BinLog_Open(&log.bin, path, buffer, 0) : SD_Log_Open(&log.text, path, 0, 0);
+    }
+
+    if(res != FR_OK)
+    {
+        printf("%s: open failed (%u)\n", label, res);
+        return;
+    }
+
+    Bench_Start();
+    for(uint16_t i = 0; i < samples && res == FR_OK; i++)
+    {
+        uint32_t timestamp = (uint32_t)i * 1000;
+        int16_t raw = 400 + (int16_t)(i % 64) - 32; //~25 degC in 1/16 degC steps
+
+        if(binary)
+        {
+            uint8_t packOnly = (log.bin.count + 1 < SD_BINLOG_RECORDS_PER_FRAME); //The append does not write the frame
+
+            start = Bench_Now();
+            res = SD_BinLog_Append(&log.bin, timestamp, 0, raw, 0); //Packing is part of the append
+            if(packOnly)
+            {
+                cpuCycles += Bench_Now() - start;
+                cpuSamples++;
+            }
+        }
+        else
+        {
+            int32_t scaled = (int32_t)raw * 10 / 16; //Same conversion as printFloatTemp()
+            int length;
+
+            start = Bench_Now();
+            length = snprintf(line, sizeof(line), "%lu,%d.%01d\n", (unsigned long)timestamp, (int)(scaled / 10), (int)abs(scaled % 10));
+            cpuCycles += Bench_Now() - start;
+            cpuSamples++;
+            res = SD_Log_Write(&log.text, line, length);
+        }
+    }
+
+    if(binary)
+    {
+        size = (uint32_t)f_size(&log.bin.file) + (log.bin.count ? SD_BINLOG_FRAME_SIZE : 0); //+ the frame Close() writes
+        SD_BinLog_Close(&log.bin);
+    }
+    else
+    {
+        size = (uint32_t)f_size(&log.text.file);
+        SD_Log_Close(&log.text);
+    }
+    cycles = Bench_Stop();
+
+    Bench_PrintResult(label, samples, size, cycles);
+    printf("%s_cpu,%lu\n", label, (unsigned long)(cpuSamples ? cpuCycles / cpuSamples : 0));
+    printf("%s_bytes,%lu.%02lu\n", label, (unsigned long)(size / samples), (unsigned long)((size % samples) * 100 / samples));
+
+    if(res != FR_OK)
+    {
+        printf("%s: write failed (%u)\n", label, res);
+    }
+}
+
+void SD_Bench_RecordFormats(const char *textPath, const char *binPath, uint8_t *buffer, uint16_t samples)
+{
+    if(samples == 0)
+    {
+        return;
+    }
+
+    printf("label,samples,file bytes,cycles,cycles/sample,KB/s\n");
+
+    SD_Bench_RunRecordFormat(textPath, buffer, samples, 0);
+    SD_Bench_RunRecordFormat(binPath, buffer, samples, 1);
+}
+
+void SD_Bench_RingLog(const char *path, uint8_t *buffer, uint32_t dataSectors, uint32_t records)
+{
+    SD_RingLog log;
+    SD_BinRecord record = {0};
+    SD_BinRecord last[16];
+    Bench_Histogram hist;
+    uint32_t start;
+    uint32_t cycles;
+    uint16_t found = 0;
+    FRESULT res;
+
+    res = SD_RingLog_Open(&log, path, dataSectors, sizeof(SD_BinRecord), buffer, 8);
+    if(res != FR_OK)
+    {
+        printf("%s: SD_RingLog_Open failed (%u)\n", path, res);
+        return;
+    }
+
+    printf("label,records,bytes,cycles,cycles/record,KB/s\n");
+    Bench_PrintHistHeader();
+    Bench_HistReset(&hist);
+
+    Bench_Start();
+    for(uint32_t i = 0; i < records && res == FR_OK; i++)
+    {
+        record.timestamp = i * 1000;
+        record.value = (int16_t)i;
+
+        start = Bench_Now();
+        res = SD_RingLog_Append(&log, &record);
+        Bench_HistAdd(&hist, Bench_Now() - start);
+    }
+    SD_RingLog_Flush(&log);
+    cycles = Bench_Stop();
+
+    Bench_PrintResult("ring_append", hist.count, hist.count * sizeof(SD_BinRecord), cycles);
+    Bench_PrintHist("ring_append", &hist);
+
+    Bench_Start();
+    for(uint8_t i = 0; i < 4; i++)
+    {
+        found = SD_RingLog_ReadLast(&log, last, sizeof(last) / sizeof(last[0]));
+    }
+    cycles = Bench_Stop();
+    printf("ring_read_last,%u,%lu\n", found, (unsigned long)(cycles / 4));
+
+    SD_RingLog_Close(&log);
+
+    if(res != FR_OK)
+    {
+        printf("ring_append: write failed (%u)\n", res);
+    }
+}
+
+static uint32_t SD_Bench_FindLine(FIL *file, uint32_t timestamp, char *line, uint16_t size) //f_gets() until the first line at or after 'timestamp'
+{
+    while(f_gets(line, size, file))
+    {
+        uint32_t lineTime = strtoul(line, 0, 10);
+        if(lineTime >= timestamp)
+        {
+            return lineTime;
+        }
+    }
+    return 0xFFFFFFFF;
+}
+
+void SD_Bench_IndexLookup(const char *logPath, const char *indexPath, uint32_t records, uint16_t interval)
+{
+    SD_Log log;
+    SD_Index index;
+    FIL reader;
+    DISK_CACHE_STATS stats;
+    char line[24];
+    uint32_t written = 0;
+    uint32_t target;
+    uint32_t found;
+    uint32_t cycles;
+    FRESULT res;
+
+    res = f_open(&reader, logPath, FA_CREATE_ALWAYS | FA_WRITE); //Start from an empty log and index
+    if(res == FR_OK)
+    {
+        f_close(&reader);
+        res = f_open(&reader, indexPath, FA_CREATE_ALWAYS | FA_WRITE);
+    }
+    if(res == FR_OK)
+    {
+        f_close(&reader);
+        res = SD_Log_Open(&log, logPath, 0, 4096);
+    }
+    if(res == FR_OK)
+    {
+        res = SD_Index_Open(&index, indexPath, interval);
+        if(res != FR_OK)
+        {
+            SD_Log_Close(&log);
+        }
+    }
+    if(res != FR_OK)
+    {
+        printf("%s: open failed (%u)\n", logPath, res);
+        return;
+    }
+    SD_Log_SetIndex(&log, &index);
+
+    printf("label,log_records,index_entries,sectors_read,cycles/lookup\n");
+
+    for(uint8_t step = 1; step <= SD_BENCH_INDEX_STEPS && res == FR_OK; step++)
+    {
+        for(; written < records / SD_BENCH_INDEX_STEPS * step && res == FR_OK; written++)
+        {
+            int length = snprintf(line, sizeof(line), "%lu,%d\n", (unsigned long)written * 1000, (int)(written % 500));
+            res = SD_Log_WriteStamped(&log, written * 1000, line, length);
+        }
+        if(res == FR_OK)
+        {
+            res = SD_Log_Sync(&log);
+        }
+        if(res != FR_OK || f_open(&reader, logPath, FA_READ) != FR_OK)
+        {
+            break;
+        }
+
+        target = (written * 3 / 4) * 1000 + 1; //Between two records, 3/4 into the log
+
+        disk_cache_reset_stats();
+        Bench_Start();
+        res = SD_Index_Seek(&index, &reader, target);
+        found = SD_Bench_FindLine(&reader, target, line, sizeof(line));
+        cycles = Bench_Stop();
+        disk_cache_stats(&stats);
+        printf("index_lookup,%lu,%lu,%lu,%lu\n", (unsigned long)written, (unsigned long)index.entries, (unsigned long)stats.sectorsRead,
+               (unsigned long)cycles);
+
+        f_lseek(&reader, 0);
+        disk_cache_reset_stats();
+        Bench_Start();
+        if(SD_Bench_FindLine(&reader, target, line, sizeof(line)) != found)
+        {
+            printf("index_lookup: wrong record\n");
+        }
+        cycles = Bench_Stop();
+        disk_cache_stats(&stats);
+        printf("linear_lookup,%lu,0,%lu,%lu\n", (unsigned long)written, (unsigned long)stats.sectorsRead, (unsigned long)cycles);
+
+        f_close(&reader);
+    }
+
+    SD_Log_Close(&log); //Closes the index too
+
+    if(res != FR_OK)
+    {
+        printf("index_lookup: failed (%u)\n", res);
+    }
+}
+
+static void SD_Bench_RunLineRead(const char *path, uint8_t *buffer, uint16_t size)
+{
+    FIL file;
+    SD_LineReader reader;
+    char label[20];
+    uint32_t lines = 0;
+    uint32_t cycles;
+    uint32_t bytes;
+    uint32_t perKB = 0;
+
+    if(f_open(&file, path, FA_READ) != FR_OK)
+    {
+        printf("%s: f_open failed\n", path);
+        return;
+    }
+
+    Bench_Start();
+    if(size == 0)
+    {
+        char line[64];
+
+        while(f_gets(line, sizeof(line), &file))
+        {
+            lines++;
+        }
+    }
+    else
+    {
+        SD_LineReader_Init(&reader, &file, (char *)buffer, size);
+        while(SD_LineReader_Next(&reader, 0))
+        {
+            lines++;
+        }
+    }
+    cycles = Bench_Stop();
+    bytes = f_tell(&file);
+
+    f_close(&file);
+
+    if(size == 0)
+    {
+        snprintf(label, sizeof(label), "lines_fgets");
+    }
+    else
+    {
+        snprintf(label, sizeof(label), "lines_reader_%u", size);
+    }
+    if(bytes)
+    {
+        perKB = (uint32_t)(((uint64_t)cycles * 1024) / bytes);
+    }
+    Bench_PrintResult(label, lines, bytes, cycles);
+    printf("%s_cycles_per_kb,%lu\n", label, (unsigned long)perKB);
+}
+
+void SD_Bench_LineRead(const char *path, uint8_t *buffer)
+{
+    printf("label,lines,bytes,cycles,cycles/line,KB/s\n");
+
+    SD_Bench_RunLineRead(path, buffer, 0);
+    SD_Bench_RunLineRead(path, buffer, 64);
+    SD_Bench_RunLineRead(path, buffer, 512);
+}
+
+void SD_Bench_Capture(const char *path, uint8_t *buffer0, uint8_t *buffer1, uint32_t sectors, uint16_t sampleSize, uint16_t checkpointSectors)
+{
+    SD_RawLog log;
+    SD_Capture capture;
+    Bench_Histogram hist;
+    uint8_t sample[16] = {0};
+    uint32_t perSector;
+    uint32_t start;
+    uint32_t cycles;
+    uint32_t worstRate = 0;
+    uint32_t meanRate = 0;
+    FRESULT res;
+
+    if(sampleSize == 0 || sampleSize > sizeof(sample))
+    {
+        return;
+    }
+    perSector = SD_CAPTURE_SECTOR / sampleSize;
+
+    res = SD_RawLog_Create(&log, path, sectors * SD_CAPTURE_SECTOR, 0, checkpointSectors); //Only whole sectors, no log buffer
+    if(res != FR_OK)
+    {
+        printf("%s: SD_RawLog_Create failed (%u)\n", path, res);
+        return;
+    }
+    SD_Capture_Init(&capture, &log, buffer0, buffer1, sampleSize);
+
+    printf("label,sectors,bytes,cycles,cycles/sector,KB/s\n");
+    Bench_PrintHistHeader();
+    Bench_HistReset(&hist);
+
+    //The samples arrive instantly here, so every sector write is timed on its own: the worst one limits the rate
+    Bench_Start();
+    while(capture.sectors < sectors && res == FR_OK)
+    {
+        while(!capture.full)
+        {
+            sample[0]++;
+            SD_Capture_Put(&capture, sample);
+        }
+
+        start = Bench_Now();
+        res = SD_Capture_Service(&capture);
+        Bench_HistAdd(&hist, Bench_Now() - start);
+    }
+    cycles = Bench_Stop();
+
+    SD_Capture_Stop(&capture);
+
+    Bench_PrintResult("capture_sector", capture.sectors, capture.sectors * SD_CAPTURE_SECTOR, cycles);
+    Bench_PrintHist("capture_sector", &hist);
+
+    if(hist.max)
+    {
+        worstRate = (uint32_t)((uint64_t)perSector * SystemCoreClock / hist.max);
+    }
+    if(cycles)
+    {
+        meanRate = (uint32_t)((uint64_t)perSector * capture.sectors * SystemCoreClock / cycles);
+    }
+    printf("capture_rate,%u,%lu,%lu\n", sampleSize, (unsigned long)worstRate, (unsigned long)meanRate);
+
+    if(res != FR_OK)
+    {
+        printf("capture_sector: write failed (%u)\n", res);
+    }
+}
+
+void SD_Bench_Durability(const char *path, const char *journalPath, uint8_t *buffer, uint16_t samples)
+{
+    SD_Journal journal;
+    SD_Log log;
+    FIL file;
+    SD_BinRecord record = {0};
+    DISK_CACHE_STATS stats;
+    uint32_t cycles;
+    UINT written;
+    FRESULT res = FR_OK;
+
+    printf("label,samples,sectors_written,cycles/sample\n");
+
+    //1. Reopen, append and close for every sample (the old main.c loop)
+    f_open(&file, path, FA_CREATE_ALWAYS | FA_WRITE);
+    f_close(&file);
+    disk_cache_reset_stats();
+    Bench_Start();
+    for(uint16_t i = 0; i < samples && res == FR_OK; i++)
+    {
+        record.timestamp = i;
+        res = f_open(&file, path, FA_OPEN_APPEND | FA_WRITE);
+        if(res == FR_OK)
+        {
+            res = f_write(&file, &record, sizeof(record), &written);
+            f_close(&file);
+        }
+    }
+    cycles = Bench_Stop();
+    disk_cache_stats(&stats);
+    printf("durable_reopen,%u,%lu,%lu\n", samples, (unsigned long)stats.sectorsWritten, (unsigned long)(cycles / samples));
+
+    //2. File kept open, f_sync() after every sample
+    f_open(&file, path, FA_CREATE_ALWAYS | FA_WRITE);
+    f_close(&file);
+    res = SD_Log_Open(&log, path, 1, 0);
+    disk_cache_reset_stats();
+    Bench_Start();
+    for(uint16_t i = 0; i < samples && res == FR_OK; i++)
+    {
+        record.timestamp = i;
+        res = SD_Log_Write(&log, &record, sizeof(record));
+    }
+    cycles = Bench_Stop();
+    SD_Log_Close(&log);
+    disk_cache_stats(&stats);
+    printf("durable_fsync,%u,%lu,%lu\n", samples, (unsigned long)stats.sectorsWritten, (unsigned long)(cycles / samples));
+
+    //3. Journal: one data sector write per commit, directory entry every 64 sectors, no FAT write
+    res = SD_Journal_Open(&journal, journalPath, samples / ((512 - SD_JOURNAL_SECTOR_HEADER) / sizeof(record)) + 2, sizeof(record), buffer, 64);
+    disk_cache_reset_stats();
+    Bench_Start();
+    for(uint16_t i = 0; i < samples && res == FR_OK; i++)
+    {
+        record.timestamp = i;
+        res = SD_Journal_Append(&journal, &record);
+        if(res == FR_OK)
+        {
+            res = SD_Journal_Commit(&journal);
+        }
+    }
+    cycles = Bench_Stop();
+    SD_Journal_Close(&journal);
+    disk_cache_stats(&stats);
+    printf("durable_journal,%u,%lu,%lu\n", samples, (unsigned long)stats.sectorsWritten, (unsigned long)(cycles / samples));
+
+    if(res != FR_OK)
+    {
+        printf("durable: write failed (%u)\n", res);
+    }
+}
+
+//Callback of SD_Bench_SpiQueue(): run the same descriptor again until the counter in 'context' is used up
+static void SD_Bench_QueueNext(SPI1_Xfer *xfer)
+{
+    uint16_t *left = (uint16_t *)xfer->context;
+
+    if(--*left)
+    {
+        SPI1_Queue_Submit(xfer);
+    }
+}
+
+static void SD_Bench_RunSpi(uint8_t *buffer, uint16_t size, uint8_t mode)
+{
+    static const char *const names[] = {"spi_polled", "spi_dma", "spi_queue"};
+    SPI1_Xfer xfer = {0};
+    char label[20];
+    uint16_t transfers = SD_BENCH_QUEUE_BYTES / size;
+    uint16_t left = transfers;
+    uint32_t bytes = (uint32_t)transfers * size;
+    uint32_t busCycles = bytes * 8 * (2u << (SD_SpiPrescaler >> 3)); //The SCK time alone
+    uint32_t cycles;
+    uint32_t cpuCycles;
+    uint8_t  error = 0;
+
+    snprintf(label, sizeof(label), "%s_%u", names[mode], size);
+    SPI1_DMA_WaitCycles = 0;
+
+    Bench_Start();
+    if(mode == 0)
+    {
+        for(uint16_t i = 0; i < transfers; i++)
+        {
+            GPIO_WriteBit(GPIOC, GPIO_Pin_4, Bit_RESET);
+            for(uint16_t j = 0; j < size; j++)
+            {
+                buffer[j] = SPI_TransferByte(buffer[j]);
+            }
+            GPIO_WriteBit(GPIOC, GPIO_Pin_4, Bit_SET);
+        }
+    }
+    else if(mode == 1)
+    {
+        for(uint16_t i = 0; i < transfers; i++)
+        {
+            GPIO_WriteBit(GPIOC, GPIO_Pin_4, Bit_RESET);
+            error |= SPI1_DMA_Transfer(buffer, buffer, size);
+            GPIO_WriteBit(GPIOC, GPIO_Pin_4, Bit_SET);
+        }
+    }
+    else
+    {
+        xfer.tx = buffer;
+        xfer.rx = buffer;
+        xfer.length = size;
+        xfer.csPort = GPIOC; //The SD card CS, each descriptor is one frame
+        xfer.csPin = GPIO_Pin_4;
+        xfer.callback = SD_Bench_QueueNext;
+        xfer.context = &left;
+        SPI1_Queue_Submit(&xfer);
+        error |= SPI1_Queue_Wait(&xfer);
+    }
+    cycles = Bench_Stop();
+
+    //The polled loop keeps the CPU busy all the time. With DMA the spinning in SPI1_DMA_Wait()/SPI1_Queue_Wait() is
+    //free for other work, but the queue interrupts (CS, callback, next start) run inside that spinning and are not
+    //subtracted: the _cpu line of the queue is the submit cost only, the _bus line shows what the interrupts cost.
+    cpuCycles = cycles - (mode ? SPI1_DMA_WaitCycles : 0);
+
+    Bench_PrintResult(label, transfers, bytes, cycles);
+    printf("%s_cpu,%u,%lu.%02lu\n", label, size, (unsigned long)(cpuCycles / bytes), (unsigned long)(cpuCycles % bytes * 100 / bytes));
+    printf("%s_bus,%u,%lu\n", label, size, (unsigned long)(cycles ? (uint64_t)busCycles * 100 / cycles : 0));
+
+    if(error)
+    {
+        printf("%s: transfer error!\n", label);
+    }
+}
+
+void SD_Bench_SpiQueue(uint8_t *buffer)
+{
+    static const uint16_t sizes[] = {1, 8, 64, 512};
+
+    //The card must be idle between commands, then the 0xFF bytes are ignored like the clocks of SD_WaitReady()
+    SD_WriteSessionClose();
+    SD_ReadSessionClose();
+    memset(buffer, 0xFF, 512);
+    SPI1_Queue_Init();
+    SPI_Bus_Acquire(&SD_BusDevice); //The whole run is one SD card session for the other bus devices
+
+    printf("label,transfers,bytes,cycles,cycles/transfer,KB/s\n");
+    for(uint8_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        for(uint8_t mode = 0; mode < 3; mode++)
+        {
+            SD_Bench_RunSpi(buffer, sizes[i], mode);
+        }
+    }
+
+    SPI_Bus_Release(&SD_BusDevice);
+    SPI1_DMA_SetCallback(0); //Back to the plain DMA functions of the SD driver
+}
+
+void SD_Bench_BusSwitch(void)
+{
+    static SPI_BusDevice accel; //Stays registered, without a CS pin it never touches a GPIO
+    uint32_t cycles;
+
+    SD_WriteSessionClose(); //The sessions would hold the bus
+    SD_ReadSessionClose();
+    SPI_Bus_Register(&accel, 0, 0, SPI_CPOL_High | SPI_CPHA_2Edge | SPI_FirstBit_MSB, SPI_BaudRatePrescaler_32);
+
+    printf("label,pairs,cycles,cycles/pair\n");
+
+    Bench_Start();
+    for(uint16_t i = 0; i < SD_BENCH_BUS_PAIRS; i++)
+    {
+        SPI_Bus_Acquire(&SD_BusDevice);
+        SPI_Bus_Release(&SD_BusDevice);
+    }
+    cycles = Bench_Stop();
+    printf("bus_same,%u,%lu,%lu\n", SD_BENCH_BUS_PAIRS, (unsigned long)cycles, (unsigned long)(cycles / SD_BENCH_BUS_PAIRS));
+
+    Bench_Start();
+    for(uint16_t i = 0; i < SD_BENCH_BUS_PAIRS / 2; i++)
+    {
+        SPI_Bus_Acquire(&accel); //CPOL, CPHA and BR change
+        SPI_Bus_Release(&accel);
+        SPI_Bus_Acquire(&SD_BusDevice); //And back
+        SPI_Bus_Release(&SD_BusDevice);
+    }
+    cycles = Bench_Stop();
+    printf("bus_switch,%u,%lu,%lu\n", SD_BENCH_BUS_PAIRS, (unsigned long)cycles, (unsigned long)(cycles / SD_BENCH_BUS_PAIRS));
+
+    SPI_Bus_Acquire(&SD_BusDevice); //Leave SPI1 in the SD mode
+    SPI_Bus_Release(&SD_BusDevice);
+}
@@ -0,0 +1,98 @@
+//sd_bench.h - Throughput benchmarks for the SD card driver
+#ifndef SD_BENCH_H
+#define SD_BENCH_H
+
+#include <stdint.h>
+
+//Read (and optionally write) 'sectors' single sectors starting at 'sector', first with polling, then with DMA.
+//Prints "label,sectors,bytes,cycles,cycles/sector,KB/s" and "label_cpu,cpu cycles/sector" lines over USART1.
+//WARNING: write != 0 overwrites the selected sectors, use a scratch card or an unused area!
+void SD_Bench_TransferModes(uint8_t *buffer, uint32_t sector, uint16_t sectors, uint8_t write);
+
+//Sequential single-sector writes (FatFs append pattern) with the CMD25 write session off, then on, then on again after
+//SD_Erase() of the sectors ("erase,sectors,cycles" line). Prints the throughput line plus "label_max,worst sector latency
+//in cycles". OVERWRITES the sectors!
+void SD_Bench_WriteSession(uint8_t *buffer, uint32_t sector, uint16_t sectors);
+
+//Sequential single-sector reads with the CMD18 read session off, then on.
+void SD_Bench_ReadSession(uint8_t *buffer, uint32_t sector, uint16_t sectors);
+
+//Read a whole file in 512-byte f_read() chunks with the CMD18 read session off, then on (the volume must be mounted).
+void SD_Bench_FileRead(const char *path, uint8_t *buffer);
+
+//Scan a whole file in small f_read() chunks (every sector goes through the FatFs window, like f_gets()),
+//with the diskio read-ahead off, then on. 'chunk' bytes of 'buffer' are used.
+void SD_Bench_FileScan(const char *path, uint8_t *buffer, uint16_t chunk);
+
+//Benchmark suite settings
+#define SD_BENCH_APPEND_BYTES   8192 //Bytes appended with every record size of SD_Bench_FileSuite()
+#define SD_BENCH_OPEN_CYCLES    32   //f_open() + f_lseek() + f_close() cycles of SD_Bench_FileSuite()
+#define SD_BENCH_LOG_STEP_KB    256  //SD_Bench_LogGrowth() prints one line per this much log data
+#define SD_BENCH_LOG_SYNC       16   //SD_Log f_sync() cadence (samples) of SD_Bench_LogGrowth()
+#define SD_BENCH_INDEX_STEPS    4    //SD_Bench_IndexLookup() measures after every 1/4 of the records
+
+//Raw sequential transfers of 1, 4, 8 and 32 sectors (CMD17/CMD24 for one sector, CMD18/CMD25 for more), 'sectors' sectors
+//in total for each size, with a latency histogram per transfer size. The same 512-byte buffer is sent/received for every
+//block of a transfer, so the bus traffic is the same as SD_ReadDisk()/SD_WriteDisk() without a 16 kB buffer.
+//Prints result lines ("raw_read_8,...") and histogram lines ("hist,raw_read_8,..."). write != 0 OVERWRITES the sectors!
+void SD_Bench_RawSuite(uint8_t *buffer, uint32_t sector, uint16_t sectors, uint8_t write);
+
+//File level suite (the volume must be mounted): appends 16, 64 and 512-byte records to 'path' with f_write(),
+//then measures f_open() + f_lseek(end) + f_close() cycles on the same file. The file is overwritten.
+void SD_Bench_FileSuite(const char *path, uint8_t *buffer);
+
+//Per-sample cost of a growing log: f_open() + f_lseek(end) + f_write() + f_close() per sample (the old main.c loop),
+//then SD_Log with the file kept open. Writes 'totalKB' kB of 'sampleSize'-byte samples to 'path' (overwritten) in both
+//modes and prints "label,file_kb,cycles/sample" after every SD_BENCH_LOG_STEP_KB kB.
+void SD_Bench_LogGrowth(const char *path, uint8_t *buffer, uint16_t totalKB, uint16_t sampleSize);
+
+//32-byte samples through SD_Log (f_write(), f_sync() every 'checkpointSectors' sectors) and through SD_RawLog
+//(preallocated, raw sector writes, checkpoint every 'checkpointSectors' sectors), 'totalKB' kB each, 'path' is overwritten.
+//Prints the result line, a per-sample latency histogram and "label_sectors,card sectors written" for both.
+void SD_Bench_StreamLog(const char *path, uint8_t *buffer, uint16_t totalKB, uint16_t checkpointSectors);
+
+//'samples' temperature samples as ASCII lines (snprintf() like printFloatTemp() in main.c, through SD_Log) and as
+//SD_BinLog records, into 'textPath' and 'binPath' (both overwritten). Prints the result line, "label_cpu,cycles/sample"
+//for the formatting/packing alone (binary: averaged over the appends that only pack, the ones that complete a frame
+//also write it) and "label_bytes,bytes/sample" of the file.
+void SD_Bench_RecordFormats(const char *textPath, const char *binPath, uint8_t *buffer, uint16_t samples);
+
+//Append 'records' 8-byte records to a ring log of 'dataSectors' sectors at 'path' (created, or reused with the same size),
+//then read back the newest 16 records a few times. Prints the append result line, the per-append latency histogram
+//and "ring_read_last,records,cycles/query".
+void SD_Bench_RingLog(const char *path, uint8_t *buffer, uint32_t dataSectors, uint32_t records);
+
+//Time-range lookup in a text log ("timestamp,value" lines through SD_Log_WriteStamped()) with a sparse SD_Index sidecar
+//(one entry per 'interval' lines) against an f_gets() scan from the start. 'records' lines are written to 'logPath' in
+//SD_BENCH_INDEX_STEPS steps (log and 'indexPath' are overwritten), after every step both find the first line after
+//3/4 of the log time. Prints "label,log_records,index_entries,sectors_read,cycles/lookup".
+void SD_Bench_IndexLookup(const char *logPath, const char *indexPath, uint32_t records, uint16_t interval);
+
+//Read 'path' line by line with f_gets() (64-byte line buffer), then with SD_LineReader on 64 and 512 bytes of 'buffer'.
+//Prints "label,lines,bytes,cycles,cycles/line,KB/s" and "label_cycles_per_kb,cycles per kB of file" for all three.
+void SD_Bench_LineRead(const char *path, uint8_t *buffer);
+
+//'sectors' sectors of 'sampleSize'-byte samples (at most 16) through SD_Capture into a preallocated log at 'path'
+//(overwritten, checkpoint every 'checkpointSectors' sectors). The samples are produced instantly, so every sector write
+//is timed: prints the result line, the per-sector histogram and "capture_rate,sample_size,no-loss samples/s (worst
+//sector write),samples/s (average)". Above the first rate a double buffer can drop samples, above the second one any can.
+void SD_Bench_Capture(const char *path, uint8_t *buffer0, uint8_t *buffer1, uint32_t sectors, uint16_t sampleSize, uint16_t checkpointSectors);
+
+//'samples' records made durable one at a time: reopen + close, f_sync() per sample and SD_Journal commits.
+//'journalPath' must not be a plain file (an existing journal with another record size is refused)
+void SD_Bench_Durability(const char *path, const char *journalPath, uint8_t *buffer, uint16_t samples);
+
+#define SD_BENCH_QUEUE_BYTES    4096 //Bytes clocked per transfer size and mode of SD_Bench_SpiQueue()
+
+//Raw SPI1 transfers of 1/8/64/512 bytes with CS around each one: polled SPI_TransferByte(), blocking SPI1_DMA_Transfer()
+//and the spi_queue.h descriptor chain (the callback submits the next transfer). The card is selected but only sees 0xFF.
+//Prints the result line plus "label_cpu,size,cpu cycles/byte" and "label_bus,size,% of the time the clock runs".
+void SD_Bench_SpiQueue(uint8_t *buffer);
+
+#define SD_BENCH_BUS_PAIRS      1000 //Acquire/release pairs of SD_Bench_BusSwitch()
+
+//Cost of the spi_bus.h arbiter: acquire + release of the SD card again and again (no CTLR1 change), then alternating with
+//an ADXL345 preset (CPOL high, 2nd edge, /32, no CS pin). Prints "label,pairs,cycles,cycles/pair".
+void SD_Bench_BusSwitch(void);
+
+#endif //SD_BENCH_H
@@ -0,0 +1,272 @@
+#include "sd_binlog.h"
+#include <string.h>
+
+static void SD_BinLog_Put16(uint8_t *p, uint16_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void SD_BinLog_Put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint8_t SD_BinLog_FrameValid(const uint8_t *frame) //1 - magic, version and CRC match
+{
+    uint16_t crc;
+
+    if(frame[0] != (SD_BINLOG_MAGIC & 0xFF) || frame[1] != (SD_BINLOG_MAGIC >> 8) || frame[2] != SD_BINLOG_VERSION)
+    {
+        return 0;
+    }
+
+    crc = SD_BinLog_Crc16(0, frame, 10);
+    crc = SD_BinLog_Crc16(crc, (const uint8_t *)"\0\0", 2);
+    crc = SD_BinLog_Crc16(crc, &frame[SD_BINLOG_HEADER_SIZE], SD_BINLOG_FRAME_SIZE - SD_BINLOG_HEADER_SIZE);
+    return crc == (frame[10] | ((uint16_t)frame[11] << 8));
+}
+
+static void SD_BinLog_NewFrame(SD_BinLog *log)
+{
+    memset(log->frame, 0, SD_BINLOG_FRAME_SIZE);
+    log->count = 0;
+    log->latest = SD_BINLOG_SLOT_NONE;
+}
+
+//Header + CRC, then write the frame into its own slot or into the shadow slot after it (a whole aligned sector: FatFs
+//passes it straight to disk_write())
+static FRESULT SD_BinLog_WriteFrame(SD_BinLog *log, uint8_t shadow)
+{
+    uint8_t *frame = log->frame;
+    FRESULT res;
+    UINT written;
+
+    SD_BinLog_Put16(&frame[0], SD_BINLOG_MAGIC);
+    frame[2] = SD_BINLOG_VERSION;
+    frame[3] = sizeof(SD_BinRecord);
+    SD_BinLog_Put32(&frame[4], log->sequence | (shadow ? SD_BINLOG_SHADOW : 0));
+    SD_BinLog_Put16(&frame[8], log->count);
+    SD_BinLog_Put16(&frame[10], 0);
+    SD_BinLog_Put16(&frame[10], SD_BinLog_Crc16(0, frame, SD_BINLOG_FRAME_SIZE));
+
+    res = f_lseek(&log->file, log->position + (shadow ? SD_BINLOG_FRAME_SIZE : 0)); //No-op for a new frame
+    if(res == FR_OK)
+    {
+        res = f_write(&log->file, frame, SD_BINLOG_FRAME_SIZE, &written);
+        if(res == FR_OK && written < SD_BINLOG_FRAME_SIZE)
+        {
+            res = FR_DENIED; //Volume is full
+        }
+    }
+    return res;
+}
+
+//Read the frame at 'offset' into the buffer, 'found' = record count + 1 if it is valid (sequence and count loaded), else 0
+static FRESULT SD_BinLog_ReadFrame(SD_BinLog *log, FSIZE_t offset, uint16_t *found)
+{
+    uint8_t *frame = log->frame;
+    FRESULT res;
+    UINT readBytes;
+
+    *found = 0;
+    res = f_lseek(&log->file, offset);
+    if(res == FR_OK)
+    {
+        res = f_read(&log->file, frame, SD_BINLOG_FRAME_SIZE, &readBytes);
+    }
+    if(res == FR_OK && readBytes == SD_BINLOG_FRAME_SIZE && SD_BinLog_FrameValid(frame))
+    {
+        log->sequence = frame[4] | ((uint32_t)frame[5] << 8) | ((uint32_t)frame[6] << 16) | ((uint32_t)frame[7] << 24);
+        log->count = frame[8] | ((uint16_t)frame[9] << 8);
+        *found = log->count + 1;
+    }
+    return res;
+}
+
+FRESULT SD_BinLog_Open(SD_BinLog *log, const char *path, uint8_t *frameBuffer, uint16_t syncFrames)
+{
+    FRESULT res;
+    FSIZE_t size;
+    uint32_t lastSequence;
+    uint16_t last;
+    uint16_t own;
+
+    log->isOpen = 0;
+    log->frame = frameBuffer;
+    log->syncFrames = syncFrames;
+    log->frames = 0;
+    log->sequence = 0;
+    log->latest = SD_BINLOG_SLOT_NONE;
+
+    res = f_open(&log->file, path, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+    if(res != FR_OK)
+    {
+        return res;
+    }
+
+    size = f_size(&log->file);
+    log->position = size - (size % SD_BINLOG_FRAME_SIZE); //A torn tail (not a whole frame) gets overwritten
+
+    if(log->position)
+    {
+        res = SD_BinLog_ReadFrame(log, log->position - SD_BINLOG_FRAME_SIZE, &last);
+        if(res == FR_OK && last && !(log->sequence & SD_BINLOG_SHADOW))
+        {
+            log->position -= SD_BINLOG_FRAME_SIZE; //The last frame is in its own slot
+            log->latest = SD_BINLOG_SLOT_OWN;
+        }
+        else if(res == FR_OK && log->position >= 2 * SD_BINLOG_FRAME_SIZE)
+        {
+            //A shadow copy or a torn frame at the end: the own slot of the frame is the one before it
+            lastSequence = log->sequence;
+            res = SD_BinLog_ReadFrame(log, log->position - 2 * SD_BINLOG_FRAME_SIZE, &own);
+            if((log->sequence & SD_BINLOG_SHADOW) || (last && (log->sequence | SD_BINLOG_SHADOW) != lastSequence))
+            {
+                own = 0; //Not a copy of the same frame
+            }
+
+            if(res == FR_OK && last > own)
+            {
+                res = SD_BinLog_ReadFrame(log, log->position - SD_BINLOG_FRAME_SIZE, &last); //The own read replaced the buffer
+                log->position -= 2 * SD_BINLOG_FRAME_SIZE;
+                log->latest = SD_BINLOG_SLOT_SHADOW;
+            }
+            else if(own)
+            {
+                log->position -= 2 * SD_BINLOG_FRAME_SIZE;
+                log->latest = SD_BINLOG_SLOT_OWN;
+            }
+        }
+
+        if(res == FR_OK && log->latest != SD_BINLOG_SLOT_NONE)
+        {
+            log->sequence &= ~SD_BINLOG_SHADOW;
+            if(log->count < SD_BINLOG_RECORDS_PER_FRAME)
+            {
+                log->isOpen = 1;
+                return FR_OK; //Keep filling the flushed partial frame
+            }
+
+            if(log->latest == SD_BINLOG_SLOT_SHADOW)
+            {
+                res = SD_BinLog_WriteFrame(log, 0); //The cut hit the own slot of a full frame: repair it
+            }
+            log->position += SD_BINLOG_FRAME_SIZE;
+            log->sequence++;
+        }
+        else
+        {
+            log->sequence = log->position / SD_BINLOG_FRAME_SIZE; //Damaged last frame: keep the numbers unique anyway
+        }
+
+        if(res != FR_OK)
+        {
+            f_close(&log->file);
+            return res;
+        }
+    }
+
+    SD_BinLog_NewFrame(log);
+    log->isOpen = 1;
+    return FR_OK;
+}
+
+FRESULT SD_BinLog_Append(SD_BinLog *log, uint32_t timestamp, uint8_t channel, int16_t value, uint8_t flags)
+{
+    uint8_t *record;
+    FRESULT res = FR_OK;
+
+    if(!log->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    record = &log->frame[SD_BINLOG_HEADER_SIZE + log->count * sizeof(SD_BinRecord)];
+    SD_BinLog_Put32(&record[0], timestamp);
+    SD_BinLog_Put16(&record[4], (uint16_t)value);
+    record[6] = channel;
+    record[7] = flags;
+    log->count++;
+
+    if(log->count < SD_BINLOG_RECORDS_PER_FRAME)
+    {
+        return FR_OK; //No division, no formatting, just 8 bytes copied
+    }
+
+    if(log->latest == SD_BINLOG_SLOT_OWN)
+    {
+        res = SD_BinLog_WriteFrame(log, 1); //The own slot holds the last flush: keep a full copy in the shadow first
+        if(res == FR_OK)
+        {
+            res = f_sync(&log->file); //...on the card and inside the file size before the own slot changes
+        }
+    }
+    if(res == FR_OK)
+    {
+        res = SD_BinLog_WriteFrame(log, 0);
+    }
+    if(res != FR_OK)
+    {
+        log->count--; //Drop the record, the frame stays consistent
+        return res;
+    }
+
+    log->position += SD_BINLOG_FRAME_SIZE; //The next frame overwrites the shadow slot
+    log->sequence++;
+    SD_BinLog_NewFrame(log);
+
+    if(log->syncFrames && ++log->frames >= log->syncFrames)
+    {
+        log->frames = 0;
+        res = f_sync(&log->file);
+    }
+    return res;
+}
+
+FRESULT SD_BinLog_Flush(SD_BinLog *log)
+{
+    FRESULT res = FR_OK;
+    uint8_t shadow;
+
+    if(!log->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    if(log->count)
+    {
+        shadow = (log->latest == SD_BINLOG_SLOT_OWN); //Never overwrite the newest good copy
+        res = SD_BinLog_WriteFrame(log, shadow); //Same sequence, the full frame replaces both copies later
+        if(res == FR_OK)
+        {
+            log->latest = shadow ? SD_BINLOG_SLOT_SHADOW : SD_BINLOG_SLOT_OWN;
+        }
+    }
+
+    log->frames = 0;
+    if(res == FR_OK)
+    {
+        res = f_sync(&log->file);
+    }
+    return res;
+}
+
+FRESULT SD_BinLog_Close(SD_BinLog *log)
+{
+    FRESULT res;
+    FRESULT closeRes;
+
+    if(!log->isOpen)
+    {
+        return FR_OK;
+    }
+
+    res = SD_BinLog_Flush(log);
+    log->isOpen = 0;
+    closeRes = f_close(&log->file);
+    return (res != FR_OK) ? res : closeRes;
+}
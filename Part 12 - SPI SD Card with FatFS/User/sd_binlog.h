@@ -0,0 +1,77 @@
+//sd_binlog.h - Binary record log: fixed-size timestamped records packed into self-checking 512-byte frames
+#ifndef SD_BINLOG_H
+#define SD_BINLOG_H
+
+#include "ff.h"
+
+//Frame layout (little-endian, one frame = one sector of the file):
+//  0  uint16 magic        SD_BINLOG_MAGIC
+//  2  uint8  version      SD_BINLOG_VERSION
+//  3  uint8  recordSize   sizeof(SD_BinRecord)
+//  4  uint32 sequence     frame number, +1 for every frame (| SD_BINLOG_SHADOW: copy in the slot after its own)
+//  8  uint16 count        valid records in the frame
+// 10  uint16 crc          CRC-16/CCITT of the whole frame, computed with this field = 0
+// 12  records             count * recordSize bytes, the rest of the frame is 0
+//Every frame can be checked on its own, so a power cut costs at most the frame that was being written.
+//A partially filled frame is written by SD_BinLog_Flush() alternately into its own slot and into the next one (the
+//shadow slot, sequence | SD_BINLOG_SHADOW), like the partial sector of sd_journal.h, so a write torn by the power cut
+//leaves the previous flush intact and only the records appended since then are lost. When a frame that was flushed
+//into its own slot fills up, its full copy goes to the shadow slot and f_sync() first (the file size must cover it),
+//then into the own slot. The next frame overwrites the shadow slot. A reader takes a shadow frame that follows a frame with the same sequence as a newer copy of it:
+//records only get appended, so the records past the count of the earlier copy are the new ones.
+//The directory entry can reach the card before the data (diskio.c cache), so the file may end in a slot that was never
+//written: readers check the magic as well as the CRC (an all-zero sector has a matching CRC).
+
+#define SD_BINLOG_MAGIC         0x4C42 //"BL"
+#define SD_BINLOG_VERSION       1
+#define SD_BINLOG_FRAME_SIZE    512
+#define SD_BINLOG_HEADER_SIZE   12
+#define SD_BINLOG_SHADOW        0x80000000 //Sequence flag of a partial frame flushed into the slot after its own
+
+#define SD_BINLOG_SLOT_NONE     0 //Nothing flushed of the frame being filled yet
+#define SD_BINLOG_SLOT_OWN      1
+#define SD_BINLOG_SLOT_SHADOW   2
+
+typedef struct
+{
+    uint32_t timestamp;     //Milliseconds
+    int16_t  value;         //Raw sample (DS18B20: 1/16 degC)
+    uint8_t  channel;       //Sensor / value type
+    uint8_t  flags;         //Application defined, passed to SD_BinLog_Append()
+} SD_BinRecord;             //8 bytes, no padding
+
+#define SD_BINLOG_RECORDS_PER_FRAME ((SD_BINLOG_FRAME_SIZE - SD_BINLOG_HEADER_SIZE) / sizeof(SD_BinRecord)) //62
+
+typedef struct
+{
+    FIL      file;
+    uint8_t *frame;         //512-byte frame buffer, owned by the log while it is open
+    uint32_t sequence;      //Sequence number of the frame being filled
+    FSIZE_t  position;      //File offset of the frame being filled (its own slot)
+    uint16_t count;         //Records in the frame
+    uint16_t syncFrames;    //f_sync() after this many complete frames (0: only SD_BinLog_Flush()/Close())
+    uint16_t frames;        //Complete frames since the last f_sync()
+    uint8_t  latest;        //SD_BINLOG_SLOT_x holding the newest flushed copy of the frame being filled
+    uint8_t  isOpen;        //1 - file is open
+} SD_BinLog;
+
+//CRC-16/CCITT (poly 0x1021, init 0), also used by the PC decoder
+static inline uint16_t SD_BinLog_Crc16(uint16_t crc, const uint8_t *data, uint16_t length)
+{
+    for(uint16_t i = 0; i < length; i++)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for(uint8_t bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+        }
+    }
+    return crc;
+}
+
+FRESULT SD_BinLog_Open(SD_BinLog *log, const char *path, uint8_t *frameBuffer, uint16_t syncFrames); //Opens or creates, continues the sequence
+FRESULT SD_BinLog_Append(SD_BinLog *log, uint32_t timestamp, uint8_t channel, int16_t value, uint8_t flags);
+FRESULT SD_BinLog_Flush(SD_BinLog *log); //Write the partial frame into the slot without the newest copy and sync
+FRESULT SD_BinLog_Close(SD_BinLog *log);
+
+#endif //SD_BINLOG_H
@@ -0,0 +1,164 @@
+#include "sd_boot.h"
+#include "sd.h"
+#include "diskio.h"
+#include "sd_binlog.h"
+#include <stddef.h>
+#include <string.h>
+
+#ifndef SD_BOOT_IMAGE_END
+extern uint8_t _data_lma[], _data_vma[], _edata[]; //Link.ld: flash copy of .data, its place in RAM and its end
+#define SD_BOOT_IMAGE_END ((uint32_t)_data_lma + (uint32_t)(_edata - _data_vma)) //The startup code copies .data from here
+#endif
+
+uint8_t SD_Boot_Status = SD_BOOT_COLD;
+static uint8_t sdBootCid[16]; //CID read by SD_Boot_Init(), written into the cache by SD_Boot_Mount()
+
+static uint16_t SD_Boot_Crc(const SD_BootCache *cache)
+{
+    return SD_BinLog_Crc16(0, (const uint8_t *)cache, offsetof(SD_BootCache, crc));
+}
+
+uint8_t SD_Boot_PageFree(void)
+{
+    return SD_BOOT_IMAGE_END <= SD_BOOT_FLASH_ADDR;
+}
+
+//Copy the flash page, 1 - it holds a valid cache
+static uint8_t SD_Boot_Load(SD_BootCache *cache)
+{
+    if(!SD_Boot_PageFree())
+    {
+        return 0; //The page holds the end of the program
+    }
+    memcpy(cache, SD_BOOT_FLASH_PTR, sizeof(SD_BootCache));
+    return cache->magic == SD_BOOT_MAGIC && cache->version == SD_BOOT_VERSION && cache->crc == SD_Boot_Crc(cache);
+}
+
+static void SD_Boot_Write(const SD_BootCache *cache)
+{
+    const uint32_t *words = (const uint32_t *)cache;
+
+    if(!SD_Boot_PageFree())
+    {
+        return; //Erasing the page would erase code
+    }
+
+    FLASH_Unlock_Fast();
+    FLASH_ErasePage_Fast(SD_BOOT_FLASH_ADDR);
+    if(cache)
+    {
+        FLASH_BufReset();
+        for(uint8_t i = 0; i < SD_BOOT_PAGE / 4; i++)
+        {
+            FLASH_BufLoad(SD_BOOT_FLASH_ADDR + 4 * i, words[i]);
+        }
+        FLASH_ProgramPage_Fast(SD_BOOT_FLASH_ADDR);
+    }
+    FLASH_Lock_Fast();
+}
+
+void SD_Boot_Forget(void)
+{
+    SD_Boot_Write(0);
+}
+
+static uint8_t SD_Boot_Start(uint8_t *buffer, uint8_t useCache)
+{
+    SD_BootCache cache;
+    SD_SpeedResult results[7];
+    uint8_t steps;
+    uint8_t result;
+
+    SD_Boot_Status = SD_BOOT_COLD;
+
+    result = SD_InitializeCard(); //The only part that can't be skipped: the card decides when it is ready
+    if(result)
+    {
+        return result;
+    }
+    if(SD_GetCID(buffer))
+    {
+        return 1;
+    }
+    memcpy(sdBootCid, buffer, sizeof(sdBootCid));
+
+    if(useCache && SD_Boot_Load(&cache) && cache.type == SD_Type && memcmp(cache.cid, sdBootCid, sizeof(sdBootCid)) == 0)
+    {
+        SD_Info.sectors = cache.sectors; //Same card: the CSD, the SD status and the working clock are known
+        SD_Info.auSectors = cache.auSectors;
+        SD_Info.eraseBlockEn = cache.eraseBlockEn;
+        SD_SpiPrescaler = cache.prescaler;
+        SD_Boot_Status = SD_BOOT_CACHED;
+    }
+    else
+    {
+        if(SD_ReadCardInfo())
+        {
+            return 1;
+        }
+        SD_TuneSpeed(buffer, 0, results, &steps); //Stays at the init clock if nothing faster works
+    }
+
+    SD_HighSpeed();
+    disk_mark_ready(); //f_mount() must not start the card again
+    return 0;
+}
+
+uint8_t SD_Boot_Init(uint8_t *buffer)
+{
+    return SD_Boot_Start(buffer, 1);
+}
+
+FRESULT SD_Boot_Mount(FATFS *fs)
+{
+    SD_BootCache stored;
+    SD_BootCache cache;
+    uint8_t valid;
+    FRESULT result;
+
+    result = f_mount(fs, "0:", 1);
+    if(result != FR_OK && SD_Boot_Status == SD_BOOT_CACHED)
+    {
+        //The cached clock doesn't work any more (or the card was swapped for an identical one): measure everything again.
+        //The window buffer is free, nothing is mounted.
+        if(SD_Boot_Start(fs->win, 0) == 0)
+        {
+            result = f_mount(fs, "0:", 1);
+        }
+    }
+    if(result != FR_OK)
+    {
+        return result;
+    }
+
+    memset(&cache, 0xFF, sizeof(cache));
+    cache.magic = SD_BOOT_MAGIC;
+    cache.version = SD_BOOT_VERSION;
+    memcpy(cache.cid, sdBootCid, sizeof(sdBootCid));
+    cache.sectors = SD_Info.sectors;
+    cache.auSectors = SD_Info.auSectors;
+    cache.type = SD_Type;
+    cache.prescaler = SD_SpiPrescaler;
+    cache.eraseBlockEn = SD_Info.eraseBlockEn;
+    cache.fsType = fs->fs_type;
+    cache.csize = fs->csize;
+    cache.nFatent = fs->n_fatent;
+    cache.fsize = fs->fsize;
+    cache.volbase = fs->volbase;
+    cache.fatbase = fs->fatbase;
+    cache.database = fs->database;
+    cache.crc = SD_Boot_Crc(&cache);
+
+    valid = SD_Boot_Load(&stored);
+    if(valid && memcmp(&stored, &cache, sizeof(cache)) == 0)
+    {
+        return FR_OK; //Nothing changed, no flash write
+    }
+
+    if(SD_Boot_Status == SD_BOOT_CACHED)
+    {
+        SD_Boot_Status = SD_BOOT_CHANGED; //The card matched, the volume didn't
+    }
+    SD_Boot_Write(&cache); //Only after a change, the page is good for about 10k erase cycles
+    return FR_OK;
+}
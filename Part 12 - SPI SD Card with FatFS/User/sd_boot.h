@@ -0,0 +1,67 @@
+//sd_boot.h - Fast start: the card and volume parameters of the last start are kept in flash and only checked
+#ifndef SD_BOOT_H
+#define SD_BOOT_H
+
+#include "sd.h"
+#include "ff.h"
+
+//A cold start reads everything again: ACMD41 init, CSD and SD status (SD_ReadCardInfo()), the SD_TuneSpeed() steps,
+//then f_mount() initializes the card a second time. The card needs its own time to leave the idle state (tens to
+//hundreds of ms), the rest is work that gives the same result at every start with the same card.
+//  SD_Boot_Init()   ACMD41 init at the fastest legal init clock, then the CID. If it is the card of the cache, the type,
+//                   geometry and tuned data clock come from flash. disk_initialize() of the next f_mount() only sends CMD13.
+//  SD_Boot_Mount()  f_mount(), then the volume (FAT type, cluster size, FAT and data start, clusters) is compared with
+//                   the cache. The flash page is only rewritten when something changed: first start, other card,
+//                   reformatted card. If the mount fails with the cached parameters, the card is measured again.
+//FatFs still reads the boot sector: the cache confirms the volume, it doesn't replace the checks of ff.c.
+
+//The program must end before SD_BOOT_FLASH_ADDR. The stock Link.ld gives it the whole flash, so nothing stops a growing
+//program from reaching into the page. SD_Boot_PageFree() checks the end of the image (code + initial values of .data,
+//SD_BOOT_IMAGE_END, from the Link.ld symbols) at run time: if it overlaps, the cache is neither read nor written and
+//every start is a cold one. Shrinking FLASH in Link.ld by 64 bytes makes the linker enforce it instead.
+#ifndef SD_BOOT_FLASH_ADDR
+#define SD_BOOT_FLASH_ADDR  0x08003FC0 //Last 64-byte page of the 16 kB flash
+#endif
+#ifndef SD_BOOT_FLASH_PTR
+#define SD_BOOT_FLASH_PTR   ((const void *)SD_BOOT_FLASH_ADDR) //The flash is memory mapped, the cache is read in place
+#endif
+#define SD_BOOT_PAGE        64 //Fast page erase/program size of the CH32V003
+#define SD_BOOT_MAGIC       0x544F4F42 //"BOOT"
+#define SD_BOOT_VERSION     1
+
+//SD_Boot_Status
+#define SD_BOOT_COLD        0 //Everything was read from the card (no valid cache, other card, or the cache failed)
+#define SD_BOOT_CACHED      1 //Card parameters and volume matched the cache
+#define SD_BOOT_CHANGED     2 //Same card, but the volume differs from the cache (reformatted): the cache was rewritten
+
+typedef struct
+{
+    uint32_t magic;         //SD_BOOT_MAGIC, the erased flash reads 0xE339E339
+    uint8_t  cid[16];       //Card identification: manufacturer, product, serial number
+    uint32_t sectors;       //SD_Info
+    uint32_t auSectors;
+    uint8_t  type;          //SD_Type
+    uint8_t  prescaler;     //SD_SpiPrescaler found by SD_TuneSpeed()
+    uint8_t  eraseBlockEn;
+    uint8_t  fsType;        //Volume: FS_FAT12/16/32
+    uint16_t csize;         //Sectors per cluster
+    uint16_t version;       //SD_BOOT_VERSION
+    uint32_t nFatent;       //Clusters + 2
+    uint32_t fsize;         //Sectors per FAT
+    uint32_t volbase;       //Volume start sector
+    uint32_t fatbase;       //FAT start sector
+    uint32_t database;      //Data area start sector
+    uint8_t  reserved[6];
+    uint16_t crc;           //CRC-16 of the bytes before it
+} SD_BootCache;             //One flash page
+
+extern uint8_t SD_Boot_Status; //SD_BOOT_... of the last SD_Boot_Init() / SD_Boot_Mount()
+
+//Initialize the card and leave SPI1 at the data clock. 'buffer': 512 bytes for the CID and SD_TuneSpeed() (the FatFs
+//window is free before the mount). 0 - ok, else the error of SD_InitializeCard().
+uint8_t SD_Boot_Init(uint8_t *buffer);
+FRESULT SD_Boot_Mount(FATFS *fs); //Mount "0:" after SD_Boot_Init() and update the cache
+uint8_t SD_Boot_PageFree(void); //1 - the program ends before SD_BOOT_FLASH_ADDR, 0 - the cache is not used
+void SD_Boot_Forget(void); //Erase the cache, the next start is a cold one
+
+#endif //SD_BOOT_H
@@ -0,0 +1,97 @@
+#include "sd_capture.h"
+#include <string.h>
+
+void SD_Capture_Init(SD_Capture *capture, SD_RawLog *log, uint8_t *buffer0, uint8_t *buffer1, uint16_t sampleSize)
+{
+    capture->buffer[0] = buffer0;
+    capture->buffer[1] = buffer1;
+    capture->log = log;
+    capture->sampleSize = sampleSize;
+    capture->fill = 0;
+    capture->active = 0;
+    capture->full = 0;
+    capture->samples = 0;
+    capture->overruns = 0;
+    capture->sectors = 0;
+}
+
+//Hand the active buffer to the main loop and continue in the other one (only while that one is free)
+static void SD_Capture_Swap(SD_Capture *capture, uint16_t fill)
+{
+    if(fill < SD_CAPTURE_SECTOR)
+    {
+        memset(&capture->buffer[capture->active][fill], 0, SD_CAPTURE_SECTOR - fill);
+    }
+    capture->full = 1;
+    capture->active ^= 1;
+    capture->fill = 0;
+}
+
+uint8_t SD_Capture_Put(SD_Capture *capture, const void *sample)
+{
+    uint16_t fill = capture->fill;
+
+    if(fill + capture->sampleSize > SD_CAPTURE_SECTOR)
+    {
+        if(capture->full)
+        {
+            capture->overruns++; //The main loop is still writing the other buffer
+            return 0;
+        }
+        SD_Capture_Swap(capture, fill);
+        fill = 0;
+    }
+
+    memcpy(&capture->buffer[capture->active][fill], sample, capture->sampleSize);
+    fill += capture->sampleSize;
+    capture->samples++;
+
+    if(fill + capture->sampleSize > SD_CAPTURE_SECTOR && !capture->full)
+    {
+        SD_Capture_Swap(capture, fill); //Swap right away, the write can start before the next sample
+    }
+    else
+    {
+        capture->fill = fill;
+    }
+    return 1;
+}
+
+FRESULT SD_Capture_Service(SD_Capture *capture)
+{
+    FRESULT res;
+
+    if(!capture->full)
+    {
+        return FR_OK;
+    }
+
+    //The interrupt only touches buffer[active] while full is set, the other buffer belongs to us until it is cleared
+    res = SD_RawLog_WriteSector(capture->log, capture->buffer[capture->active ^ 1], SD_CAPTURE_SECTOR);
+    if(res == FR_OK)
+    {
+        capture->sectors++;
+        capture->full = 0;
+    }
+    return res; //On an error the buffer stays full and the interrupt counts overruns
+}
+
+FRESULT SD_Capture_Stop(SD_Capture *capture)
+{
+    FRESULT res;
+    FRESULT closeRes;
+
+    res = SD_Capture_Service(capture);
+    if(res == FR_OK && capture->fill)
+    {
+        res = SD_RawLog_WriteSector(capture->log, capture->buffer[capture->active], capture->fill); //Partial last sector
+        if(res == FR_OK)
+        {
+            capture->sectors++;
+            capture->fill = 0;
+        }
+    }
+
+    closeRes = SD_RawLog_Close(capture->log);
+    return (res != FR_OK) ? res : closeRes;
+}
@@ -0,0 +1,35 @@
+//sd_capture.h - Double-buffered acquisition: an interrupt fills one sector buffer while the main loop writes the other
+#ifndef SD_CAPTURE_H
+#define SD_CAPTURE_H
+
+#include "sd_rawlog.h"
+
+//A sector write blocks for milliseconds while the card is busy, so samples cannot be written from the interrupt that
+//takes them. SD_Capture_Put() (interrupt) copies the sample into the active sector buffer; when it is full the buffers
+//are swapped and SD_Capture_Service() (main loop) writes the full one to a preallocated SD_RawLog with disk_write().
+//No sample is lost as long as every sector write finishes before the other buffer fills up:
+//  max rate = (512 / sampleSize) / worst sector write time
+//Otherwise SD_Capture_Put() drops the sample and counts an overrun.
+//Every sector holds 512 / sampleSize samples, the rest of it is 0 (choose a sample size that divides 512).
+
+#define SD_CAPTURE_SECTOR   512
+
+typedef struct
+{
+    uint8_t          *buffer[2];    //Two 512-byte sector buffers
+    SD_RawLog        *log;          //Open preallocated log, written with SD_RawLog_WriteSector()
+    uint16_t          sampleSize;   //Bytes per sample
+    volatile uint16_t fill;         //Bytes in the active buffer
+    volatile uint8_t  active;       //Buffer the interrupt fills
+    volatile uint8_t  full;         //1 - buffer[active ^ 1] waits for SD_Capture_Service()
+    volatile uint32_t samples;      //Samples stored
+    volatile uint32_t overruns;     //Samples dropped because both buffers were full
+    uint32_t          sectors;      //Sectors written
+} SD_Capture;
+
+void SD_Capture_Init(SD_Capture *capture, SD_RawLog *log, uint8_t *buffer0, uint8_t *buffer1, uint16_t sampleSize);
+uint8_t SD_Capture_Put(SD_Capture *capture, const void *sample); //Interrupt side: 1 - stored, 0 - dropped (overrun)
+FRESULT SD_Capture_Service(SD_Capture *capture); //Main loop side: writes the full buffer if there is one
+FRESULT SD_Capture_Stop(SD_Capture *capture); //Call after the producer is stopped: writes the rest, closes the log
+
+#endif //SD_CAPTURE_H
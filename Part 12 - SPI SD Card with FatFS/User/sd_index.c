@@ -0,0 +1,158 @@
+#include "sd_index.h"
+
+FRESULT SD_Index_Open(SD_Index *index, const char *path, uint16_t interval)
+{
+    FRESULT res;
+
+    index->isOpen = 0;
+    index->interval = interval ? interval : 1;
+    index->sinceEntry = 0; //The first record after a reopen always gets an entry
+
+    res = f_open(&index->file, path, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+    if(res != FR_OK)
+    {
+        return res;
+    }
+
+    index->entries = f_size(&index->file) / sizeof(SD_IndexEntry); //A torn last entry is overwritten
+    res = f_lseek(&index->file, (FSIZE_t)index->entries * sizeof(SD_IndexEntry));
+    if(res != FR_OK)
+    {
+        f_close(&index->file);
+        return res;
+    }
+
+    index->isOpen = 1;
+    return FR_OK;
+}
+
+FRESULT SD_Index_Add(SD_Index *index, uint32_t timestamp, FSIZE_t offset)
+{
+    SD_IndexEntry entry;
+    FRESULT res;
+    UINT written;
+
+    if(!index->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    if(index->sinceEntry)
+    {
+        if(++index->sinceEntry >= index->interval)
+        {
+            index->sinceEntry = 0;
+        }
+        return FR_OK;
+    }
+
+    entry.timestamp = timestamp;
+    entry.offset = offset;
+    res = f_write(&index->file, &entry, sizeof(entry), &written); //Entries never cross a sector boundary
+    if(res != FR_OK)
+    {
+        return res;
+    }
+    if(written < sizeof(entry))
+    {
+        return FR_DENIED; //Volume is full
+    }
+
+    index->entries++;
+    if(index->interval > 1)
+    {
+        index->sinceEntry = 1;
+    }
+    return FR_OK;
+}
+
+FRESULT SD_Index_Sync(SD_Index *index)
+{
+    if(!index->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    return f_sync(&index->file);
+}
+
+FRESULT SD_Index_Close(SD_Index *index)
+{
+    if(!index->isOpen)
+    {
+        return FR_OK;
+    }
+
+    index->isOpen = 0;
+    return f_close(&index->file);
+}
+
+static FRESULT SD_Index_ReadEntry(SD_Index *index, uint32_t number, SD_IndexEntry *entry)
+{
+    FRESULT res;
+    UINT read;
+
+    res = f_lseek(&index->file, (FSIZE_t)number * sizeof(SD_IndexEntry));
+    if(res == FR_OK)
+    {
+        res = f_read(&index->file, entry, sizeof(SD_IndexEntry), &read);
+        if(res == FR_OK && read < sizeof(SD_IndexEntry))
+        {
+            res = FR_INT_ERR;
+        }
+    }
+    return res;
+}
+
+FRESULT SD_Index_Find(SD_Index *index, uint32_t timestamp, FSIZE_t limit, FSIZE_t *offset)
+{
+    SD_IndexEntry entry;
+    uint32_t low = 0;
+    uint32_t high;
+    FRESULT res = FR_OK;
+    FRESULT seek;
+
+    *offset = 0;
+    if(!index->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    high = index->entries;
+    while(low < high) //First entry that is too late (or not in the log yet), the one before it is the answer
+    {
+        uint32_t middle = low + (high - low) / 2;
+
+        res = SD_Index_ReadEntry(index, middle, &entry);
+        if(res != FR_OK)
+        {
+            break;
+        }
+
+        if(entry.timestamp <= timestamp && entry.offset < limit)
+        {
+            low = middle + 1;
+            *offset = entry.offset;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    seek = f_lseek(&index->file, (FSIZE_t)index->entries * sizeof(SD_IndexEntry)); //Back to the end for SD_Index_Add()
+    return (res != FR_OK) ? res : seek;
+}
+
+FRESULT SD_Index_Seek(SD_Index *index, FIL *log, uint32_t timestamp)
+{
+    FSIZE_t offset;
+    FRESULT res;
+
+    res = SD_Index_Find(index, timestamp, f_size(log), &offset);
+    if(res == FR_OK)
+    {
+        res = f_lseek(log, offset);
+    }
+    return res;
+}
@@ -0,0 +1,41 @@
+//sd_index.h - Sparse timestamp index kept in a sidecar file next to a log
+#ifndef SD_INDEX_H
+#define SD_INDEX_H
+
+#include "ff.h"
+
+//Every SD_Index_Add() call describes one log record (timestamp + byte offset of the record in the log file), only every
+//'interval'-th record gets an 8-byte entry in the index file. Timestamps must not decrease.
+//A lookup binary-searches the entries (about log2(entries) 8-byte reads, 64 entries share one sector) and seeks the log
+//to at most 'interval' records before the wanted time, instead of reading the log from the beginning.
+//Backward f_lseek() calls walk the cluster chain of the index from its first cluster, but 1 MB of index (131072 entries)
+//needs only a few FAT sectors, so a lookup stays a handful of sector reads however long the log gets.
+
+typedef struct
+{
+    uint32_t timestamp;     //Time of the indexed record
+    uint32_t offset;        //Byte offset of the record in the log file
+} SD_IndexEntry;            //8 bytes, stored as it is (little-endian)
+
+typedef struct
+{
+    FIL      file;
+    uint32_t entries;       //Entries in the index file
+    uint16_t interval;      //One entry per this many records
+    uint16_t sinceEntry;    //Records since the last entry
+    uint8_t  isOpen;        //1 - file is open
+} SD_Index;
+
+FRESULT SD_Index_Open(SD_Index *index, const char *path, uint16_t interval); //Opens (or creates) the index, appends to it
+FRESULT SD_Index_Add(SD_Index *index, uint32_t timestamp, FSIZE_t offset); //Call before writing every record
+FRESULT SD_Index_Sync(SD_Index *index);
+FRESULT SD_Index_Close(SD_Index *index);
+
+//Offset of the last indexed record with time <= timestamp (0 if there is none). Entries pointing at or beyond 'limit'
+//(the current log size) are ignored: the index can be synced before the log after a power cut.
+FRESULT SD_Index_Find(SD_Index *index, uint32_t timestamp, FSIZE_t limit, FSIZE_t *offset);
+
+//SD_Index_Find() + f_lseek() of the log: the next record read from 'log' is at most 'interval' records before 'timestamp'
+FRESULT SD_Index_Seek(SD_Index *index, FIL *log, uint32_t timestamp);
+
+#endif //SD_INDEX_H
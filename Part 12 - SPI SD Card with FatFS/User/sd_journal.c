@@ -0,0 +1,385 @@
+#include "sd_journal.h"
+#include "sd_binlog.h"
+#include "sd_rawlog.h"
+#include "diskio.h"
+#include <string.h>
+
+//Header sector layout (little-endian)
+#define JRNL_HDR_ID         0  //uint32, first like in the data sectors
+#define JRNL_HDR_MAGIC      4  //uint32
+#define JRNL_HDR_VERSION    8  //uint8
+#define JRNL_HDR_RECORD     9  //uint8 record size
+#define JRNL_HDR_SECTORS    12 //uint32 data sectors
+#define JRNL_HDR_CRC        16 //uint16 CRC-16 of bytes 0...15
+
+static void Put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t Get32(const uint8_t *p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint8_t SD_Journal_Drive(const SD_Journal *journal)
+{
+    return journal->file.obj.fs->pdrv;
+}
+
+static uint32_t SD_Journal_Lba(const SD_Journal *journal, uint32_t slot)
+{
+    return journal->startSector + 1 + slot; //Sector 0 of the file is the header
+}
+
+//Make the data durable, then move the directory entry size to 'sectors' data sectors (+ header), no FAT write
+static FRESULT SD_Journal_SetSize(SD_Journal *journal, uint32_t sectors)
+{
+    if(disk_ioctl(SD_Journal_Drive(journal), CTRL_SYNC, 0) != RES_OK)
+    {
+        return FR_DISK_ERR;
+    }
+    return SD_RawLog_SetDirSize(&journal->file, (FSIZE_t)(sectors + 1) * 512);
+}
+
+static FRESULT SD_Journal_Checkpoint(SD_Journal *journal)
+{
+    FRESULT res = SD_Journal_SetSize(journal, journal->next);
+
+    if(res == FR_OK)
+    {
+        journal->checkpoint = journal->next;
+    }
+    return res;
+}
+
+//Fill the sector header and write the buffer into the own slot of the sector being filled or into its shadow slot
+static FRESULT SD_Journal_WriteSlot(SD_Journal *journal, uint8_t shadow)
+{
+    uint8_t *b = journal->buffer;
+    uint16_t crc;
+
+    Put32(&b[0], journal->id);
+    Put32(&b[4], journal->next | (shadow ? SD_JOURNAL_SHADOW : 0));
+    b[8] = journal->count;
+    b[9] = journal->count >> 8;
+    b[10] = 0;
+    b[11] = 0;
+    crc = SD_BinLog_Crc16(0, b, 512);
+    b[10] = crc;
+    b[11] = crc >> 8;
+
+    if(disk_write(SD_Journal_Drive(journal), b, SD_Journal_Lba(journal, journal->next + (shadow ? 1 : 0)), 1) != RES_OK)
+    {
+        return FR_DISK_ERR;
+    }
+    return FR_OK;
+}
+
+//Read a slot into the buffer: record count + 1 if it holds a valid sector with the expected sequence, 0 otherwise
+static uint16_t SD_Journal_ReadSlot(SD_Journal *journal, uint32_t slot, uint32_t sequence)
+{
+    uint8_t *b = journal->buffer;
+    uint16_t stored;
+    uint16_t count;
+    uint16_t crc;
+
+    if(disk_read(SD_Journal_Drive(journal), b, SD_Journal_Lba(journal, slot), 1) != RES_OK)
+    {
+        return 0;
+    }
+
+    stored = b[10] | ((uint16_t)b[11] << 8);
+    count = b[8] | ((uint16_t)b[9] << 8);
+    if(Get32(&b[0]) != journal->id || Get32(&b[4]) != sequence || count > journal->perSector)
+    {
+        return 0;
+    }
+    crc = SD_BinLog_Crc16(0, b, 10);
+    crc = SD_BinLog_Crc16(crc, (const uint8_t *)"\0\0", 2);
+    crc = SD_BinLog_Crc16(crc, &b[SD_JOURNAL_SECTOR_HEADER], 512 - SD_JOURNAL_SECTOR_HEADER);
+    return (crc == stored) ? count + 1 : 0;
+}
+
+static void SD_Journal_NextSector(SD_Journal *journal)
+{
+    journal->next++;
+    journal->count = 0;
+    journal->dirty = 0;
+    journal->latest = SD_JOURNAL_SLOT_NONE;
+    memset(journal->buffer, 0, 512);
+}
+
+//Find the sector being filled: complete sectors are skipped, of a partial one the newer valid copy is loaded
+static FRESULT SD_Journal_Recover(SD_Journal *journal, uint32_t from)
+{
+    uint16_t own;
+    uint16_t shadow;
+
+    journal->next = from;
+    while(journal->next < journal->sectors)
+    {
+        own = SD_Journal_ReadSlot(journal, journal->next, journal->next);
+        if(own == journal->perSector + 1)
+        {
+            SD_Journal_NextSector(journal); //Complete
+            continue;
+        }
+
+        shadow = SD_Journal_ReadSlot(journal, journal->next + 1, journal->next | SD_JOURNAL_SHADOW);
+        if(shadow > own)
+        {
+            journal->count = shadow - 1;
+            journal->latest = SD_JOURNAL_SLOT_SHADOW;
+            if(journal->count == journal->perSector)
+            {
+                if(SD_Journal_WriteSlot(journal, 0) != FR_OK) //The cut hit the own slot of a full sector: repair it
+                {
+                    return FR_DISK_ERR;
+                }
+                SD_Journal_NextSector(journal);
+                continue;
+            }
+        }
+        else if(own)
+        {
+            SD_Journal_ReadSlot(journal, journal->next, journal->next); //The shadow read replaced the buffer
+            journal->count = own - 1;
+            journal->latest = SD_JOURNAL_SLOT_OWN;
+        }
+        else
+        {
+            memset(journal->buffer, 0, 512); //Never written (or only a torn first commit): starts empty
+            journal->count = 0;
+            journal->latest = SD_JOURNAL_SLOT_NONE;
+        }
+        break;
+    }
+
+    if(journal->next >= journal->sectors)
+    {
+        journal->count = 0;
+        journal->latest = SD_JOURNAL_SLOT_NONE;
+    }
+    return FR_OK;
+}
+
+FRESULT SD_Journal_Open(SD_Journal *journal, const char *path, uint32_t sectors, uint8_t recordSize, uint8_t *buffer, uint16_t checkpointSectors)
+{
+    FATFS *fs;
+    FRESULT res;
+    uint8_t *b = buffer;
+    uint32_t covered;
+    uint16_t crc;
+
+    journal->isOpen = 0;
+    journal->buffer = buffer;
+    journal->recordSize = recordSize;
+    journal->perSector = recordSize ? (512 - SD_JOURNAL_SECTOR_HEADER) / recordSize : 0;
+    journal->checkpointSectors = checkpointSectors;
+    journal->recovered = 0;
+    journal->count = 0;
+    journal->dirty = 0;
+    journal->latest = SD_JOURNAL_SLOT_NONE;
+
+    if(journal->perSector == 0)
+    {
+        return FR_INVALID_PARAMETER;
+    }
+
+    res = f_open(&journal->file, path, FA_OPEN_ALWAYS | FA_READ | FA_WRITE);
+    if(res != FR_OK)
+    {
+        return res;
+    }
+    fs = journal->file.obj.fs;
+
+    if(f_size(&journal->file) == 0)
+    {
+        if(sectors == 0)
+        {
+            res = FR_INVALID_PARAMETER;
+        }
+        else
+        {
+            res = SD_RawLog_Expand(&journal->file, (FSIZE_t)(sectors + 2) * 512); //Header + data + shadow slot of the last sector
+        }
+        if(res == FR_OK)
+        {
+            journal->startSector = fs->database + (LBA_t)fs->csize * (journal->file.obj.sclust - 2);
+            journal->sectors = sectors;
+
+            //A new id, different from the journal that used these clusters before (its id is the first word of its sectors)
+            if(disk_read(fs->pdrv, b, journal->startSector, 1) != RES_OK)
+            {
+                res = FR_DISK_ERR;
+            }
+            journal->id = Get32(&b[0]) + 1;
+            if(journal->id == 0 || journal->id == 0xFFFFFFFF)
+            {
+                journal->id = 1; //Not the pattern of an erased card
+            }
+
+            memset(b, 0, 512);
+            Put32(&b[JRNL_HDR_ID], journal->id);
+            Put32(&b[JRNL_HDR_MAGIC], SD_JOURNAL_MAGIC);
+            b[JRNL_HDR_VERSION] = SD_JOURNAL_VERSION;
+            b[JRNL_HDR_RECORD] = recordSize;
+            Put32(&b[JRNL_HDR_SECTORS], sectors);
+            crc = SD_BinLog_Crc16(0, b, JRNL_HDR_CRC);
+            b[JRNL_HDR_CRC] = crc;
+            b[JRNL_HDR_CRC + 1] = crc >> 8;
+            if(res == FR_OK && disk_write(fs->pdrv, b, journal->startSector, 1) != RES_OK)
+            {
+                res = FR_DISK_ERR;
+            }
+            memset(b, 0, 512);
+        }
+        if(res == FR_OK)
+        {
+            journal->next = 0;
+            res = SD_Journal_Checkpoint(journal); //Header only, f_expand() set the full size
+        }
+    }
+    else
+    {
+        journal->startSector = fs->database + (LBA_t)fs->csize * (journal->file.obj.sclust - 2);
+
+        if(disk_read(fs->pdrv, b, journal->startSector, 1) != RES_OK)
+        {
+            res = FR_DISK_ERR;
+        }
+        else if(Get32(&b[JRNL_HDR_MAGIC]) != SD_JOURNAL_MAGIC || b[JRNL_HDR_VERSION] != SD_JOURNAL_VERSION
+                || SD_BinLog_Crc16(0, b, JRNL_HDR_CRC) != (b[JRNL_HDR_CRC] | ((uint16_t)b[JRNL_HDR_CRC + 1] << 8))
+                || b[JRNL_HDR_RECORD] != recordSize)
+        {
+            res = FR_DENIED; //Not a journal of this format: never write raw sectors into it
+        }
+        else
+        {
+            journal->id = Get32(&b[JRNL_HDR_ID]);
+            journal->sectors = Get32(&b[JRNL_HDR_SECTORS]);
+
+            //The size covers the checkpointed sectors, after SD_Journal_Close() also both slots of the partial sector
+            covered = f_size(&journal->file) / 512 - 1;
+            journal->checkpoint = (covered > journal->sectors) ? journal->sectors : covered;
+            res = SD_Journal_Recover(journal, (journal->checkpoint >= 2) ? journal->checkpoint - 2 : 0);
+            if(res == FR_OK && journal->next > journal->checkpoint)
+            {
+                journal->recovered = journal->next - journal->checkpoint;
+                res = SD_Journal_Checkpoint(journal); //Complete sectors written after the last checkpoint
+            }
+            journal->checkpoint = journal->next;
+        }
+    }
+
+    if(res != FR_OK)
+    {
+        f_close(&journal->file);
+        return res;
+    }
+
+    journal->isOpen = 1;
+    return FR_OK;
+}
+
+FRESULT SD_Journal_Append(SD_Journal *journal, const void *record)
+{
+    FRESULT res = FR_OK;
+
+    if(!journal->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+    if(journal->next >= journal->sectors)
+    {
+        return FR_DENIED; //Journal is full
+    }
+
+    memcpy(&journal->buffer[SD_JOURNAL_SECTOR_HEADER + journal->count * journal->recordSize], record, journal->recordSize);
+    journal->count++;
+    journal->dirty = 1;
+
+    if(journal->count == journal->perSector)
+    {
+        if(journal->latest == SD_JOURNAL_SLOT_OWN)
+        {
+            res = SD_Journal_WriteSlot(journal, 1); //The own slot holds the last commit: keep a full copy in the shadow first
+            if(res == FR_OK && disk_ioctl(SD_Journal_Drive(journal), CTRL_SYNC, 0) != RES_OK)
+            {
+                res = FR_DISK_ERR; //...on the card before the own slot changes, the diskio cache may hold it back
+            }
+        }
+        if(res == FR_OK)
+        {
+            res = SD_Journal_WriteSlot(journal, 0);
+        }
+        if(res != FR_OK)
+        {
+            journal->count--; //The record is not stored, the caller may try again
+            return res;
+        }
+
+        SD_Journal_NextSector(journal);
+        if(journal->checkpointSectors && journal->next - journal->checkpoint >= journal->checkpointSectors)
+        {
+            res = SD_Journal_Checkpoint(journal);
+        }
+    }
+    return res;
+}
+
+FRESULT SD_Journal_Commit(SD_Journal *journal)
+{
+    uint8_t shadow;
+
+    if(!journal->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+    if(!journal->dirty)
+    {
+        return FR_OK;
+    }
+
+    shadow = (journal->latest == SD_JOURNAL_SLOT_OWN); //Never overwrite the newest good copy
+    if(SD_Journal_WriteSlot(journal, shadow) != FR_OK || disk_ioctl(SD_Journal_Drive(journal), CTRL_SYNC, 0) != RES_OK)
+    {
+        return FR_DISK_ERR;
+    }
+
+    journal->latest = shadow ? SD_JOURNAL_SLOT_SHADOW : SD_JOURNAL_SLOT_OWN;
+    journal->dirty = 0;
+    return FR_OK;
+}
+
+FRESULT SD_Journal_Close(SD_Journal *journal)
+{
+    FRESULT res;
+
+    if(!journal->isOpen)
+    {
+        return FR_OK;
+    }
+
+    res = SD_Journal_Commit(journal);
+    if(res == FR_OK)
+    {
+        res = SD_Journal_SetSize(journal, journal->next + (journal->count ? 2 : 0)); //A PC sees both slots of the partial sector
+    }
+
+    journal->isOpen = 0;
+    if(f_close(&journal->file) != FR_OK && res == FR_OK)
+    {
+        res = FR_DISK_ERR;
+    }
+    return res;
+}
+
+uint32_t SD_Journal_Records(const SD_Journal *journal)
+{
+    return journal->next * journal->perSector + journal->count;
+}
@@ -0,0 +1,61 @@
+//sd_journal.h - Power-fail-safe append log: data first, metadata later, recovery by sequence numbers
+#ifndef SD_JOURNAL_H
+#define SD_JOURNAL_H
+
+#include "ff.h"
+
+//The file is allocated in one piece with f_expand() when it is created, so the FAT is never written again.
+//Every data sector carries the journal id, its sequence number (= its index in the file) and a CRC:
+//  0  uint32 id           Same as in the header: sectors of an earlier journal in the same clusters are ignored
+//  4  uint32 sequence     Data sector index, 0...sectors-1
+//  8  uint16 count        Valid records in the sector
+// 10  uint16 crc          CRC-16/CCITT of the sector, computed with this field = 0
+// 12  records             count * recordSize bytes, a record never spans two sectors
+//Sector 0 of the file is the header (id, magic, version, record size, capacity), written once at creation.
+//Commit protocol:
+//  SD_Journal_Commit()  writes the partial sector + CTRL_SYNC: the records are durable, no FAT or directory write
+//  checkpoint           every 'checkpointSectors' complete sectors the directory entry size is moved forward (f_sync()),
+//                       always after the data it covers is on the card
+//A commit never overwrites the only good copy of its records: the partial sector is committed alternately into its own
+//slot and into the next one (the shadow slot, sequence | SD_JOURNAL_SHADOW), so a write torn by the power cut leaves the
+//previous commit intact. The shadow slot is overwritten by the next data sector once its own slot is complete.
+//SD_Journal_Open() starts at the checkpointed size and scans forward while the sectors are valid and in sequence,
+//so everything committed before a power cut is found again with at most 'checkpointSectors' + 3 sector reads.
+
+#define SD_JOURNAL_MAGIC         0x4C4E524A //"JRNL"
+#define SD_JOURNAL_VERSION       1
+#define SD_JOURNAL_SECTOR_HEADER 12
+#define SD_JOURNAL_SHADOW        0x80000000 //Sequence flag of a partial sector committed into the slot after its own
+
+#define SD_JOURNAL_SLOT_NONE     0 //Nothing committed in the partial sector yet
+#define SD_JOURNAL_SLOT_OWN      1
+#define SD_JOURNAL_SLOT_SHADOW   2
+
+typedef struct
+{
+    FIL      file;              //Kept open for the checkpoints
+    uint8_t *buffer;            //Sector being filled (512 bytes, owned by the journal while it is open)
+    uint32_t startSector;       //LBA of the header sector
+    uint32_t sectors;           //Data sectors of the file
+    uint32_t id;                //Journal id, written into every sector
+    uint32_t next;              //Data sector being filled
+    uint32_t checkpoint;        //Complete data sectors covered by the directory entry size
+    uint32_t recovered;         //Sectors found behind the checkpoint by SD_Journal_Open()
+    uint16_t perSector;         //Records per data sector
+    uint16_t count;             //Records in the buffer
+    uint16_t checkpointSectors; //Move the checkpoint after this many complete sectors (0: only at SD_Journal_Close())
+    uint8_t  recordSize;        //Bytes per record
+    uint8_t  dirty;             //1 - the buffer has records that are not on the card
+    uint8_t  latest;            //Slot with the newest committed copy of the partial sector (SD_JOURNAL_SLOT_...)
+    uint8_t  isOpen;            //1 - journal is open
+} SD_Journal;
+
+//Open 'path' and recover it, or create it with room for 'sectors' data sectors of 'recordSize'-byte records.
+//An existing journal must have the same record size (FR_DENIED otherwise), its capacity comes from its header.
+FRESULT SD_Journal_Open(SD_Journal *journal, const char *path, uint32_t sectors, uint8_t recordSize, uint8_t *buffer, uint16_t checkpointSectors);
+FRESULT SD_Journal_Append(SD_Journal *journal, const void *record); //FR_DENIED when the journal is full
+FRESULT SD_Journal_Commit(SD_Journal *journal); //Make every appended record durable (one sector write + CTRL_SYNC)
+FRESULT SD_Journal_Close(SD_Journal *journal); //Commit + final checkpoint
+uint32_t SD_Journal_Records(const SD_Journal *journal);
+
+#endif //SD_JOURNAL_H
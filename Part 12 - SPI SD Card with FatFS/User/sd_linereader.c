@@ -0,0 +1,71 @@
+#include "sd_linereader.h"
+#include <string.h>
+
+void SD_LineReader_Init(SD_LineReader *reader, FIL *file, char *buffer, uint16_t size)
+{
+    reader->file = file;
+    reader->buffer = buffer;
+    reader->size = size;
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = (size < 2); //No room for a character and the terminator
+    reader->result = FR_OK;
+}
+
+char *SD_LineReader_Next(SD_LineReader *reader, uint16_t *length)
+{
+    char *line;
+    char *newline;
+    uint16_t count;
+    UINT read;
+
+    while(1)
+    {
+        line = reader->buffer + reader->start;
+        count = reader->end - reader->start;
+
+        newline = memchr(line, '\n', count);
+        if(newline)
+        {
+            count = newline - line;
+            reader->start += count + 1;
+            break;
+        }
+
+        if(reader->eof || (reader->start == 0 && reader->end == reader->size - 1))
+        {
+            if(count == 0)
+            {
+                return 0; //Nothing left
+            }
+            reader->start = reader->end; //Last line without '\n' or a piece of a too long line
+            break;
+        }
+
+        if(reader->start)
+        {
+            memmove(reader->buffer, line, count); //Keep the beginning of a line that crosses the end of the buffer
+            reader->start = 0;
+            reader->end = count;
+        }
+
+        reader->result = f_read(reader->file, reader->buffer + reader->end, reader->size - 1 - reader->end, &read);
+        if(reader->result != FR_OK || read < (UINT)(reader->size - 1 - reader->end))
+        {
+            reader->eof = 1;
+        }
+        reader->end += read;
+    }
+
+    if(count && line[count - 1] == '\r')
+    {
+        count--; //CRLF line end
+    }
+    line[count] = 0;
+
+    if(length)
+    {
+        *length = count;
+    }
+    return line;
+}
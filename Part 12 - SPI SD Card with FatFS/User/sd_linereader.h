@@ -0,0 +1,31 @@
+//sd_linereader.h - Line reader that scans a block buffer instead of reading the file byte by byte
+#ifndef SD_LINEREADER_H
+#define SD_LINEREADER_H
+
+#include "ff.h"
+
+//f_gets() calls f_read() for every single character (validation, window check and a 1-byte copy each time).
+//SD_LineReader fills its buffer with one f_read() call, finds the line ends with memchr() and returns pointers into the
+//buffer: the '\n' (and a '\r' before it) is replaced by a 0, nothing is copied. The line stays valid until the next call.
+//A line that reaches the end of the buffer is moved to the front before the next refill, so lines may cross sector
+//boundaries. Lines longer than size - 1 bytes are returned in pieces (like f_gets() does).
+//Bigger buffers mean fewer f_read() calls: 512 bytes = one call per sector, but even line[64] beats f_gets().
+
+typedef struct
+{
+    FIL     *file;
+    char    *buffer;        //Owned by the reader while it is in use
+    uint16_t size;          //Buffer size, one byte is kept for the terminating 0
+    uint16_t start;         //First byte not returned yet
+    uint16_t end;           //End of the valid data
+    uint8_t  eof;           //1 - the file has no more data (or a read failed)
+    FRESULT  result;        //Result of the last f_read()
+} SD_LineReader;
+
+//Start reading at the current position of 'file' (f_lseek() first to start elsewhere, then Init again)
+void SD_LineReader_Init(SD_LineReader *reader, FIL *file, char *buffer, uint16_t size);
+
+//Next line without the line end, 0 terminated, 'length' (may be 0) gets its length. Returns 0 at the end of the file.
+char *SD_LineReader_Next(SD_LineReader *reader, uint16_t *length);
+
+#endif //SD_LINEREADER_H
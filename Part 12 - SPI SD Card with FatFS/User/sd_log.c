@@ -0,0 +1,117 @@
+#include "sd_log.h"
+
+FRESULT SD_Log_Open(SD_Log *log, const char *path, uint16_t syncSamples, uint32_t syncBytes)
+{
+    FRESULT res;
+
+    log->isOpen = 0;
+    log->syncSamples = syncSamples;
+    log->syncBytes = syncBytes;
+    log->samples = 0;
+    log->bytes = 0;
+    log->index = 0;
+
+    res = f_open(&log->file, path, FA_OPEN_APPEND | FA_WRITE); //The only seek to the end of the file
+    if(res == FR_OK)
+    {
+        log->isOpen = 1;
+    }
+    return res;
+}
+
+FRESULT SD_Log_Write(SD_Log *log, const void *data, UINT length)
+{
+    FRESULT res;
+    UINT written;
+
+    if(!log->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    res = f_write(&log->file, data, length, &written);
+    if(res != FR_OK)
+    {
+        return res;
+    }
+    if(written < length)
+    {
+        return FR_DENIED; //Volume is full
+    }
+
+    log->samples++;
+    log->bytes += length;
+
+    if((log->syncSamples && log->samples >= log->syncSamples) || (log->syncBytes && log->bytes >= log->syncBytes))
+    {
+        res = SD_Log_Sync(log);
+    }
+    return res;
+}
+
+void SD_Log_SetIndex(SD_Log *log, SD_Index *index)
+{
+    log->index = index;
+}
+
+FRESULT SD_Log_WriteStamped(SD_Log *log, uint32_t timestamp, const void *data, UINT length)
+{
+    FRESULT res;
+
+    if(!log->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    if(log->index)
+    {
+        res = SD_Index_Add(log->index, timestamp, f_tell(&log->file)); //Offset of the sample about to be written
+        if(res != FR_OK)
+        {
+            return res;
+        }
+    }
+    return SD_Log_Write(log, data, length);
+}
+
+FRESULT SD_Log_Sync(SD_Log *log)
+{
+    FRESULT res;
+
+    if(!log->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    log->samples = 0;
+    log->bytes = 0;
+    res = f_sync(&log->file); //Directory entry + dirty sector, then CTRL_SYNC
+    if(res == FR_OK && log->index)
+    {
+        res = SD_Index_Sync(log->index); //After the log, so a synced entry rarely points past the synced data
+    }
+    return res;
+}
+
+FRESULT SD_Log_Close(SD_Log *log)
+{
+    FRESULT res;
+
+    if(!log->isOpen)
+    {
+        return FR_OK;
+    }
+
+    log->isOpen = 0;
+    res = f_close(&log->file);
+    if(log->index)
+    {
+        FRESULT indexRes = SD_Index_Close(log->index);
+        if(res == FR_OK)
+        {
+            res = indexRes;
+        }
+        log->index = 0;
+    }
+    return res;
+}
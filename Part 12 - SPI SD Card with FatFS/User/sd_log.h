@@ -0,0 +1,34 @@
+//sd_log.h - Append logger that keeps the log file open between samples
+#ifndef SD_LOG_H
+#define SD_LOG_H
+
+#include "ff.h"
+#include "sd_index.h"
+
+//Opening the file and seeking to its end walks the cluster chain from the first cluster, so a reopen per sample
+//gets slower as the log grows. SD_Log keeps the FIL open instead: FatFs remembers the current cluster and sector,
+//every write continues from there. f_sync() writes the size into the directory entry (and flushes the cache),
+//choose the cadence to limit how much data a power cut can lose.
+
+typedef struct
+{
+    FIL      file;
+    uint16_t syncSamples;   //f_sync() after this many SD_Log_Write() calls (0: no sample limit)
+    uint16_t samples;       //Writes since the last f_sync()
+    uint32_t syncBytes;     //f_sync() after this many bytes (0: no byte limit)
+    uint32_t bytes;         //Bytes since the last f_sync()
+    SD_Index *index;        //Optional timestamp index, see SD_Log_SetIndex()
+    uint8_t  isOpen;        //1 - file is open
+} SD_Log;
+
+FRESULT SD_Log_Open(SD_Log *log, const char *path, uint16_t syncSamples, uint32_t syncBytes); //Opens (or creates) the file for appending
+FRESULT SD_Log_Write(SD_Log *log, const void *data, UINT length); //Append one sample, f_sync() when a limit is reached
+FRESULT SD_Log_Sync(SD_Log *log); //Commit everything written so far (and the index)
+FRESULT SD_Log_Close(SD_Log *log); //Closes the index too
+
+//Timestamped samples: SD_Log_WriteStamped() adds the sample to the attached index (if any) before writing it,
+//SD_Index_Seek(index, &log->file, t) then positions a reader at the samples around time t
+void SD_Log_SetIndex(SD_Log *log, SD_Index *index); //'index' must be open, 0 detaches it
+FRESULT SD_Log_WriteStamped(SD_Log *log, uint32_t timestamp, const void *data, UINT length);
+
+#endif //SD_LOG_H
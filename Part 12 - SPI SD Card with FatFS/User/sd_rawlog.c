@@ -0,0 +1,257 @@
+#include "sd_rawlog.h"
+#include "diskio.h"
+#include <string.h>
+
+FRESULT SD_RawLog_SetDirSize(FIL *file, FSIZE_t size)
+{
+    file->obj.objsize = size;
+    file->flag |= FF_FA_MODIFIED; //f_sync() only writes the directory entry when it is set, ff.c checks the value
+    return f_sync(file);
+}
+
+FRESULT SD_RawLog_Expand(FIL *file, FSIZE_t size)
+{
+    FATFS *fs = file->obj.fs;
+    DWORD block = 1;
+    DWORD saved = fs->last_clst;
+    DWORD cluster;
+    DWORD found;
+    DWORD step;
+    FRESULT res;
+
+    disk_ioctl(fs->pdrv, GET_BLOCK_SIZE, &block);
+    if(block > fs->csize && block % fs->csize == 0 && fs->database % fs->csize == 0) //Else no cluster starts on a boundary
+    {
+        step = block / fs->csize; //Clusters per erase block
+        cluster = 2 + ((block - fs->database % block) % block) / fs->csize; //First cluster on a boundary
+
+        while(cluster < fs->n_fatent)
+        {
+            fs->last_clst = cluster;
+            //Only find the first free run: the scan starts at last_clst itself (= 'cluster'), and without allocation
+            //f_expand() leaves last_clst one before the run it found
+            res = f_expand(file, size, 0);
+            if(res != FR_OK)
+            {
+                fs->last_clst = saved;
+                return res; //No contiguous space anywhere
+            }
+            found = fs->last_clst + 1;
+            if(found == cluster)
+            {
+                fs->last_clst = cluster;
+                return f_expand(file, size, 1); //Free run on the boundary: allocate it
+            }
+            if(found < cluster)
+            {
+                break; //Wrapped around, there is no aligned run left
+            }
+            cluster += (found - cluster + step - 1) / step * step; //First boundary at or after the free run
+        }
+    }
+
+    fs->last_clst = saved;
+    return f_expand(file, size, 1); //Unknown block size, unaligned volume or no aligned run: first fit
+}
+
+FRESULT SD_RawLog_Create(SD_RawLog *log, const char *path, uint32_t size, uint8_t *buffer, uint16_t checkpointSectors)
+{
+    FRESULT res;
+    FATFS *fs;
+
+    log->isOpen = 0;
+    log->buffer = buffer;
+    log->sectors = size / 512;
+    log->next = 0;
+    log->fill = 0;
+    log->tail = 0;
+    log->checkpointSectors = checkpointSectors;
+    log->sinceCheckpoint = 0;
+
+    if(log->sectors == 0)
+    {
+        return FR_INVALID_PARAMETER;
+    }
+
+    res = f_open(&log->file, path, FA_CREATE_ALWAYS | FA_WRITE);
+    if(res != FR_OK)
+    {
+        return res;
+    }
+
+    res = SD_RawLog_Expand(&log->file, (FSIZE_t)log->sectors * 512); //Contiguous clusters on an erase block boundary, FAT written once here
+    if(res == FR_OK)
+    {
+        fs = log->file.obj.fs;
+        log->startSector = fs->database + (LBA_t)fs->csize * (log->file.obj.sclust - 2); //First sector of the first cluster
+        res = SD_RawLog_SetDirSize(&log->file, 0); //f_expand() set the full size, the log starts empty (the chain stays allocated)
+    }
+
+    if(res != FR_OK)
+    {
+        f_close(&log->file);
+        return res;
+    }
+
+    log->isOpen = 1;
+    return FR_OK;
+}
+
+FRESULT SD_RawLog_PreErase(SD_RawLog *log)
+{
+    LBA_t range[2];
+
+    if(!log->isOpen || log->next >= log->sectors)
+    {
+        return FR_OK; //Nothing left to erase
+    }
+
+    range[0] = log->startSector + log->next;
+    range[1] = log->startSector + log->sectors - 1;
+    return (disk_ioctl(log->file.obj.fs->pdrv, CTRL_TRIM, range) == RES_OK) ? FR_OK : FR_DISK_ERR;
+}
+
+static FRESULT SD_RawLog_Flush(SD_RawLog *log, const uint8_t *sector)
+{
+    if(log->next >= log->sectors || log->tail)
+    {
+        return FR_DENIED; //Region is full or closed by a partial sector
+    }
+
+    if(disk_write(log->file.obj.fs->pdrv, sector, log->startSector + log->next, 1) != RES_OK)
+    {
+        return FR_DISK_ERR;
+    }
+
+    log->next++;
+    log->sinceCheckpoint++;
+    return FR_OK;
+}
+
+FRESULT SD_RawLog_Write(SD_RawLog *log, const void *data, UINT length)
+{
+    const uint8_t *source = data;
+    FRESULT res;
+    UINT chunk;
+
+    if(!log->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    while(length)
+    {
+        chunk = 512 - log->fill;
+        if(chunk > length)
+        {
+            chunk = length;
+        }
+
+        memcpy(&log->buffer[log->fill], source, chunk);
+        log->fill += chunk;
+        source += chunk;
+        length -= chunk;
+
+        if(log->fill == 512)
+        {
+            res = SD_RawLog_Flush(log, log->buffer); //Sequential single sectors: the write session keeps one CMD25 open
+            if(res != FR_OK)
+            {
+                return res; //The full buffer is kept, the next write tries it again
+            }
+            log->fill = 0;
+
+            if(log->checkpointSectors && log->sinceCheckpoint >= log->checkpointSectors)
+            {
+                res = SD_RawLog_Checkpoint(log);
+                if(res != FR_OK)
+                {
+                    return res;
+                }
+            }
+        }
+    }
+    return FR_OK;
+}
+
+FRESULT SD_RawLog_WriteSector(SD_RawLog *log, uint8_t *sector, uint16_t length)
+{
+    FRESULT res;
+
+    if(!log->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+    if(log->fill || length == 0 || length > 512)
+    {
+        return FR_INVALID_PARAMETER;
+    }
+
+    if(length < 512)
+    {
+        memset(&sector[length], 0, 512 - length);
+    }
+
+    res = SD_RawLog_Flush(log, sector);
+    if(res != FR_OK)
+    {
+        return res;
+    }
+
+    if(length < 512)
+    {
+        log->tail = length; //Last sector, SD_RawLog_Close() sets the size
+    }
+    else if(log->checkpointSectors && log->sinceCheckpoint >= log->checkpointSectors)
+    {
+        res = SD_RawLog_Checkpoint(log);
+    }
+    return res;
+}
+
+FRESULT SD_RawLog_Checkpoint(SD_RawLog *log)
+{
+    if(!log->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    log->sinceCheckpoint = 0;
+    return SD_RawLog_SetDirSize(&log->file, (FSIZE_t)log->next * 512); //Complete sectors only, f_sync() also ends the CMD25 run
+}
+
+FRESULT SD_RawLog_Close(SD_RawLog *log)
+{
+    FRESULT res = FR_OK;
+    FSIZE_t size = (FSIZE_t)log->next * 512;
+
+    if(!log->isOpen)
+    {
+        return FR_OK;
+    }
+
+    if(log->tail)
+    {
+        size -= 512 - log->tail; //Partial last sector of SD_RawLog_WriteSector()
+    }
+
+    if(log->fill)
+    {
+        memset(&log->buffer[log->fill], 0, 512 - log->fill);
+        res = SD_RawLog_Flush(log, log->buffer);
+        if(res == FR_OK)
+        {
+            size += log->fill; //Only the valid bytes of the padded sector
+            log->fill = 0;
+        }
+    }
+
+    if(res == FR_OK)
+    {
+        res = SD_RawLog_SetDirSize(&log->file, size);
+    }
+
+    log->isOpen = 0;
+    f_close(&log->file);
+    return res;
+}
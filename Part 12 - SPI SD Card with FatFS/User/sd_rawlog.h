@@ -0,0 +1,52 @@
+//sd_rawlog.h - Preallocated contiguous log file, written with raw sector writes
+#ifndef SD_RAWLOG_H
+#define SD_RAWLOG_H
+
+#include "ff.h"
+
+//The file is allocated in one piece with f_expand() when it is created, so the FAT is written only once.
+//Samples are collected in a sector buffer and every full sector goes to the next LBA of the region with disk_write(),
+//FatFs is not involved: no FAT or directory writes between the checkpoints, the card sees one long CMD25 run.
+//A checkpoint writes the number of complete sectors into the directory entry (f_sync()). After a power cut the file
+//ends at the last checkpoint, the sectors written after it are still in the allocated region.
+
+typedef struct
+{
+    FIL      file;              //Kept open for the checkpoints
+    uint8_t *buffer;            //One sector, collects the samples
+    uint32_t startSector;       //LBA of the first sector of the region
+    uint32_t sectors;           //Size of the region in sectors
+    uint32_t next;              //Sectors written so far
+    uint16_t fill;              //Bytes in the buffer
+    uint16_t tail;              //Valid bytes of a partial last sector written by SD_RawLog_WriteSector() (0: none)
+    uint16_t checkpointSectors; //Update the directory entry every this many sectors (0: only at SD_RawLog_Close())
+    uint16_t sinceCheckpoint;   //Sectors written since the last checkpoint
+    uint8_t  isOpen;            //1 - file is open
+} SD_RawLog;
+
+//f_expand() for a newly created (empty) file, placed at the start of an erase block (GET_BLOCK_SIZE: the card's
+//allocation unit) when a free run starts on one. Whole AUs are written fastest: the card never has to move the data of
+//another file that shares the AU. Falls back to the first fit. Costs one FAT scan per skipped candidate.
+FRESULT SD_RawLog_Expand(FIL *file, FSIZE_t size);
+
+//Write 'size' to the directory entry of the open file (f_sync()) without touching its cluster chain, for files that are
+//written around FatFs. The chain keeps its allocated length: clusters past 'size' stay allocated and with size 0 the
+//whole chain does (a size-0 entry normally has none), chkdsk reports them as lost clusters until the size grows again.
+FRESULT SD_RawLog_SetDirSize(FIL *file, FSIZE_t size);
+
+//Create (overwrite) 'path' with 'size' bytes of contiguous space. 'buffer' is a 512-byte work buffer owned by the log
+//until SD_RawLog_Close(), it must not be the FatFs window. Returns FR_DENIED if there is no contiguous space.
+FRESULT SD_RawLog_Create(SD_RawLog *log, const char *path, uint32_t size, uint8_t *buffer, uint16_t checkpointSectors);
+//Erase the unwritten rest of the region (CMD32/33/38 through CTRL_TRIM) before a long run, so the sector writes land on
+//erased blocks and the card programs them without erasing first. Takes about the erase time of the region once.
+FRESULT SD_RawLog_PreErase(SD_RawLog *log);
+FRESULT SD_RawLog_Write(SD_RawLog *log, const void *data, UINT length); //FR_DENIED when the region is full
+
+//Write one sector straight from the caller's buffer, nothing is copied (only while the log buffer is empty; a log that is
+//only written this way can be created with buffer = 0). length < 512 marks the last sector: the rest of 'sector' is
+//zero padded here, SD_RawLog_Close() keeps 'length' bytes of it and no more data is accepted.
+FRESULT SD_RawLog_WriteSector(SD_RawLog *log, uint8_t *sector, uint16_t length);
+FRESULT SD_RawLog_Checkpoint(SD_RawLog *log); //Set the file size to the written sectors and sync
+FRESULT SD_RawLog_Close(SD_RawLog *log); //Write the partial sector (zero padded), set the exact size, close
+
+#endif //SD_RAWLOG_H
@@ -0,0 +1,484 @@
+#include "sd_ringlog.h"
+#include "sd_binlog.h"
+#include "sd_rawlog.h"
+#include "diskio.h"
+#include <string.h>
+
+//Header sector layout (little-endian)
+#define RING_HDR_MAGIC      0  //uint32
+#define RING_HDR_VERSION    4  //uint8
+#define RING_HDR_RECORD     5  //uint8 record size
+#define RING_HDR_SECTORS    8  //uint32 data sectors
+#define RING_HDR_HEAD       12 //uint32
+#define RING_HDR_TAIL       16 //uint32
+#define RING_HDR_WRAPS      20 //uint32
+#define RING_HDR_SEQUENCE   24 //uint32 sequence of the head sector
+#define RING_HDR_CRC        28 //uint16 CRC-16 of bytes 0...27
+#define RING_HDR_COPIES     2  //Header sectors in front of the ring
+#define RING_SHADOW_SLOT    2  //Sector of the shadow slot
+#define RING_DATA_START     3  //Sector of ring index 0
+
+static void Put32(uint8_t *p, uint32_t value)
+{
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t Get32(const uint8_t *p)
+{
+    return p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static uint32_t SD_RingLog_Lba(const SD_RingLog *log, uint32_t index)
+{
+    return log->startSector + RING_DATA_START + index; //Sectors 0 and 1 of the file are the header copies, 2 the shadow slot
+}
+
+//Write the header from log->buffer into the older copy: only called when the buffer has no unsaved records
+static FRESULT SD_RingLog_WriteHeader(SD_RingLog *log)
+{
+    uint8_t *b = log->buffer;
+    uint16_t crc;
+
+    memset(b, 0, 512);
+    Put32(&b[RING_HDR_MAGIC], SD_RINGLOG_MAGIC);
+    b[RING_HDR_VERSION] = SD_RINGLOG_VERSION;
+    b[RING_HDR_RECORD] = log->recordSize;
+    Put32(&b[RING_HDR_SECTORS], log->dataSectors);
+    Put32(&b[RING_HDR_HEAD], log->head);
+    Put32(&b[RING_HDR_TAIL], log->tail);
+    Put32(&b[RING_HDR_WRAPS], log->wraps);
+    Put32(&b[RING_HDR_SEQUENCE], log->sequence);
+    crc = SD_BinLog_Crc16(0, b, RING_HDR_CRC);
+    b[RING_HDR_CRC] = crc;
+    b[RING_HDR_CRC + 1] = crc >> 8;
+
+    log->sinceHeader = 0;
+    if(disk_write(log->pdrv, b, log->startSector + log->headerCopy, 1) != RES_OK)
+    {
+        return FR_DISK_ERR;
+    }
+    log->headerCopy ^= 1;
+    return FR_OK;
+}
+
+//Read a header copy into the buffer: 1 if it is valid
+static uint8_t SD_RingLog_ReadHeader(SD_RingLog *log, uint8_t copy)
+{
+    uint8_t *b = log->buffer;
+
+    return disk_read(log->pdrv, b, log->startSector + copy, 1) == RES_OK
+           && Get32(&b[RING_HDR_MAGIC]) == SD_RINGLOG_MAGIC && b[RING_HDR_VERSION] == SD_RINGLOG_VERSION
+           && SD_BinLog_Crc16(0, b, RING_HDR_CRC) == (b[RING_HDR_CRC] | ((uint16_t)b[RING_HDR_CRC + 1] << 8));
+}
+
+//Fill the sector header (sequence, count, CRC) and write the buffer to the head sector or to the shadow slot
+static FRESULT SD_RingLog_WriteSector(SD_RingLog *log, uint8_t shadow)
+{
+    uint8_t *b = log->buffer;
+    uint16_t crc;
+
+    Put32(&b[0], log->sequence | (shadow ? SD_RINGLOG_SHADOW : 0));
+    b[4] = log->count;
+    b[5] = log->count >> 8;
+    b[6] = 0;
+    b[7] = 0;
+    crc = SD_BinLog_Crc16(0, b, 512);
+    b[6] = crc;
+    b[7] = crc >> 8;
+
+    if(disk_write(log->pdrv, b, shadow ? log->startSector + RING_SHADOW_SLOT : SD_RingLog_Lba(log, log->head), 1) != RES_OK)
+    {
+        return FR_DISK_ERR;
+    }
+    log->dirty = 0;
+    return FR_OK;
+}
+
+//Write the partial head sector into the slot without its newest copy
+static FRESULT SD_RingLog_WritePartial(SD_RingLog *log)
+{
+    uint8_t shadow = (log->latest == SD_RINGLOG_SLOT_OWN);
+    FRESULT res = SD_RingLog_WriteSector(log, shadow);
+
+    if(res == FR_OK)
+    {
+        log->latest = shadow ? SD_RINGLOG_SLOT_SHADOW : SD_RINGLOG_SLOT_OWN;
+    }
+    return res;
+}
+
+//1 - the buffer holds a valid data sector with the expected sequence number
+static uint8_t SD_RingLog_SectorValid(const SD_RingLog *log, uint32_t sequence)
+{
+    const uint8_t *b = log->buffer;
+    uint16_t stored = b[6] | ((uint16_t)b[7] << 8);
+    uint16_t count = b[4] | ((uint16_t)b[5] << 8);
+    uint16_t crc;
+
+    if(Get32(&b[0]) != sequence || count > log->perSector)
+    {
+        return 0;
+    }
+    crc = SD_BinLog_Crc16(0, b, 6);
+    crc = SD_BinLog_Crc16(crc, (const uint8_t *)"\0\0", 2);
+    crc = SD_BinLog_Crc16(crc, &b[SD_RINGLOG_SECTOR_HEADER], 512 - SD_RINGLOG_SECTOR_HEADER);
+    return crc == stored;
+}
+
+//Read a sector into the buffer, 'found' = record count + 1 if it is valid with the expected sequence number, else 0
+static FRESULT SD_RingLog_ReadSlot(SD_RingLog *log, LBA_t lba, uint32_t sequence, uint16_t *found)
+{
+    *found = 0;
+    if(disk_read(log->pdrv, log->buffer, lba, 1) != RES_OK)
+    {
+        return FR_DISK_ERR;
+    }
+    if(SD_RingLog_SectorValid(log, sequence))
+    {
+        *found = (log->buffer[4] | ((uint16_t)log->buffer[5] << 8)) + 1;
+    }
+    return FR_OK;
+}
+
+static void SD_RingLog_Advance(SD_RingLog *log)
+{
+    log->head++;
+    log->sequence++;
+    if(log->head == log->dataSectors)
+    {
+        log->head = 0;
+        log->wraps++;
+    }
+    log->tail = log->wraps ? (log->head + 1) % log->dataSectors : 0; //The head sector is being replaced
+    log->count = 0;
+    log->latest = SD_RINGLOG_SLOT_NONE;
+    memset(log->buffer, 0, 512);
+}
+
+FRESULT SD_RingLog_Open(SD_RingLog *log, const char *path, uint32_t dataSectors, uint8_t recordSize, uint8_t *buffer, uint16_t headerInterval)
+{
+    FIL file;
+    FATFS *fs;
+    FRESULT res;
+    uint8_t created = 0;
+    uint8_t newest = 0xFF; //Valid header copy with the highest head sequence
+    uint32_t sequence = 0;
+
+    log->isOpen = 0;
+    log->buffer = buffer;
+    log->recordSize = recordSize;
+    log->perSector = recordSize ? (512 - SD_RINGLOG_SECTOR_HEADER) / recordSize : 0;
+    log->dataSectors = dataSectors;
+    log->headerInterval = headerInterval;
+    log->sinceHeader = 0;
+    log->dirty = 0;
+    log->headerCopy = 0;
+    log->latest = SD_RINGLOG_SLOT_NONE;
+
+    if(log->perSector == 0 || dataSectors < 2)
+    {
+        return FR_INVALID_PARAMETER;
+    }
+
+    res = f_open(&file, path, FA_OPEN_ALWAYS | FA_WRITE);
+    if(res != FR_OK)
+    {
+        return res;
+    }
+
+    if(f_size(&file) == 0)
+    {
+        res = SD_RawLog_Expand(&file, (FSIZE_t)(dataSectors + RING_DATA_START) * 512); //Contiguous, the ring is addressed by LBA
+        created = 1;
+    }
+    else if(f_size(&file) != (FSIZE_t)(dataSectors + RING_DATA_START) * 512)
+    {
+        res = FR_DENIED; //Different ring size
+    }
+
+    fs = file.obj.fs;
+    log->pdrv = fs->pdrv;
+    log->startSector = fs->database + (LBA_t)fs->csize * (file.obj.sclust - 2);
+
+    if(f_close(&file) != FR_OK && res == FR_OK)
+    {
+        res = FR_DISK_ERR;
+    }
+    if(res != FR_OK)
+    {
+        return res;
+    }
+
+    for(uint8_t copy = 0; !created && copy < RING_HDR_COPIES; copy++)
+    {
+        if(SD_RingLog_ReadHeader(log, copy) && (newest == 0xFF || Get32(&buffer[RING_HDR_SEQUENCE]) > sequence))
+        {
+            newest = copy;
+            sequence = Get32(&buffer[RING_HDR_SEQUENCE]);
+        }
+    }
+
+    if(newest != 0xFF)
+    {
+        if(newest != RING_HDR_COPIES - 1)
+        {
+            SD_RingLog_ReadHeader(log, newest); //The other copy replaced the buffer
+        }
+        log->headerCopy = newest ^ 1; //Never overwrite the newest copy
+
+        if(buffer[RING_HDR_RECORD] != recordSize || Get32(&buffer[RING_HDR_SECTORS]) != dataSectors)
+        {
+            return FR_DENIED; //Different record format
+        }
+
+        log->head = Get32(&buffer[RING_HDR_HEAD]);
+        log->tail = Get32(&buffer[RING_HDR_TAIL]);
+        log->wraps = Get32(&buffer[RING_HDR_WRAPS]);
+        log->sequence = Get32(&buffer[RING_HDR_SEQUENCE]);
+
+        //Follow the sectors written after the last header update
+        for(uint32_t i = 0; i <= dataSectors; i++)
+        {
+            uint16_t own;
+            uint16_t shadow = 0;
+
+            res = SD_RingLog_ReadSlot(log, SD_RingLog_Lba(log, log->head), log->sequence, &own);
+            if(res == FR_OK && own <= log->perSector) //Not a complete sector: the shadow slot may hold a newer copy
+            {
+                res = SD_RingLog_ReadSlot(log, log->startSector + RING_SHADOW_SLOT, log->sequence | SD_RINGLOG_SHADOW, &shadow);
+            }
+            if(res != FR_OK)
+            {
+                return res;
+            }
+
+            if(shadow > own)
+            {
+                log->count = shadow - 1;
+                log->latest = SD_RINGLOG_SLOT_SHADOW;
+                if(log->count < log->perSector)
+                {
+                    break; //Flushed partial sector: keep filling it
+                }
+                res = SD_RingLog_WriteSector(log, 0); //The cut hit the own slot of a full sector: repair it
+                if(res != FR_OK)
+                {
+                    return res;
+                }
+            }
+            else if(own)
+            {
+                log->count = own - 1;
+                log->latest = SD_RINGLOG_SLOT_OWN;
+                if(log->count < log->perSector)
+                {
+                    SD_RingLog_ReadSlot(log, SD_RingLog_Lba(log, log->head), log->sequence, &own); //The shadow read replaced the buffer
+                    break;
+                }
+            }
+            else
+            {
+                memset(buffer, 0, 512); //Old data of an earlier round: the head sector starts empty
+                log->count = 0;
+                break;
+            }
+            SD_RingLog_Advance(log);
+        }
+    }
+    else
+    {
+        //New file (or both header copies unreadable): empty ring
+        log->head = 0;
+        log->tail = 0;
+        log->wraps = 0;
+        log->sequence = 0;
+        memset(buffer, 0, 512); //The shadow slot may hold a sector of an earlier file with a matching sequence
+        res = (disk_write(log->pdrv, buffer, log->startSector + RING_SHADOW_SLOT, 1) == RES_OK) ? FR_OK : FR_DISK_ERR;
+        if(res == FR_OK)
+        {
+            res = SD_RingLog_WriteHeader(log);
+        }
+        if(res == FR_OK)
+        {
+            res = SD_RingLog_WriteHeader(log); //Both copies: the second sector may hold a header of an earlier file
+        }
+        if(res != FR_OK)
+        {
+            return res;
+        }
+        memset(buffer, 0, 512);
+        log->count = 0;
+    }
+
+    log->isOpen = 1;
+    return FR_OK;
+}
+
+FRESULT SD_RingLog_Append(SD_RingLog *log, const void *record)
+{
+    FRESULT res;
+
+    if(!log->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    memcpy(&log->buffer[SD_RINGLOG_SECTOR_HEADER + log->count * log->recordSize], record, log->recordSize);
+    log->count++;
+    log->dirty = 1;
+
+    if(log->count < log->perSector)
+    {
+        return FR_OK;
+    }
+
+    //Sector complete: one sector write, and the header every headerInterval sectors - the cost never depends on the log size
+    res = FR_OK;
+    if(log->latest == SD_RINGLOG_SLOT_OWN)
+    {
+        res = SD_RingLog_WriteSector(log, 1); //The own slot holds the last flush: keep a full copy in the shadow first
+        if(res == FR_OK && disk_ioctl(log->pdrv, CTRL_SYNC, 0) != RES_OK)
+        {
+            res = FR_DISK_ERR; //...on the card before the own slot changes, the diskio cache may hold it back
+        }
+    }
+    if(res == FR_OK)
+    {
+        res = SD_RingLog_WriteSector(log, 0);
+    }
+    if(res != FR_OK)
+    {
+        log->count--;
+        return res;
+    }
+    SD_RingLog_Advance(log);
+
+    if(++log->sinceHeader >= log->headerInterval)
+    {
+        res = SD_RingLog_WriteHeader(log); //The buffer is empty at this point, it can hold the header
+        memset(log->buffer, 0, 512);
+    }
+    return res;
+}
+
+FRESULT SD_RingLog_Flush(SD_RingLog *log)
+{
+    FRESULT res = FR_OK;
+
+    if(!log->isOpen)
+    {
+        return FR_INVALID_OBJECT;
+    }
+
+    if(log->dirty)
+    {
+        res = SD_RingLog_WritePartial(log); //Same sequence, the full sector replaces both copies later
+    }
+    if(res == FR_OK)
+    {
+        res = (disk_ioctl(log->pdrv, CTRL_SYNC, 0) == RES_OK) ? FR_OK : FR_DISK_ERR;
+    }
+    return res;
+}
+
+FRESULT SD_RingLog_Close(SD_RingLog *log)
+{
+    FRESULT res;
+
+    if(!log->isOpen)
+    {
+        return FR_OK;
+    }
+
+    res = SD_RingLog_Flush(log);
+    if(res == FR_OK)
+    {
+        res = SD_RingLog_WriteHeader(log); //Next open doesn't need to follow any sector
+    }
+    if(res == FR_OK)
+    {
+        res = (disk_ioctl(log->pdrv, CTRL_SYNC, 0) == RES_OK) ? FR_OK : FR_DISK_ERR;
+    }
+    log->isOpen = 0;
+    return res;
+}
+
+uint32_t SD_RingLog_Count(const SD_RingLog *log)
+{
+    uint32_t fullSectors = log->wraps ? log->dataSectors - 1 : log->head;
+
+    return fullSectors * log->perSector + log->count;
+}
+
+uint16_t SD_RingLog_ReadLast(SD_RingLog *log, void *records, uint16_t count)
+{
+    uint8_t *out = records;
+    uint32_t available;
+    uint32_t index;
+    uint16_t remaining;
+    uint16_t take;
+
+    if(!log->isOpen)
+    {
+        return 0;
+    }
+
+    available = SD_RingLog_Count(log);
+    if(count > available)
+    {
+        count = available;
+    }
+
+    //Newest records first, filled from the end of the output
+    remaining = count;
+    take = (remaining < log->count) ? remaining : log->count;
+    remaining -= take;
+    memcpy(&out[(uint32_t)remaining * log->recordSize], &log->buffer[SD_RINGLOG_SECTOR_HEADER + (log->count - take) * log->recordSize], (uint32_t)take * log->recordSize);
+
+    if(remaining == 0)
+    {
+        return count;
+    }
+
+    //Older sectors go through the same buffer: the partial head sector is saved first and read back at the end
+    if(log->dirty && SD_RingLog_WritePartial(log) != FR_OK)
+    {
+        return 0;
+    }
+
+    index = log->head;
+    while(remaining)
+    {
+        index = index ? index - 1 : log->dataSectors - 1;
+
+        if(disk_read(log->pdrv, log->buffer, SD_RingLog_Lba(log, index), 1) != RES_OK
+           || !SD_RingLog_SectorValid(log, log->sequence - ((log->head - index + log->dataSectors) % log->dataSectors)))
+        {
+            break; //Damaged sector: return the newer records only
+        }
+
+        take = (remaining < log->perSector) ? remaining : log->perSector;
+        remaining -= take;
+        memcpy(&out[(uint32_t)remaining * log->recordSize], &log->buffer[SD_RINGLOG_SECTOR_HEADER + (log->perSector - take) * log->recordSize], (uint32_t)take * log->recordSize);
+    }
+
+    if(remaining)
+    {
+        memmove(out, &out[(uint32_t)remaining * log->recordSize], (uint32_t)(count - remaining) * log->recordSize);
+        count -= remaining;
+    }
+
+    //Restore the head sector from the slot with its newest copy
+    if(log->count)
+    {
+        disk_read(log->pdrv, log->buffer, (log->latest == SD_RINGLOG_SLOT_SHADOW) ? log->startSector + RING_SHADOW_SLOT : SD_RingLog_Lba(log, log->head), 1);
+    }
+    else
+    {
+        memset(log->buffer, 0, 512);
+    }
+    return count;
+}
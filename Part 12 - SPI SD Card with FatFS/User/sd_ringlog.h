@@ -0,0 +1,62 @@
+//sd_ringlog.h - Fixed-size circular log file: preallocated, raw sector writes, header with head/tail/wrap counter
+#ifndef SD_RINGLOG_H
+#define SD_RINGLOG_H
+
+#include "ff.h"
+
+//File layout: sectors 0 and 1 are two copies of the header, sector 2 is the shadow slot of the partial head sector,
+//sectors 3...dataSectors+2 form the ring. The file is allocated in one piece with f_expand() when it is created and
+//never changes size, FatFs is only used to find it, the ring is written with disk_write().
+//Data sector: uint32 sequence (| SD_RINGLOG_SHADOW in the shadow slot), uint16 record count, uint16 CRC-16 (with this
+//field = 0), then the records.
+//The header is only rewritten every 'headerInterval' completed sectors, alternately into the two copies, so a header
+//write torn by a power cut leaves the previous one intact. SD_RingLog_Flush() writes the partial head sector
+//alternately into its own slot and into the shadow slot, like the partial sector of sd_journal.h (the sector after the
+//head is the oldest data of the ring, so the shadow slot has a fixed place here): a torn flush leaves the previous one
+//intact. When a sector whose last flush is in its own slot fills up, its full copy goes to the shadow slot first.
+//After a power cut SD_RingLog_Open() starts from the newer valid header copy and follows the sectors whose sequence
+//numbers continue it, taking the newer of the two copies of the head sector, so nothing written before the last
+//SD_RingLog_Flush() is lost. A record never spans two sectors.
+
+#define SD_RINGLOG_MAGIC        0x474F4C52 //"RLOG"
+#define SD_RINGLOG_VERSION      3 //1: a single header sector, 2: no shadow slot
+#define SD_RINGLOG_SHADOW       0x80000000 //Sequence flag of the head sector copy in the shadow slot
+
+#define SD_RINGLOG_SLOT_NONE    0 //Nothing flushed of the head sector yet
+#define SD_RINGLOG_SLOT_OWN     1
+#define SD_RINGLOG_SLOT_SHADOW  2
+#define SD_RINGLOG_SECTOR_HEADER 8
+
+typedef struct
+{
+    uint8_t *buffer;            //Sector being filled (512 bytes, owned by the log while it is open)
+    uint8_t  pdrv;              //Physical drive of the volume
+    uint8_t  recordSize;        //Bytes per record
+    uint8_t  dirty;             //1 - the buffer has records that are not on the card
+    uint8_t  isOpen;            //1 - log is open
+    uint8_t  headerCopy;        //Header sector (0/1) the next header write goes to, the other one holds the newest
+    uint8_t  latest;            //SD_RINGLOG_SLOT_x holding the newest flushed copy of the head sector
+    uint16_t perSector;         //Records per data sector
+    uint16_t count;             //Records in the buffer
+    uint16_t headerInterval;    //Write the header after this many completed sectors
+    uint16_t sinceHeader;       //Completed sectors since the last header write
+    uint32_t startSector;       //LBA of the first header copy
+    uint32_t dataSectors;       //Ring size in sectors
+    uint32_t head;              //Ring index of the sector being filled
+    uint32_t tail;              //Ring index of the oldest complete sector
+    uint32_t wraps;             //Number of times the head went around the ring
+    uint32_t sequence;          //Sequence number of the sector being filled
+} SD_RingLog;
+
+//Open 'path' or create it with 'dataSectors' ring sectors (+2 header sectors, +1 shadow slot) for 'recordSize'-byte records.
+//An existing file must have the same geometry (FR_DENIED otherwise). 'buffer' is a 512-byte work buffer.
+FRESULT SD_RingLog_Open(SD_RingLog *log, const char *path, uint32_t dataSectors, uint8_t recordSize, uint8_t *buffer, uint16_t headerInterval);
+FRESULT SD_RingLog_Append(SD_RingLog *log, const void *record); //Overwrites the oldest sector when the ring is full
+FRESULT SD_RingLog_Flush(SD_RingLog *log); //Write the partial sector into the slot without the newest copy (no header needed)
+FRESULT SD_RingLog_Close(SD_RingLog *log); //Flush + header
+uint32_t SD_RingLog_Count(const SD_RingLog *log); //Records that can be read back
+//Copy the newest 'count' records to 'records' (oldest first), returns the number of records copied. Only the needed
+//sectors are read, backwards from the head: the cost depends on 'count', not on the size of the ring.
+uint16_t SD_RingLog_ReadLast(SD_RingLog *log, void *records, uint16_t count);
+
+#endif //SD_RINGLOG_H
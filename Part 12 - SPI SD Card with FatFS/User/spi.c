@@ -1,4 +1,12 @@
 #include "spi.h"
+#include "bench.h"
+
+volatile uint8_t  SPI1_DMA_Done = 1; //No transfer is running after reset
+volatile uint32_t SPI1_DMA_WaitCycles = 0;
+
+static SPI1_DMA_Callback spiDmaCallback = 0; //Optional user callback for the end of the transfer
+static uint8_t spiDmaTxDummy = 0xFF; //Source byte when we only want to receive (SD card reads)
+static uint8_t spiDmaRxDummy; //Sink byte when we only want to transmit (SD card writes)
 
 void SPI1_Init(void)
 {
@@ -39,9 +47,22 @@ void SPI1_Init(void)
 
 void SPI1_SetSpeed(uint8_t SPI_BaudRatePrescaler)
 {   
-    SPI_InitTypeDef SPI_InitStructure = {0};
-    SPI_InitStructure.SPI_BaudRatePrescaler = SPI_BaudRatePrescaler;    
-    SPI_Init(SPI1, &SPI_InitStructure);   
+    //Only the BR[2:0] bits are changed, SPI_Init() would also reset the mode, CPOL/CPHA and NSS settings
+    SPI1_SetMode(SPI_BaudRatePrescaler, SPI_CTLR1_BR_MASK);
+}
+
+uint8_t SPI1_SetMode(uint16_t bits, uint16_t mask)
+{
+    uint16_t ctlr1 = SPI1->CTLR1;
+
+    if(((ctlr1 ^ bits) & mask) == 0)
+    {
+        return 0; //Already set up, no need to wait for the bus
+    }
+
+    while (SPI_I2S_GetFlagStatus(SPI1, SPI_I2S_FLAG_BSY) == SET); //Don't change the clock in the middle of a byte
+    SPI1->CTLR1 = (ctlr1 & ~mask) | (bits & mask);
+    return 1;
 }
 
 uint8_t SPI_TransferByte(uint8_t data)
@@ -64,5 +85,121 @@ uint8_t SPI_TransferByte(uint8_t data)
     return SPI_I2S_ReceiveData(SPI1);                              
 }
 
+void SPI1_DMA_Init(void)
+{
+    NVIC_InitTypeDef NVIC_InitStructure = {0};
+
+    RCC_AHBPeriphClockCmd(RCC_AHBPeriph_DMA1, ENABLE);
+
+    DMA_DeInit(SPI1_DMA_RX_CH);
+    DMA_DeInit(SPI1_DMA_TX_CH);
+
+    //Only the RX channel raises an interrupt: when the last byte is received, the last byte was also sent
+    NVIC_InitStructure.NVIC_IRQChannel = DMA1_Channel2_IRQn;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 1;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+
+    SPI1_DMA_Done = 1;
+}
+
+void SPI1_DMA_SetCallback(SPI1_DMA_Callback callback)
+{
+    spiDmaCallback = callback;
+}
+
+void SPI1_DMA_Start(const uint8_t *txBuf, uint8_t *rxBuf, uint16_t length)
+{
+    DMA_InitTypeDef dma = {0};
+
+    SPI1_DMA_Done = 0;
+
+    DMA_Cmd(SPI1_DMA_RX_CH, DISABLE);
+    DMA_Cmd(SPI1_DMA_TX_CH, DISABLE);
+    (void)SPI_I2S_ReceiveData(SPI1); //Drop a leftover byte, so the first DMA byte belongs to this transfer
+
+    dma.DMA_PeripheralBaseAddr = (uint32_t)&SPI1->DATAR;
+    dma.DMA_BufferSize         = length;
+    dma.DMA_PeripheralInc      = DMA_PeripheralInc_Disable; //Always the same data register
+    dma.DMA_PeripheralDataSize = DMA_PeripheralDataSize_Byte;
+    dma.DMA_MemoryDataSize     = DMA_MemoryDataSize_Byte;
+    dma.DMA_Mode               = DMA_Mode_Normal;
+    dma.DMA_M2M                = DMA_M2M_Disable;
+
+    //RX: SPI1 -> buffer (or the dummy byte without incrementing)
+    dma.DMA_MemoryBaseAddr     = rxBuf ? (uint32_t)rxBuf : (uint32_t)&spiDmaRxDummy;
+    dma.DMA_MemoryInc          = rxBuf ? DMA_MemoryInc_Enable : DMA_MemoryInc_Disable;
+    dma.DMA_DIR                = DMA_DIR_PeripheralSRC;
+    dma.DMA_Priority           = DMA_Priority_VeryHigh; //RX must win, otherwise we get an overrun
+    DMA_Init(SPI1_DMA_RX_CH, &dma);
+
+    //TX: buffer (or 0xFF without incrementing) -> SPI1
+    dma.DMA_MemoryBaseAddr     = txBuf ? (uint32_t)txBuf : (uint32_t)&spiDmaTxDummy;
+    dma.DMA_MemoryInc          = txBuf ? DMA_MemoryInc_Enable : DMA_MemoryInc_Disable;
+    dma.DMA_DIR                = DMA_DIR_PeripheralDST;
+    dma.DMA_Priority           = DMA_Priority_High;
+    DMA_Init(SPI1_DMA_TX_CH, &dma);
+
+    DMA_ClearFlag(DMA1_FLAG_GL2 | DMA1_FLAG_GL3);
+    DMA_ITConfig(SPI1_DMA_RX_CH, DMA_IT_TC, ENABLE);
+
+    DMA_Cmd(SPI1_DMA_RX_CH, ENABLE); //RX first, so it is ready when the first byte arrives
+    DMA_Cmd(SPI1_DMA_TX_CH, ENABLE);
+    SPI_I2S_DMACmd(SPI1, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, ENABLE); //Start: TXE is already set, so the TX request fires immediately
+}
+
+void SPI1_DMA_Abort(void)
+{
+    //Stop the transfer and give the SPI back to the polling functions
+    SPI_I2S_DMACmd(SPI1, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, DISABLE);
+    DMA_Cmd(SPI1_DMA_RX_CH, DISABLE);
+    DMA_Cmd(SPI1_DMA_TX_CH, DISABLE);
+    SPI1_DMA_Done = 1;
+}
 
+uint8_t SPI1_DMA_Wait(void)
+{
+    uint32_t retry = 0;
+    uint32_t start = Bench_Now();
+
+    while(!SPI1_DMA_Done)
+    {
+        retry++;
+        if(retry > SPI1_DMA_TIMEOUT)
+        {
+            SPI1_DMA_Abort();
+            return 1;
+        }
+    }
 
+    SPI1_DMA_WaitCycles += Bench_Now() - start;
+    return 0;
+}
+
+uint8_t SPI1_DMA_Transfer(const uint8_t *txBuf, uint8_t *rxBuf, uint16_t length)
+{
+    SPI1_DMA_Start(txBuf, rxBuf, length);
+    return SPI1_DMA_Wait();
+}
+
+void DMA1_Channel2_IRQHandler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
+
+void DMA1_Channel2_IRQHandler(void)
+{
+    if(DMA_GetITStatus(DMA1_IT_TC2) != RESET)
+    {
+        DMA_ClearITPendingBit(DMA1_IT_GL2);
+
+        SPI_I2S_DMACmd(SPI1, SPI_I2S_DMAReq_Rx | SPI_I2S_DMAReq_Tx, DISABLE); //SPI_TransferByte() polls the flags again
+        DMA_Cmd(SPI1_DMA_RX_CH, DISABLE);
+        DMA_Cmd(SPI1_DMA_TX_CH, DISABLE);
+
+        SPI1_DMA_Done = 1; //Flag for the polling code
+
+        if(spiDmaCallback)
+        {
+            spiDmaCallback(); //Callback for the interrupt-driven code
+        }
+    }
+}
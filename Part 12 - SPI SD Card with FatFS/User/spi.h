@@ -1,8 +1,35 @@
+#ifndef SPI_H
+#define SPI_H
+
 #include "ch32v00x.h"
 
 extern GPIO_TypeDef* SD_CD_PORT; //CD port (GPIOx)
 extern uint16_t      SD_CD_PIN; //CD pin (GPIO_Pin_x)
 
+//DMA mapping for SPI1 on CH32V003 (RM: Table 8-2 DMA1 peripheral mapping table)
+#define SPI1_DMA_RX_CH          DMA1_Channel2 //SPI1_RX
+#define SPI1_DMA_TX_CH          DMA1_Channel3 //SPI1_TX
+#define SPI1_DMA_TIMEOUT        0x3FFFF       //Wait loop iterations before a DMA transfer is aborted
+
+#define SPI_CTLR1_BR_MASK       0x0038        //BR[2:0]: baud rate prescaler bits of SPI1->CTLR1
+#define SPI_CTLR1_MODE_MASK     0x0083        //CPHA, CPOL and LSBFIRST bits of SPI1->CTLR1 (SPI_CPOL_x | SPI_CPHA_x | SPI_FirstBit_x)
+
+typedef void (*SPI1_DMA_Callback)(void); //Called from the DMA ISR when a transfer is finished
+
+extern volatile uint8_t  SPI1_DMA_Done;       //1 - no transfer running, 0 - DMA transfer in progress
+extern volatile uint32_t SPI1_DMA_WaitCycles; //SysTick ticks spent spinning in SPI1_DMA_Wait() (benchmark counter)
+
 void SPI1_Init(void);
 void SPI1_SetSpeed(uint8_t SPI_BaudRatePrescaler);
+uint8_t SPI1_SetMode(uint16_t bits, uint16_t mask); //Change only the CTLR1 bits in 'mask', 1 - something changed
 uint8_t   SPI_TransferByte(uint8_t TxData);
+
+//DMA transfers
+void SPI1_DMA_Init(void);
+void SPI1_DMA_SetCallback(SPI1_DMA_Callback callback);
+void SPI1_DMA_Start(const uint8_t *txBuf, uint8_t *rxBuf, uint16_t length); //txBuf == 0 -> clock out 0xFF, rxBuf == 0 -> discard the received bytes
+uint8_t SPI1_DMA_Wait(void); //0 - finished, 1 - timeout
+void SPI1_DMA_Abort(void); //Stop a running transfer without calling the callback
+uint8_t SPI1_DMA_Transfer(const uint8_t *txBuf, uint8_t *rxBuf, uint16_t length); //Blocking Start() + Wait()
+
+#endif //SPI_H
\ No newline at end of file
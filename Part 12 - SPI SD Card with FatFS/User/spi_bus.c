@@ -0,0 +1,150 @@
+#include "spi_bus.h"
+
+volatile uint32_t SPI_Bus_Switches = 0;
+volatile uint32_t SPI_Bus_Deferred = 0;
+
+static SPI_BusDevice *spiBusDevices = 0; //Registered devices, the newest first
+static SPI_BusDevice *volatile spiBusOwner = 0;
+static uint8_t spiBusDraining = 0; //SPI_Bus_Release() is running deferred work
+
+void SPI_Bus_Register(SPI_BusDevice *dev, GPIO_TypeDef *csPort, uint16_t csPin, uint16_t mode, uint8_t prescaler)
+{
+    GPIO_InitTypeDef GPIO_InitStructure = {0};
+    SPI_BusDevice *d;
+
+    dev->csPort = csPort;
+    dev->csPin = csPin;
+    dev->ctlr1 = (mode & SPI_CTLR1_MODE_MASK) | (prescaler & SPI_CTLR1_BR_MASK);
+
+    if(csPort)
+    {
+        GPIO_WriteBit(csPort, csPin, Bit_SET); //Deselected before the pin starts to drive
+        GPIO_InitStructure.GPIO_Pin = csPin;
+        GPIO_InitStructure.GPIO_Mode = GPIO_Mode_Out_PP;
+        GPIO_InitStructure.GPIO_Speed = GPIO_Speed_50MHz;
+        GPIO_Init(csPort, &GPIO_InitStructure);
+    }
+
+    for(d = spiBusDevices; d; d = d->next)
+    {
+        if(d == dev)
+        {
+            return; //Already in the list (SD_SPI_Init() of every card init)
+        }
+    }
+    dev->pending = 0;
+    dev->next = spiBusDevices;
+    spiBusDevices = dev;
+}
+
+static void SPI_Bus_Configure(SPI_BusDevice *dev)
+{
+    if(SPI1_SetMode(dev->ctlr1, SPI_BUS_CTLR1_MASK))
+    {
+        SPI_Bus_Switches++;
+    }
+}
+
+static void SPI_Bus_Free(SPI_BusDevice *dev)
+{
+    if(dev->csPort)
+    {
+        GPIO_WriteBit(dev->csPort, dev->csPin, Bit_SET);
+    }
+    spiBusOwner = 0;
+}
+
+void SPI_Bus_SetSpeed(SPI_BusDevice *dev, uint8_t prescaler)
+{
+    dev->ctlr1 = (dev->ctlr1 & ~SPI_CTLR1_BR_MASK) | (prescaler & SPI_CTLR1_BR_MASK);
+    if(spiBusOwner == dev)
+    {
+        SPI_Bus_Configure(dev);
+    }
+}
+
+uint8_t SPI_Bus_Acquire(SPI_BusDevice *dev)
+{
+    uint8_t busy;
+
+    __disable_irq(); //An interrupt must see either the old or the new owner
+    busy = (spiBusOwner != 0 && spiBusOwner != dev);
+    if(!busy)
+    {
+        spiBusOwner = dev;
+    }
+    __enable_irq();
+
+    if(busy)
+    {
+        return 1;
+    }
+    SPI_Bus_Configure(dev);
+    return 0;
+}
+
+void SPI_Bus_Release(SPI_BusDevice *dev)
+{
+    SPI_BusDevice *d;
+    SPI_BusWork work;
+
+    if(spiBusOwner != dev)
+    {
+        return; //Not acquired (e.g. SD_Deselect() before a command)
+    }
+    SPI_Bus_Free(dev);
+
+    if(spiBusDraining)
+    {
+        return; //Released by deferred work, the loop below goes on
+    }
+    spiBusDraining = 1;
+
+    d = spiBusDevices;
+    while(d)
+    {
+        __disable_irq();
+        work = spiBusOwner ? 0 : d->pending;
+        if(work)
+        {
+            d->pending = 0;
+            spiBusOwner = d;
+        }
+        __enable_irq();
+
+        if(work)
+        {
+            SPI_Bus_Configure(d);
+            work();
+            SPI_Bus_Free(d);
+            d = spiBusDevices; //An interrupt may have deferred more work meanwhile
+        }
+        else
+        {
+            d = d->next;
+        }
+    }
+
+    spiBusDraining = 0;
+}
+
+uint8_t SPI_Bus_Run(SPI_BusDevice *dev, SPI_BusWork work)
+{
+    if(spiBusOwner)
+    {
+        dev->pending = work; //A second interrupt before the release merges with the first one
+        SPI_Bus_Deferred++;
+        return 1;
+    }
+
+    spiBusOwner = dev;
+    SPI_Bus_Configure(dev);
+    work();
+    SPI_Bus_Free(dev);
+    return 0;
+}
+
+SPI_BusDevice *SPI_Bus_Owner(void)
+{
+    return spiBusOwner;
+}
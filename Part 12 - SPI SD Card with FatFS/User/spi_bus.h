@@ -0,0 +1,43 @@
+//spi_bus.h - SPI1 shared by several devices: per-device clock/mode presets and bus ownership
+#ifndef SPI_BUS_H
+#define SPI_BUS_H
+
+#include "spi.h"
+
+//Every device on SPI1 registers its mode (CPOL, CPHA, bit order), clock and chip select once. Before a device uses
+//the bus it acquires it: only the CTLR1 bits that differ from the previous owner are written (SPI1_SetMode()), so
+//going back and forth between two devices costs a register compare and, after a change, one write.
+//  Main loop:  SPI_Bus_Acquire(), transfers with its CS low, SPI_Bus_Release().
+//  Interrupt:  SPI_Bus_Run(dev, work). If the main loop holds the bus, 'work' is deferred and runs from the
+//              SPI_Bus_Release() of the owner (main loop context), else it runs at once.
+//The interrupts that call SPI_Bus_Run() must not preempt each other (same priority, the default). While the spi_queue.h
+//engine runs, its user holds the bus. The configuration only changes while every registered CS is high.
+
+#define SPI_BUS_CTLR1_MASK  (SPI_CTLR1_MODE_MASK | SPI_CTLR1_BR_MASK) //The CTLR1 bits a device preset owns
+
+typedef void (*SPI_BusWork)(void);
+
+typedef struct SPI_BusDevice SPI_BusDevice;
+
+struct SPI_BusDevice
+{
+    GPIO_TypeDef         *csPort;   //GPIOx of the chip select, 0 - the device drives its own
+    uint16_t              csPin;    //GPIO_Pin_x
+    uint16_t              ctlr1;    //Preset: CPOL, CPHA, LSBFIRST and BR bits of CTLR1
+    volatile SPI_BusWork  pending;  //Work deferred by SPI_Bus_Run()
+    SPI_BusDevice        *next;     //List of the registered devices
+};
+
+extern volatile uint32_t SPI_Bus_Switches; //Acquires that changed CTLR1 (benchmark counter)
+extern volatile uint32_t SPI_Bus_Deferred; //SPI_Bus_Run() calls that had to wait for the owner
+
+//'mode': SPI_CPOL_x | SPI_CPHA_x | SPI_FirstBit_x, 'prescaler': SPI_BaudRatePrescaler_x. The CS pin becomes a push-pull
+//output, high (its GPIO clock must be on). Registering a device again only updates its preset.
+void SPI_Bus_Register(SPI_BusDevice *dev, GPIO_TypeDef *csPort, uint16_t csPin, uint16_t mode, uint8_t prescaler);
+void SPI_Bus_SetSpeed(SPI_BusDevice *dev, uint8_t prescaler); //Change the clock of the preset, applied at once if 'dev' owns the bus
+uint8_t SPI_Bus_Acquire(SPI_BusDevice *dev); //Main loop: 0 - 'dev' owns the bus (again), configured; 1 - busy
+void SPI_Bus_Release(SPI_BusDevice *dev); //Raise its CS, free the bus, then run the deferred work
+uint8_t SPI_Bus_Run(SPI_BusDevice *dev, SPI_BusWork work); //Interrupt: 0 - done, 1 - deferred to the owner's release
+SPI_BusDevice *SPI_Bus_Owner(void); //0 - the bus is free
+
+#endif //SPI_BUS_H
@@ -0,0 +1,124 @@
+#include "spi_queue.h"
+#include "bench.h"
+
+static SPI1_Xfer *volatile spiQueueHead = 0; //Running descriptor, the rest of the queue hangs on its 'next'
+static SPI1_Xfer *spiQueueTail = 0;
+
+//Lower CS and hand the descriptor to the DMA
+static void SPI1_Queue_Start(SPI1_Xfer *xfer)
+{
+    xfer->state = SPI1_XFER_ACTIVE;
+    if(xfer->csPort)
+    {
+        GPIO_WriteBit(xfer->csPort, xfer->csPin, Bit_RESET);
+    }
+    SPI1_DMA_Start(xfer->tx, xfer->rx, xfer->length);
+}
+
+//DMA completion callback (interrupt)
+static void SPI1_Queue_Complete(void)
+{
+    SPI1_Xfer *xfer = spiQueueHead;
+
+    if(!xfer || xfer->state != SPI1_XFER_ACTIVE)
+    {
+        return; //A blocking SPI1_DMA_Transfer() outside the queue (SD driver)
+    }
+
+    spiQueueHead = xfer->next;
+    if(!spiQueueHead)
+    {
+        spiQueueTail = 0;
+    }
+
+    if(xfer->csPort && !(xfer->flags & SPI1_XFER_HOLD_CS))
+    {
+        GPIO_WriteBit(xfer->csPort, xfer->csPin, Bit_SET);
+    }
+    xfer->state = SPI1_XFER_DONE;
+
+    if(xfer->callback)
+    {
+        xfer->callback(xfer); //A submit from here is started at once if the queue ran empty, else queued
+    }
+
+    if(spiQueueHead && spiQueueHead->state == SPI1_XFER_QUEUED)
+    {
+        SPI1_Queue_Start(spiQueueHead);
+    }
+}
+
+void SPI1_Queue_Init(void)
+{
+    spiQueueHead = 0;
+    spiQueueTail = 0;
+    SPI1_DMA_SetCallback(SPI1_Queue_Complete);
+}
+
+void SPI1_Queue_Submit(SPI1_Xfer *xfer)
+{
+    uint8_t idle;
+
+    xfer->next = 0;
+    xfer->state = SPI1_XFER_QUEUED;
+
+    NVIC_DisableIRQ(DMA1_Channel2_IRQn); //The completion interrupt changes the list too
+    idle = (spiQueueHead == 0);
+    if(idle)
+    {
+        spiQueueHead = xfer;
+    }
+    else
+    {
+        spiQueueTail->next = xfer;
+    }
+    spiQueueTail = xfer;
+    NVIC_EnableIRQ(DMA1_Channel2_IRQn);
+
+    if(idle)
+    {
+        SPI1_Queue_Start(xfer); //Nothing running: no interrupt will pick it up
+    }
+}
+
+uint8_t SPI1_Queue_Busy(void)
+{
+    return spiQueueHead != 0;
+}
+
+uint8_t SPI1_Queue_Wait(SPI1_Xfer *xfer)
+{
+    SPI1_Xfer *seen = spiQueueHead;
+    uint32_t retry = 0;
+    uint32_t start = Bench_Now();
+
+    while(xfer->state != SPI1_XFER_DONE)
+    {
+        if(spiQueueHead != seen)
+        {
+            seen = spiQueueHead; //The queue moves: the timeout is per descriptor, not for the whole chain
+            retry = 0;
+        }
+        retry++;
+        if(retry > SPI1_DMA_TIMEOUT)
+        {
+            //Stop the DMA, release every chip select and drop the queue: the states stay QUEUED/ACTIVE
+            NVIC_DisableIRQ(DMA1_Channel2_IRQn);
+            SPI1_DMA_Abort();
+            for(seen = spiQueueHead; seen; seen = seen->next)
+            {
+                if(seen->csPort)
+                {
+                    GPIO_WriteBit(seen->csPort, seen->csPin, Bit_SET);
+                }
+            }
+            spiQueueHead = 0;
+            spiQueueTail = 0;
+            NVIC_EnableIRQ(DMA1_Channel2_IRQn);
+            return 1;
+        }
+    }
+
+    SPI1_DMA_WaitCycles += Bench_Now() - start;
+    return 0;
+}
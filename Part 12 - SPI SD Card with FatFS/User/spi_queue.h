@@ -0,0 +1,43 @@
+//spi_queue.h - Queued SPI1 DMA transfers with chip select handling and completion callbacks
+#ifndef SPI_QUEUE_H
+#define SPI_QUEUE_H
+
+#include "spi.h"
+
+//A descriptor describes one full-duplex DMA transfer. Submitted descriptors are linked into a FIFO queue and run one
+//after the other: the DMA interrupt of the finished one raises CS, calls its callback and starts the next one, so the
+//CPU only touches the bus between descriptors. The callback may submit more descriptors (e.g. a command, then the data
+//phase chosen by the response). The descriptors are owned by the caller and must stay valid until they are done.
+//While the queue runs, SPI_TransferByte(), SPI1_DMA_Start() and SPI1_DMA_SetCallback() must not be used.
+
+#define SPI1_XFER_HOLD_CS   0x01 //Leave CS low after the transfer: the next descriptor continues the same frame
+
+//SPI1_Xfer.state
+#define SPI1_XFER_IDLE      0 //Never submitted
+#define SPI1_XFER_QUEUED    1 //Waiting for the bus
+#define SPI1_XFER_ACTIVE    2 //DMA running
+#define SPI1_XFER_DONE      3 //Finished, CS released (unless SPI1_XFER_HOLD_CS)
+
+typedef struct SPI1_Xfer SPI1_Xfer;
+typedef void (*SPI1_XferCallback)(SPI1_Xfer *xfer); //Runs in the DMA interrupt
+
+struct SPI1_Xfer
+{
+    const uint8_t    *tx;       //Bytes to send, 0 - clock out 0xFF
+    uint8_t          *rx;       //Received bytes, 0 - discard
+    uint16_t          length;   //Bytes (1-65535)
+    uint16_t          csPin;    //GPIO_Pin_x of the chip select
+    GPIO_TypeDef     *csPort;   //GPIOx of the chip select, 0 - the caller drives CS
+    SPI1_XferCallback callback; //0 - none
+    void             *context;  //Free for the callback
+    uint8_t           flags;    //SPI1_XFER_...
+    volatile uint8_t  state;    //SPI1_XFER_IDLE/QUEUED/ACTIVE/DONE
+    SPI1_Xfer        *next;     //Queue link, used by the engine
+};
+
+void SPI1_Queue_Init(void); //After SPI1_Init() and SPI1_DMA_Init(): takes over the DMA completion callback
+void SPI1_Queue_Submit(SPI1_Xfer *xfer); //Append, the transfer starts at once if the bus is idle (also from a callback)
+uint8_t SPI1_Queue_Busy(void); //1 - a descriptor is running or waiting
+uint8_t SPI1_Queue_Wait(SPI1_Xfer *xfer); //Spin until 'xfer' is done, 0 - done, 1 - timeout (the queue is dropped)
+
+#endif //SPI_QUEUE_H
@@ -7,6 +7,16 @@
 #include "../User/SDCard/spi.h"
 #include "../User/SDCard/sd.h"
 #include "../User/SDCard/ff.h"
+#include "../User/SDCard/diskio.h"
+#include "../User/SDCard/sd_bench.h"
+#include "../User/SDCard/sd_log.h"
+#include "../User/SDCard/sd_binlog.h"
+#include "../User/SDCard/sd_ringlog.h"
+#include "../User/SDCard/sd_index.h"
+#include "../User/SDCard/sd_linereader.h"
+#include "../User/SDCard/sd_capture.h"
+#include "../User/SDCard/sd_journal.h"
+#include "../User/SDCard/sd_boot.h"
 #include "stdlib.h"
 #include "string.h"
 
@@ -20,6 +30,38 @@
   #define DBG_PRINTF(...)   do { } while (0)
 #endif
 
+#define SD_BENCHMARK 0 //1: run the SD card benchmarks after the card is initialized
+#define SD_BENCH_SECTORS 64 //Number of sectors used by the benchmarks
+#define SD_BENCH_WRITE 0 //1: also benchmark writes - it OVERWRITES the last sectors of the card!
+#define SD_BENCH_FILE "0:BIGFILE.BIN" //Large file for the file read benchmark (copy it on the card from a PC)
+#define SD_BENCH_LOG_FILE "0:BENCH.TXT" //Scratch file of the append benchmark (overwritten)
+#define SD_BENCH_LOG_KB 2048 //Size of the growing log of the reopen vs. keep-open benchmark
+#define SD_BENCH_STREAM_FILE "0:STREAM.LOG" //Scratch file of the FatFs vs. preallocated raw log benchmark (overwritten)
+
+#define SD_LOG_KEEP_OPEN 0 //1: keep the log file open (SD_Log), 0: open, seek to the end and close for every sample
+#define SD_LOG_SYNC_SAMPLES 5 //f_sync() after this many samples (0: off)
+#define SD_LOG_SYNC_BYTES 0 //f_sync() after this many bytes (0: off)
+#define SD_LOG_INDEX 0 //1: SD_LOG_KEEP_OPEN writes "ms,temperature" lines and a sparse timestamp index into SD_LOG_INDEX_FILE
+#define SD_LOG_INDEX_FILE "0:Writetes.idx"
+#define SD_LOG_INDEX_INTERVAL 16 //One index entry per this many lines
+#define SD_LOG_BINARY 0 //1: log binary records into SD_LOG_BINARY_FILE instead of text (needs a 512-byte frame buffer)
+#define SD_LOG_BINARY_FILE "0:TEMP.BIN" //Convert it with Tools/binlog2csv on a PC
+#define SD_LOG_FLAG_RESET 0x01 //Record flags: first sample after a reset, so a PC can tell the sessions apart
+#define SD_LOG_RING 0 //1: log binary records into a fixed-size ring file that never fills the card (needs a 512-byte buffer)
+#define SD_LOG_RING_FILE "0:TEMP.RNG"
+#define SD_LOG_RING_SECTORS 2048 //Ring size: 1 MB = 129024 records of 8 bytes
+#define SD_LOG_JOURNAL 0 //1: commit every binary record to a power-fail-safe journal (needs a 512-byte buffer)
+#define SD_LOG_JOURNAL_FILE "0:TEMP.JRN"
+#define SD_LOG_JOURNAL_SECTORS 2048 //Capacity: 1 MB = 126976 records of 8 bytes
+#define SD_CAPTURE_DEMO 0 //1: capture samples from a TIM2 interrupt into SD_CAPTURE_FILE (needs 2 x 512 bytes, turn the other buffers off)
+#define SD_CAPTURE_FILE "0:CAPTURE.BIN"
+#define SD_CAPTURE_RATE 20000 //Samples/s, raise it until overruns show up
+#define SD_CAPTURE_SECTORS 1024 //512 kB = 131072 samples of 4 bytes
+#define SD_CAPTURE_PREERASE 1 //1: erase the capture file region (CMD38) before the capture starts
+#define SD_FAST_BOOT 0 //1: log right after reset: no countdown or read demo, the DS18B20 converts while the card starts,
+                       //   card type, geometry and SPI clock come from the flash cache of SD_Boot (the program must end before its page)
+#define SD_BOOT_TIME 0 //1: print the time from reset to the first logged sample (TIM1 counts milliseconds, up to 65 s)
+
 //SD card detect port and pin - Some card modules have their CD port available
 #define SD_DETECT_PORT  GPIOC
 #define SD_DETECT_PIN   GPIO_Pin_4
@@ -28,13 +70,38 @@
 FATFS fs;                     //FatFs File system object
 FIL filewrite;                //File object 
 FIL fileread;                 //File object 
+#if SD_LOG_BINARY
+SD_BinLog binLogger;          //Binary log of the while(1) loop
+uint8_t logFrame[512];        //Frame being filled
+#elif SD_LOG_RING
+SD_RingLog ringLogger;        //Ring log of the while(1) loop
+uint8_t logFrame[512];        //Sector being filled
+#elif SD_LOG_JOURNAL
+SD_Journal journal;           //Journal of the while(1) loop
+uint8_t logFrame[512];        //Sector being filled
+#elif SD_LOG_KEEP_OPEN
+SD_Log logger;                //Open log file of the while(1) loop
+#if SD_LOG_INDEX
+SD_Index logIndex;            //Timestamp -> file offset, every SD_LOG_INDEX_INTERVAL-th line
+#endif
+#endif
 FRESULT result;               //File operation results 
 UINT fnum;                    //Number of successful file write/read 
 const char msg[] = "CH32V003F4P6 - SD Card with FatFS0.15a + DS18B20 temperature logger!\n"; //Welcome message
 uint16_t buflen;        //Buffer length used for the thermometer
 char buf[16];           //Thermometer data buffer
 char line[64];          //SD read/write line buffer
+SD_LineReader reader;   //Line reader of the read test (uses line[] as its buffer)
+#if SD_BENCHMARK
+uint8_t benchBuffer[512]; //One sector for the benchmarks
+#endif
 uint8_t counter = 0;    //Counter for writing only a limited amount of data in the while(1)
+#if SD_CAPTURE_DEMO
+uint8_t captureBuffer[2][SD_CAPTURE_SECTOR]; //Interrupt fills one, the main loop writes the other
+SD_RawLog captureLog;   //Preallocated file of the capture
+SD_Capture capture;     //Double buffer state and overrun counter
+volatile uint32_t captureNumber = 0; //Running sample number, a PC can find the dropped samples from the gaps
+#endif
 
 
 void USARTx_CFG(void)
@@ -164,19 +231,32 @@ uint8_t ds18b20_read_byte(void)
     return byte;
 }
 
-int16_t ds18b20_get_temperature_raw(void)
+uint8_t ds18b20_converting = 0; //1 - ds18b20_start_conversion() started a conversion that wasn't read yet
+
+uint8_t ds18b20_start_conversion(void) //Returns right away, the conversion runs in the sensor
 {
     if (ds18b20_init() == 0) //If the initialization was unsuccesful
     {
-        DBG_PRINTF("Error");
-        return -10000; //error
+        return 0;
     } 
         
     ds18b20_write_byte(0xCC); //Skip ROM
     ds18b20_write_byte(0x44); //Convert T
     ds18b20_set_pin_mode(0);  //Release bus so line goes HIGH
+    ds18b20_converting = 1;
+    return 1;
+}
 
-    // Wait for conversion (750 ms max for 12-bit)
+int16_t ds18b20_get_temperature_raw(void)
+{
+    if (!ds18b20_converting && ds18b20_start_conversion() == 0) //Start one unless it is already running
+    {
+        DBG_PRINTF("Error");
+        return -10000; //error
+    } 
+    ds18b20_converting = 0;
+
+    // Wait for conversion (750 ms max for 12-bit), finished already if it was started early enough
     while(!ds18b20_read_bit());
 
     ds18b20_init(); //Initialize again
@@ -198,6 +278,86 @@ int printFloatTemp(int16_t raw, char *buf, size_t buflen)
     return snprintf(buf, buflen, "%d.%01d\n", whole, frac); //Return with the length of the float "string" + pass the values to the buf buffer
 }
 
+#if SD_BOOT_TIME
+void initializeBootTimer(void) //Free-running millisecond counter, read with TIM_GetCounter(TIM1)
+{
+    TIM_TimeBaseInitTypeDef TIM_TimeBaseStructure = {0};
+
+    RCC_APB2PeriphClockCmd(RCC_APB2Periph_TIM1, ENABLE);
+
+    TIM_TimeBaseStructure.TIM_Period = 0xFFFF;
+    TIM_TimeBaseStructure.TIM_Prescaler = SystemCoreClock / 1000 - 1; //1 kHz timer clock
+    TIM_TimeBaseStructure.TIM_ClockDivision = TIM_CKD_DIV1;
+    TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
+    TIM_TimeBaseInit(TIM1, &TIM_TimeBaseStructure);
+
+    TIM_Cmd(TIM1, ENABLE);
+}
+#endif
+
+#if SD_CAPTURE_DEMO
+void initializeCaptureTimer(uint32_t rate)
+{
+    TIM_TimeBaseInitTypeDef TIM_TimeBaseStructure = {0};
+    NVIC_InitTypeDef NVIC_InitStructure = {0};
+
+    RCC_APB1PeriphClockCmd(RCC_APB1Periph_TIM2, ENABLE);
+
+    TIM_TimeBaseStructure.TIM_Period = 1000000 / rate - 1; //Update event at 'rate' Hz
+    TIM_TimeBaseStructure.TIM_Prescaler = SystemCoreClock / 1000000 - 1; //1 MHz timer clock
+    TIM_TimeBaseStructure.TIM_ClockDivision = TIM_CKD_DIV1;
+    TIM_TimeBaseStructure.TIM_CounterMode = TIM_CounterMode_Up;
+    TIM_TimeBaseInit(TIM2, &TIM_TimeBaseStructure);
+
+    TIM_ITConfig(TIM2, TIM_IT_Update, ENABLE);
+
+    NVIC_InitStructure.NVIC_IRQChannel = TIM2_IRQn;
+    NVIC_InitStructure.NVIC_IRQChannelPreemptionPriority = 0;
+    NVIC_InitStructure.NVIC_IRQChannelSubPriority = 1;
+    NVIC_InitStructure.NVIC_IRQChannelCmd = ENABLE;
+    NVIC_Init(&NVIC_InitStructure);
+
+    TIM_Cmd(TIM2, ENABLE);
+}
+
+void TIM2_IRQHandler(void) __attribute__((interrupt("WCH-Interrupt-fast")));
+
+void TIM2_IRQHandler(void)
+{
+    if(TIM_GetITStatus(TIM2, TIM_IT_Update) != RESET)
+    {
+        uint32_t sample = captureNumber++; //Replace it with an ADC or accelerometer reading
+        SD_Capture_Put(&capture, &sample); //Copies 4 bytes, never waits for the card
+        TIM_ClearITPendingBit(TIM2, TIM_IT_Update);
+    }
+}
+
+void runCapture(void)
+{
+    result = SD_RawLog_Create(&captureLog, SD_CAPTURE_FILE, (uint32_t)SD_CAPTURE_SECTORS * SD_CAPTURE_SECTOR, 0, 64); //Checkpoint every 32 kB
+    if(result != FR_OK)
+    {
+        DBG_PRINTF("Capture file failed: (%d)\n", result);
+        return;
+    }
+#if SD_CAPTURE_PREERASE
+    SD_RawLog_PreErase(&captureLog); //Sector writes land on erased blocks: shorter busy times, fewer overruns
+#endif
+    SD_Capture_Init(&capture, &captureLog, captureBuffer[0], captureBuffer[1], sizeof(uint32_t));
+
+    initializeCaptureTimer(SD_CAPTURE_RATE);
+    while(capture.sectors < SD_CAPTURE_SECTORS - 1 && result == FR_OK)
+    {
+        result = SD_Capture_Service(&capture); //The only SD work of the loop: write the full buffer
+    }
+    TIM_Cmd(TIM2, DISABLE);
+
+    SD_Capture_Stop(&capture); //Partial last sector + exact file size
+    DBG_PRINTF("Capture: %lu samples, %lu overruns, %lu sectors at %lu samples/s\n", (unsigned long)capture.samples,
+               (unsigned long)capture.overruns, (unsigned long)capture.sectors, (unsigned long)SD_CAPTURE_RATE);
+}
+#endif
+
 /*********************************************************************
  * @fn      main
  *
@@ -209,6 +369,9 @@ int main(void)
 {
     NVIC_PriorityGroupConfig(NVIC_PriorityGroup_1);
     SystemCoreClockUpdate();
+#if SD_BOOT_TIME
+    initializeBootTimer();
+#endif
     Delay_Init();
 
     if(DEBUG_ == 1) //Don't use the USART when debug is not enabled
@@ -221,6 +384,9 @@ int main(void)
     //Here I cheat because I don't have CD pin, so I read the CS which should have 1 in the beginning
 
     DBG_PRINTF("CH32V003F4P6 - Part 12 - SPI SD Card\n"); //Print some welcome message
+#if SD_FAST_BOOT
+    ds18b20_start_conversion(); //The 750 ms conversion runs while the card starts, the first sample doesn't wait for it again
+#else
     DBG_PRINTF("Insert SD Card in the next 10 seconds!\n");
 
     for(int i = 0; i < 10; i++) //"Visual countdown"
@@ -228,6 +394,7 @@ int main(void)
         Delay_Ms(1000);
         DBG_PRINTF("."); //Print a new point on the serial terminal every second
     }
+#endif
 
     uint8_t cardDetect = !SD_Detect(SD_DETECT_PORT, SD_DETECT_PIN); //present == 1, not present == 0
     DBG_PRINTF("Card: %d\n", cardDetect); 
@@ -241,7 +408,11 @@ int main(void)
     {
         DBG_PRINTF("\nSD card detected!\n");
 
+#if SD_FAST_BOOT
+        if(SD_Boot_Init(fs.win)) //Init at the fastest legal clock, the rest from the flash cache if it is the same card
+#else
         if(SD_Initialize()) //After successful insertion detection, check for successful init()
+#endif
         {
             DBG_PRINTF("SD card error!\n");
             Delay_Ms(500);
@@ -251,12 +422,45 @@ int main(void)
             DBG_PRINTF("SD card initialized!\n");
             uint32_t sd_size = SD_GetSectorCount();//get the number of sectors
             DBG_PRINTF("SD Card size: %d MB.\n", sd_size >> 11);
+            DBG_PRINTF("Allocation unit: %lu kB.\n", (unsigned long)(SD_Info.auSectors >> 1)); //Preallocated logs start on AU boundaries
 
-            SD_HighSpeed(); //Set the SD card to a higher speed after initializing the card
+#if SD_FAST_BOOT
+            DBG_PRINTF("Card parameters: %s\n", SD_Boot_Status == SD_BOOT_CACHED ? "from flash" : "measured");
+            if(!SD_Boot_PageFree())
+            {
+                DBG_PRINTF("The program reaches into the SD_Boot flash page, every start is a cold one.\n");
+            }
+#else
+            //Find the fastest SPI clock that still reads the card correctly. FatFs is not mounted yet, so its window buffer is free.
+            SD_SpeedResult speedResults[7];
+            uint8_t speedSteps;
+            if(SD_TuneSpeed(fs.win, 0, speedResults, &speedSteps) == 0)
+            {
+                for(uint8_t i = 0; i < speedSteps; i++) //Report every step that was tried
+                {
+                    DBG_PRINTF("SPI %lu Hz: %s, %lu KB/s\n", (unsigned long)speedResults[i].clockHz, speedResults[i].passed ? "OK" : "FAIL", (unsigned long)speedResults[i].kbps);
+                }
+            }
+
+            SD_HighSpeed(); //Set the SD card to a higher speed after initializing the card (tuned clock)
+#endif
+
+#if SD_BENCHMARK
+            SD_Bench_TransferModes(benchBuffer, sd_size - SD_BENCH_SECTORS, SD_BENCH_SECTORS, SD_BENCH_WRITE); //Polling vs DMA at the end of the card
+#if SD_BENCH_WRITE
+            SD_Bench_WriteSession(benchBuffer, sd_size - SD_BENCH_SECTORS, SD_BENCH_SECTORS); //CMD24 per sector vs one open CMD25
+#endif
+            SD_Bench_ReadSession(benchBuffer, sd_size - SD_BENCH_SECTORS, SD_BENCH_SECTORS); //CMD17 per sector vs one open CMD18
+            SD_Bench_RawSuite(benchBuffer, sd_size - SD_BENCH_SECTORS, SD_BENCH_SECTORS, SD_BENCH_WRITE); //1/4/8/32-sector transfers with latency histograms
+#endif
         }
     }   
 
+#if SD_FAST_BOOT
+    result = SD_Boot_Mount(&fs); //No second card init, the volume is compared with the flash cache
+#else
     result = f_mount(&fs,"0:",1); //Mount the file system
+#endif
     //--
     if(result == FR_NO_FILESYSTEM)
     {
@@ -272,6 +476,25 @@ int main(void)
         DBG_PRINTF("Successful mounting!\n");
     }
 
+#if SD_BENCHMARK
+    SD_Bench_FileRead(SD_BENCH_FILE, benchBuffer); //Sequential file read with and without the CMD18 stream
+    SD_Bench_FileScan(SD_BENCH_FILE, benchBuffer, sizeof(line)); //Line-sized reads with and without the read-ahead
+    SD_Bench_FileSuite(SD_BENCH_LOG_FILE, benchBuffer); //f_write() appends and f_open()/f_lseek()/f_close() cycles
+    SD_Bench_LogGrowth(SD_BENCH_LOG_FILE, benchBuffer, SD_BENCH_LOG_KB, 32); //Per-sample cost while the log grows
+    SD_Bench_StreamLog(SD_BENCH_STREAM_FILE, benchBuffer, 256, 64); //SD_Log vs. preallocated SD_RawLog, checkpoint every 32 kB
+    SD_Bench_RecordFormats("0:TEMP.TXT", "0:TEMPB.BIN", benchBuffer, 1000); //ASCII lines vs. binary records
+    SD_Bench_RingLog("0:BENCH.RNG", benchBuffer, 64, 20000); //Ring log append cost over several wraps + tail query
+    SD_Bench_IndexLookup("0:BENCH.LOG", "0:BENCH.IDX", 40000, 16); //Indexed time lookup vs. f_gets() scan
+    SD_Bench_LineRead("0:BENCH.LOG", benchBuffer); //f_gets() vs. SD_LineReader on the same text
+    SD_Bench_Durability("0:DURABLE.LOG", "0:DURABLE.JRN", benchBuffer, 500); //Cost of making every sample durable
+    SD_Bench_SpiQueue(benchBuffer); //Polled vs. DMA vs. queued descriptor chains, bus use and CPU cycles per byte
+    SD_Bench_BusSwitch(); //Arbiter cost with and without a CTLR1 change (SD card <-> ADXL345 preset)
+#if SD_CAPTURE_DEMO
+    SD_Bench_Capture("0:CAPTURE.BIN", captureBuffer[0], captureBuffer[1], 256, 4, 64); //No-loss rate limit of the double buffer
+#endif
+#endif
+
+#if !SD_FAST_BOOT
     Delay_Ms(5000);
     DBG_PRINTF("READ TEST: \n");
 
@@ -281,15 +504,18 @@ int main(void)
         DBG_PRINTF("f_open failed: %u\n", result);
     }
 
-    while (f_gets(line, sizeof(line), &fileread)) 
+    SD_LineReader_Init(&reader, &fileread, line, sizeof(line)); //Reads 63 bytes at once instead of f_gets() byte by byte
+    char *text;
+    while ((text = SD_LineReader_Next(&reader, 0)) != 0) //Points into line[], the line end is removed
     {              
-        DBG_PRINTF("%s", line); //Print each line with 1 second delay between
+        DBG_PRINTF("%s\n", text); //Print each line with 1 second delay between
         Delay_Ms(1000);
     }
 
     f_close(&fileread); //Close the file
 
     Delay_Ms(5000);
+#endif
     DBG_PRINTF("\nWRITE TEST: \n");
 
     result = f_open(&filewrite, "0:Writetes.txt", FA_CREATE_ALWAYS | FA_WRITE ); //Create (overwrite) a new file with the name
@@ -315,12 +541,101 @@ int main(void)
         DBG_PRINTF("Failed to open/create file\n");
     }    
 
+#if SD_CAPTURE_DEMO
+    runCapture(); //High-rate interrupt logging through the double buffer
+#endif
+
+#if SD_LOG_BINARY
+    result = SD_BinLog_Open(&binLogger, SD_LOG_BINARY_FILE, logFrame, 0); //Continues an existing log
+    if(result != FR_OK)
+    {
+        DBG_PRINTF("Failed to open the log: (%d)\n", result);
+    }
+#elif SD_LOG_RING
+    result = SD_RingLog_Open(&ringLogger, SD_LOG_RING_FILE, SD_LOG_RING_SECTORS, sizeof(SD_BinRecord), logFrame, 16); //Header every 16 sectors
+    if(result != FR_OK)
+    {
+        DBG_PRINTF("Failed to open the log: (%d)\n", result);
+    }
+#elif SD_LOG_JOURNAL
+    result = SD_Journal_Open(&journal, SD_LOG_JOURNAL_FILE, SD_LOG_JOURNAL_SECTORS, sizeof(SD_BinRecord), logFrame, 16); //Directory entry every 16 sectors
+    if(result != FR_OK)
+    {
+        DBG_PRINTF("Failed to open the log: (%d)\n", result);
+    }
+    else if(journal.recovered)
+    {
+        DBG_PRINTF("Recovered %lu sectors after a power cut\n", (unsigned long)journal.recovered);
+    }
+#elif SD_LOG_KEEP_OPEN
+    result = SD_Log_Open(&logger, "0:Writetes.txt", SD_LOG_SYNC_SAMPLES, SD_LOG_SYNC_BYTES); //Opened once, the loop only appends
+    if(result != FR_OK)
+    {
+        DBG_PRINTF("Failed to open the log: (%d)\n", result);
+    }
+#if SD_LOG_INDEX
+    else if(SD_Index_Open(&logIndex, SD_LOG_INDEX_FILE, SD_LOG_INDEX_INTERVAL) == FR_OK)
+    {
+        SD_Log_SetIndex(&logger, &logIndex); //Synced and closed together with the log
+    }
+#endif
+#endif
+
     while(1)
     {
         if(counter < 10) //Only print 10 times
         {
             DBG_PRINTF("Update.\n");
 
+#if SD_LOG_BINARY
+            int16_t raw = ds18b20_get_temperature_raw(); //Fetch the raw temperature reading
+            result = SD_BinLog_Append(&binLogger, (uint32_t)counter * 1000, 0, raw, counter ? 0 : SD_LOG_FLAG_RESET); //8 bytes, no float formatting
+            if(result == FR_OK && SD_LOG_SYNC_SAMPLES && (counter + 1) % SD_LOG_SYNC_SAMPLES == 0)
+            {
+                result = SD_BinLog_Flush(&binLogger); //Write the partial frame, so a power cut loses at most SD_LOG_SYNC_SAMPLES samples
+            }
+            if (result != FR_OK)
+            {
+                DBG_PRINTF("Error writing...");
+            }
+#elif SD_LOG_RING
+            SD_BinRecord record = {(uint32_t)counter * 1000, ds18b20_get_temperature_raw(), 0, 0};
+            result = SD_RingLog_Append(&ringLogger, &record); //Overwrites the oldest records when the ring is full
+            if(result == FR_OK && SD_LOG_SYNC_SAMPLES && (counter + 1) % SD_LOG_SYNC_SAMPLES == 0)
+            {
+                result = SD_RingLog_Flush(&ringLogger); //Partial sector, alternately in two slots: found again after a power cut
+            }
+            if (result != FR_OK)
+            {
+                DBG_PRINTF("Error writing...");
+            }
+#elif SD_LOG_JOURNAL
+            SD_BinRecord record = {(uint32_t)counter * 1000, ds18b20_get_temperature_raw(), 0, 0};
+            result = SD_Journal_Append(&journal, &record);
+            if(result == FR_OK)
+            {
+                result = SD_Journal_Commit(&journal); //Durable now: one sector write, no FAT or directory update
+            }
+            if (result != FR_OK)
+            {
+                DBG_PRINTF("Error writing...");
+            }
+#elif SD_LOG_KEEP_OPEN
+            int16_t raw = ds18b20_get_temperature_raw(); //Fetch the raw temperature reading
+#if SD_LOG_INDEX
+            uint32_t timestamp = (uint32_t)counter * 1000; //Sample time in ms
+            int length = snprintf(line, sizeof(line), "%lu,", (unsigned long)timestamp);
+            length += printFloatTemp(raw, line + length, sizeof(line) - length);
+            result = SD_Log_WriteStamped(&logger, timestamp, line, length); //Index entry (every SD_LOG_INDEX_INTERVAL-th line) + append
+#else
+            int length = printFloatTemp(raw, line, sizeof(line)); //Calculate the floating point temperature and return with the length of the number from the conversion
+            result = SD_Log_Write(&logger, line, length); //Append, f_sync() every SD_LOG_SYNC_SAMPLES samples
+#endif
+            if (result != FR_OK)
+            {
+                DBG_PRINTF("Error writing...");
+            }
+#else
             result = f_open(&filewrite, "0:Writetes.txt", FA_OPEN_ALWAYS | FA_WRITE); //Open the previously created file for writing
             if (result != FR_OK) 
             { 
@@ -345,12 +660,59 @@ int main(void)
             }
             
             f_close(&filewrite); //Close the file
+#endif
             counter++; //Increase the counter
+#if SD_BOOT_TIME
+            if(counter == 1)
+            {
+                DBG_PRINTF("First sample logged %u ms after reset\n", TIM_GetCounter(TIM1));
+            }
+#endif
             Delay_Ms(1000); //Wait 1 second
+#if SD_USE_WRITE_SESSION
+            SD_WriteSessionTick(1000); //Close a streaming write that has been idle for too long
+#endif
         }
-        else
+        else if(counter == 10)
         {
-        
+#if SD_LOG_BINARY
+            SD_BinLog_Close(&binLogger); //Writes the last frame
+#elif SD_LOG_RING
+            SD_BinRecord last[4];
+            uint16_t found = SD_RingLog_ReadLast(&ringLogger, last, 4); //Tail query: only the newest sectors are read
+            for(uint16_t i = 0; i < found; i++)
+            {
+                DBG_PRINTF("Last: %lu ms, raw %d\n", (unsigned long)last[i].timestamp, last[i].value);
+            }
+            SD_RingLog_Close(&ringLogger); //Writes the partial sector and the header
+#elif SD_LOG_JOURNAL
+            SD_Journal_Close(&journal); //Moves the file size over the last records
+#elif SD_LOG_KEEP_OPEN
+#if SD_LOG_INDEX
+            SD_Log_Sync(&logger); //A second FIL only sees the synced file size
+            result = f_open(&fileread, "0:Writetes.txt", FA_READ);
+            if(result == FR_OK && SD_Index_Seek(&logIndex, &fileread, 5000) == FR_OK) //Jump close to t = 5 s instead of reading from the start
+            {
+                char *text;
+                SD_LineReader_Init(&reader, &fileread, line, sizeof(line)); //After the seek
+                while((text = SD_LineReader_Next(&reader, 0)) != 0)
+                {
+                    if(text[0] >= '0' && text[0] <= '9' && strtoul(text, 0, 10) >= 5000) //Skip the lines before it (less than SD_LOG_INDEX_INTERVAL)
+                    {
+                        DBG_PRINTF("From 5 s: %s\n", text);
+                    }
+                }
+            }
+            f_close(&fileread);
+#endif
+            SD_Log_Close(&logger); //Writes the last samples and the file size (and closes the index)
+#endif
+#if DISKIO_CACHE_SECTORS > 0
+            DISK_CACHE_STATS stats;
+            disk_cache_stats(&stats); //How much work the logging did on the card
+            DBG_PRINTF("Cache hits: %lu, misses: %lu, sectors written: %lu\n", (unsigned long)stats.hits, (unsigned long)stats.misses, (unsigned long)stats.sectorsWritten);
+#endif
+            counter++; //Print it only once
         }
     }
 }